@@ -17,13 +17,41 @@
  * Author: Vratislav Podzimek <vpodzime@redhat.com>
  */
 
+#define _GNU_SOURCE
 #include <glib.h>
 #include <string.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <mntent.h>
+#include <linux/fs.h>
+#include <linux/btrfs.h>
+#include <linux/btrfs_tree.h>
 #include <utils.h>
 
 #include "btrfs.h"
 
+/* profiles added in kernel 5.5, not known by older kernel headers */
+#ifndef BTRFS_BLOCK_GROUP_RAID1C3
+#define BTRFS_BLOCK_GROUP_RAID1C3 (1ULL << 9)
+#endif
+#ifndef BTRFS_BLOCK_GROUP_RAID1C4
+#define BTRFS_BLOCK_GROUP_RAID1C4 (1ULL << 10)
+#endif
+
+/* older kernel headers' profile mask doesn't include the profiles above */
+#define ALL_PROFILES_MASK (BTRFS_BLOCK_GROUP_PROFILE_MASK | BTRFS_BLOCK_GROUP_RAID1C3 | BTRFS_BLOCK_GROUP_RAID1C4)
+
+#ifndef BTRFS_SPACE_INFO_GLOBAL_RSV
+#define BTRFS_SPACE_INFO_GLOBAL_RSV (1ULL << 49)
+#endif
+
 /**
  * SECTION: btrfs
  * @short_description: plugin for operations with BTRFS devices
@@ -89,6 +117,134 @@ void bd_btrfs_filesystem_info_free (BDBtrfsFilesystemInfo *info) {
     g_free (info);
 }
 
+BDBtrfsSpaceInfo* bd_btrfs_space_info_copy (BDBtrfsSpaceInfo *info) {
+    BDBtrfsSpaceInfo *new_info = g_new0 (BDBtrfsSpaceInfo, 1);
+
+    new_info->type = info->type;
+    new_info->profile = g_strdup (info->profile);
+    new_info->device = g_strdup (info->device);
+    new_info->total = info->total;
+    new_info->used = info->used;
+
+    return new_info;
+}
+
+void bd_btrfs_space_info_free (BDBtrfsSpaceInfo *info) {
+    g_free (info->profile);
+    g_free (info->device);
+    g_free (info);
+}
+
+BDBtrfsBalanceStatus* bd_btrfs_balance_status_copy (BDBtrfsBalanceStatus *status) {
+    BDBtrfsBalanceStatus *new_status = g_new0 (BDBtrfsBalanceStatus, 1);
+
+    new_status->state = status->state;
+    new_status->expected = status->expected;
+    new_status->considered = status->considered;
+    new_status->completed = status->completed;
+    new_status->rate = status->rate;
+    new_status->eta = status->eta;
+
+    return new_status;
+}
+
+void bd_btrfs_balance_status_free (BDBtrfsBalanceStatus *status) {
+    g_free (status);
+}
+
+BDBtrfsScrubStatus* bd_btrfs_scrub_status_copy (BDBtrfsScrubStatus *status) {
+    BDBtrfsScrubStatus *new_status = g_new0 (BDBtrfsScrubStatus, 1);
+
+    new_status->state = status->state;
+    new_status->bytes_total = status->bytes_total;
+    new_status->bytes_scrubbed = status->bytes_scrubbed;
+    new_status->read_errors = status->read_errors;
+    new_status->csum_errors = status->csum_errors;
+    new_status->verify_errors = status->verify_errors;
+    new_status->corrected_errors = status->corrected_errors;
+    new_status->uncorrectable_errors = status->uncorrectable_errors;
+    new_status->rate = status->rate;
+    new_status->eta = status->eta;
+
+    return new_status;
+}
+
+void bd_btrfs_scrub_status_free (BDBtrfsScrubStatus *status) {
+    g_free (status);
+}
+
+BDBtrfsSnapshotResult* bd_btrfs_snapshot_result_copy (BDBtrfsSnapshotResult *result) {
+    BDBtrfsSnapshotResult *new_result = g_new0 (BDBtrfsSnapshotResult, 1);
+
+    new_result->source = g_strdup (result->source);
+    new_result->dest = g_strdup (result->dest);
+    new_result->success = result->success;
+    new_result->error_message = g_strdup (result->error_message);
+
+    return new_result;
+}
+
+void bd_btrfs_snapshot_result_free (BDBtrfsSnapshotResult *result) {
+    g_free (result->source);
+    g_free (result->dest);
+    g_free (result->error_message);
+    g_free (result);
+}
+
+BDBtrfsQgroupInfo* bd_btrfs_qgroup_info_copy (BDBtrfsQgroupInfo *info) {
+    BDBtrfsQgroupInfo *new_info = g_new0 (BDBtrfsQgroupInfo, 1);
+
+    new_info->id = info->id;
+    new_info->generation = info->generation;
+    new_info->referenced = info->referenced;
+    new_info->exclusive = info->exclusive;
+    new_info->max_referenced = info->max_referenced;
+    new_info->max_exclusive = info->max_exclusive;
+
+    return new_info;
+}
+
+void bd_btrfs_qgroup_info_free (BDBtrfsQgroupInfo *info) {
+    g_free (info);
+}
+
+BDBtrfsQgroupArray* bd_btrfs_qgroup_array_copy (BDBtrfsQgroupArray *qgroups) {
+    BDBtrfsQgroupArray *new_qgroups = g_new0 (BDBtrfsQgroupArray, 1);
+    gsize items_size = qgroups->n_items * sizeof (BDBtrfsQgroupInfo);
+
+    new_qgroups->items = g_malloc (items_size);
+    memcpy (new_qgroups->items, qgroups->items, items_size);
+    new_qgroups->n_items = qgroups->n_items;
+    new_qgroups->generation = qgroups->generation;
+
+    return new_qgroups;
+}
+
+void bd_btrfs_qgroup_array_free (BDBtrfsQgroupArray *qgroups) {
+    g_free (qgroups->items);
+    g_free (qgroups);
+}
+
+BDBtrfsQgroupInfo* bd_btrfs_qgroup_array_get_item (BDBtrfsQgroupArray *qgroups, guint64 index) {
+    if (index >= qgroups->n_items)
+        return NULL;
+    return qgroups->items + index;
+}
+
+BDBtrfsTransferStats* bd_btrfs_transfer_stats_copy (BDBtrfsTransferStats *stats) {
+    BDBtrfsTransferStats *new_stats = g_new0 (BDBtrfsTransferStats, 1);
+
+    new_stats->bytes = stats->bytes;
+    new_stats->duration = stats->duration;
+    new_stats->rate = stats->rate;
+
+    return new_stats;
+}
+
+void bd_btrfs_transfer_stats_free (BDBtrfsTransferStats *stats) {
+    g_free (stats);
+}
+
 /**
  * check: (skip)
  */
@@ -385,6 +541,80 @@ gboolean bd_btrfs_set_default_subvolume (gchar *mountpoint, guint64 subvol_id, G
     return ret;
 }
 
+/**
+ * create_snapshot_native: (skip)
+ * @source: path to source subvolume
+ * @dest: path to new snapshot volume (or an existing directory to create it in)
+ * @ro: whether the snapshot should be read-only
+ * @error: (out): place to store error (if any)
+ *
+ * Creates the snapshot with the SNAP_CREATE_V2 ioctl(), following the
+ * semantics of 'btrfs subvolume snapshot'.
+ *
+ * Returns: whether the @dest snapshot of @source was successfully created or not
+ */
+static gboolean create_snapshot_native (const gchar *source, const gchar *dest, gboolean ro, GError **error) {
+    struct btrfs_ioctl_vol_args_v2 args;
+    gchar *parent = NULL;
+    gchar *name = NULL;
+    int src_fd = -1;
+    int parent_fd = -1;
+    gboolean ret = FALSE;
+
+    if (g_file_test (dest, G_FILE_TEST_IS_DIR)) {
+        /* just like 'btrfs subvolume snapshot', create the snapshot in the
+           existing directory, named after the source */
+        parent = g_strdup (dest);
+        name = g_path_get_basename (source);
+    } else {
+        parent = g_path_get_dirname (dest);
+        name = g_path_get_basename (dest);
+    }
+
+    if (strlen (name) > BTRFS_SUBVOL_NAME_MAX) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Snapshot name '%s' is too long", name);
+        goto out;
+    }
+
+    src_fd = open (source, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (src_fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", source, strerror (errno));
+        goto out;
+    }
+
+    parent_fd = open (parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (parent_fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", parent, strerror (errno));
+        goto out;
+    }
+
+    memset (&args, 0, sizeof (args));
+    args.fd = src_fd;
+    if (ro)
+        args.flags |= BTRFS_SUBVOL_RDONLY;
+    strcpy (args.name, name);
+
+    if (ioctl (parent_fd, BTRFS_IOC_SNAP_CREATE_V2, &args) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to create snapshot '%s/%s' of '%s': %s", parent, name, source, strerror (errno));
+        goto out;
+    }
+
+    ret = TRUE;
+
+ out:
+    if (parent_fd >= 0)
+        close (parent_fd);
+    if (src_fd >= 0)
+        close (src_fd);
+    g_free (name);
+    g_free (parent);
+    return ret;
+}
+
 /**
  * bd_btrfs_create_snapshot:
  * @source: path to source subvolume
@@ -395,29 +625,367 @@ gboolean bd_btrfs_set_default_subvolume (gchar *mountpoint, guint64 subvol_id, G
  * Returns: whether the @dest snapshot of @source was successfully created or not
  */
 gboolean bd_btrfs_create_snapshot (gchar *source, gchar *dest, gboolean ro, GError **error) {
-    gchar *argv[7] = {"btrfs", "subvol", "snapshot", NULL, NULL, NULL, NULL};
-    guint next_arg = 3;
+    return create_snapshot_native (source, dest, ro, error);
+}
 
-    if (ro) {
-        argv[next_arg] = "-r";
-        next_arg++;
+static void create_snapshot_item (BDBtrfsSnapshotResult *result, gboolean ro) {
+    GError *l_error = NULL;
+
+    result->success = create_snapshot_native (result->source, result->dest, ro, &l_error);
+    if (!result->success) {
+        result->error_message = g_strdup (l_error->message);
+        g_clear_error (&l_error);
     }
-    argv[next_arg] = source;
-    next_arg++;
-    argv[next_arg] = dest;
+}
 
-    return bd_utils_exec_and_report_error (argv, error);
+static void create_snapshot_pool_func (gpointer data, gpointer user_data) {
+    create_snapshot_item ((BDBtrfsSnapshotResult *) data, *((gboolean *) user_data));
 }
 
 /**
- * bd_btrfs_list_devices:
- * @device: a device that is part of the queried btrfs volume
+ * bd_btrfs_create_snapshots:
+ * @sources: (array zero-terminated=1): paths to source subvolumes
+ * @dests: (array zero-terminated=1): paths to new snapshot volumes (one for each of @sources)
+ * @ro: whether the snapshots should be read-only
+ * @max_threads: maximum number of snapshots created in parallel (0 or 1 to create them one by one)
  * @error: (out): place to store error (if any)
  *
- * Returns: (array zero-terminated=1): information about the devices that are part of the btrfs volume
- * containing @device or %NULL in case of error
+ * Creates all the snapshots without running any external utilities. Creating
+ * them in parallel allows the kernel to commit many of them in the same
+ * transaction which makes them being taken at (almost) the same time.
+ *
+ * Returns: (array zero-terminated=1): results of the snapshot creation (in the
+ * same order as @sources) or %NULL if the arguments are invalid
+ *
+ * A failure to create some snapshots is not an error, check the results for
+ * the individual snapshots.
  */
-BDBtrfsDeviceInfo** bd_btrfs_list_devices (gchar *device, GError **error) {
+BDBtrfsSnapshotResult** bd_btrfs_create_snapshots (gchar **sources, gchar **dests, gboolean ro, guint max_threads, GError **error) {
+    BDBtrfsSnapshotResult **ret = NULL;
+    GThreadPool *pool = NULL;
+    guint num_items = 0;
+    guint i = 0;
+
+    num_items = sources ? g_strv_length (sources) : 0;
+    if (num_items != (dests ? g_strv_length (dests) : 0)) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_INVALID_ARGUMENT,
+                     "Number of sources and destinations of the snapshots doesn't match");
+        return NULL;
+    }
+
+    ret = g_new0 (BDBtrfsSnapshotResult*, num_items + 1);
+    for (i=0; i < num_items; i++) {
+        ret[i] = g_new0 (BDBtrfsSnapshotResult, 1);
+        ret[i]->source = g_strdup (sources[i]);
+        ret[i]->dest = g_strdup (dests[i]);
+    }
+
+    if ((max_threads > 1) && (num_items > 1))
+        pool = g_thread_pool_new (create_snapshot_pool_func, &ro, (gint) MIN (max_threads, num_items), TRUE, NULL);
+
+    for (i=0; i < num_items; i++)
+        if (!pool || !g_thread_pool_push (pool, ret[i], NULL))
+            /* no (working) thread pool, just do it here */
+            create_snapshot_item (ret[i], ro);
+
+    if (pool)
+        /* wait for all the snapshots to be created */
+        g_thread_pool_free (pool, FALSE, TRUE);
+
+    return ret;
+}
+
+/* location of the primary superblock and offsets of its fields (see struct
+   btrfs_super_block in the kernel sources) */
+#define SB_OFFSET (64 KiB)
+#define SB_FSID_OFFSET 32
+#define SB_MAGIC_OFFSET 64
+#define SB_BYTES_USED_OFFSET 120
+#define SB_NUM_DEVICES_OFFSET 136
+#define SB_DEV_ITEM_OFFSET 201
+#define SB_LABEL_OFFSET 299
+#define SB_SIZE 4096
+#define SB_MAGIC "_BHRfS_M"
+
+typedef struct BtrfsSuperblockInfo {
+    guint8 fsid[BTRFS_FSID_SIZE];
+    gchar label[BTRFS_LABEL_SIZE];
+    guint64 bytes_used;
+    guint64 num_devices;
+    guint64 devid;
+    guint64 dev_total_bytes;
+    guint64 dev_bytes_used;
+} BtrfsSuperblockInfo;
+
+static guint64 sb_get_u64 (const guint8 *sb, gsize offset) {
+    guint64 val = 0;
+
+    memcpy (&val, sb + offset, sizeof (val));
+    return GUINT64_FROM_LE (val);
+}
+
+/**
+ * read_superblock: (skip)
+ * @device: device to read the primary btrfs superblock from
+ * @info: (out): place to store the information from the superblock
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: whether a valid btrfs superblock was read from @device or not
+ */
+static gboolean read_superblock (const gchar *device, BtrfsSuperblockInfo *info, GError **error) {
+    guint8 sb[SB_SIZE];
+    int fd = -1;
+    ssize_t num_read = 0;
+
+    fd = open (device, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", device, strerror (errno));
+        return FALSE;
+    }
+
+    num_read = pread (fd, sb, SB_SIZE, SB_OFFSET);
+    close (fd);
+    if (num_read != SB_SIZE) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to read superblock from '%s'", device);
+        return FALSE;
+    }
+
+    if (memcmp (sb + SB_MAGIC_OFFSET, SB_MAGIC, strlen (SB_MAGIC)) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "No btrfs superblock found on '%s'", device);
+        return FALSE;
+    }
+
+    memcpy (info->fsid, sb + SB_FSID_OFFSET, BTRFS_FSID_SIZE);
+    memcpy (info->label, sb + SB_LABEL_OFFSET, BTRFS_LABEL_SIZE);
+    info->label[BTRFS_LABEL_SIZE - 1] = '\0';
+    info->bytes_used = sb_get_u64 (sb, SB_BYTES_USED_OFFSET);
+    info->num_devices = sb_get_u64 (sb, SB_NUM_DEVICES_OFFSET);
+    /* devid, total_bytes and bytes_used are the first fields of the dev item */
+    info->devid = sb_get_u64 (sb, SB_DEV_ITEM_OFFSET);
+    info->dev_total_bytes = sb_get_u64 (sb, SB_DEV_ITEM_OFFSET + 8);
+    info->dev_bytes_used = sb_get_u64 (sb, SB_DEV_ITEM_OFFSET + 16);
+
+    return TRUE;
+}
+
+/**
+ * open_mounted_fs: (skip)
+ * @path: a mountpoint of the btrfs volume or a device that is part of it
+ * @sb_info: (out): place to store the superblock information if @path is a device
+ * @have_sb: (out): whether @sb_info was filled in or not
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: file descriptor of the mounted btrfs volume @path is/belongs to
+ * (usable for btrfs ioctl()s) or -1 in case of error (e.g. if it's not mounted)
+ */
+static int open_mounted_fs (const gchar *path, BtrfsSuperblockInfo *sb_info, gboolean *have_sb, GError **error) {
+    struct stat st;
+    struct btrfs_ioctl_fs_info_args fs_info;
+    struct mntent *ent = NULL;
+    FILE *mounts = NULL;
+    int fd = -1;
+
+    *have_sb = FALSE;
+    if (stat (path, &st) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to get information about '%s': %s", path, strerror (errno));
+        return -1;
+    }
+
+    if (S_ISDIR (st.st_mode)) {
+        fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                         "Failed to open '%s': %s", path, strerror (errno));
+        return fd;
+    }
+
+    /* a device, find the mounted btrfs volume with the same fsid */
+    if (!read_superblock (path, sb_info, error))
+        return -1;
+    *have_sb = TRUE;
+
+    mounts = setmntent ("/proc/self/mounts", "r");
+    if (!mounts) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to read the list of mounted filesystems: %s", strerror (errno));
+        return -1;
+    }
+
+    while (fd < 0 && (ent = getmntent (mounts))) {
+        if (g_strcmp0 (ent->mnt_type, "btrfs") != 0)
+            continue;
+        fd = open (ent->mnt_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        memset (&fs_info, 0, sizeof (fs_info));
+        if ((ioctl (fd, BTRFS_IOC_FS_INFO, &fs_info) != 0) ||
+            (memcmp (fs_info.fsid, sb_info->fsid, BTRFS_FSID_SIZE) != 0)) {
+            close (fd);
+            fd = -1;
+        }
+    }
+    endmntent (mounts);
+
+    if (fd < 0)
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "The btrfs volume '%s' belongs to is not mounted", path);
+
+    return fd;
+}
+
+static gchar* fsid_to_str (const guint8 *fsid) {
+    return g_strdup_printf ("%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                            fsid[0], fsid[1], fsid[2], fsid[3], fsid[4], fsid[5], fsid[6], fsid[7],
+                            fsid[8], fsid[9], fsid[10], fsid[11], fsid[12], fsid[13], fsid[14], fsid[15]);
+}
+
+/**
+ * get_space_args: (skip)
+ * @fd: file descriptor of the mounted btrfs volume
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (transfer full): result of the BTRFS_IOC_SPACE_INFO ioctl() with
+ * all the space infos or %NULL in case of error
+ */
+static struct btrfs_ioctl_space_args* get_space_args (int fd, GError **error) {
+    struct btrfs_ioctl_space_args probe;
+    struct btrfs_ioctl_space_args *args = NULL;
+
+    /* first ask for the number of space infos, then get them all */
+    memset (&probe, 0, sizeof (probe));
+    if (ioctl (fd, BTRFS_IOC_SPACE_INFO, &probe) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to get space information: %s", strerror (errno));
+        return NULL;
+    }
+
+    args = g_malloc0 (sizeof (struct btrfs_ioctl_space_args) +
+                      probe.total_spaces * sizeof (struct btrfs_ioctl_space_info));
+    args->space_slots = probe.total_spaces;
+    if (ioctl (fd, BTRFS_IOC_SPACE_INFO, args) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to get space information: %s", strerror (errno));
+        g_free (args);
+        return NULL;
+    }
+
+    return args;
+}
+
+/**
+ * get_dev_infos: (skip)
+ * @fd: file descriptor of the mounted btrfs volume
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (transfer full): information about the volume's devices (gathered
+ * with BTRFS_IOC_FS_INFO and BTRFS_IOC_DEV_INFO) or %NULL in case of error,
+ * the array frees the items if freed with its segment
+ */
+static GPtrArray* get_dev_infos (int fd, GError **error) {
+    struct btrfs_ioctl_fs_info_args fs_info;
+    struct btrfs_ioctl_dev_info_args *dev_info = NULL;
+    GPtrArray *dev_infos = NULL;
+    BDBtrfsDeviceInfo *info = NULL;
+    guint64 id = 0;
+
+    memset (&fs_info, 0, sizeof (fs_info));
+    if (ioctl (fd, BTRFS_IOC_FS_INFO, &fs_info) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to get information about the filesystem: %s", strerror (errno));
+        return NULL;
+    }
+
+    dev_info = g_new0 (struct btrfs_ioctl_dev_info_args, 1);
+    dev_infos = g_ptr_array_new_with_free_func ((GDestroyNotify) bd_btrfs_device_info_free);
+    /* device IDs are not necessarily contiguous (e.g. after a device removal) */
+    for (id=1; id <= fs_info.max_id; id++) {
+        memset (dev_info, 0, sizeof (struct btrfs_ioctl_dev_info_args));
+        dev_info->devid = id;
+        if (ioctl (fd, BTRFS_IOC_DEV_INFO, dev_info) != 0) {
+            if (errno == ENODEV)
+                continue;
+            g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                         "Failed to get information about device %"G_GUINT64_FORMAT": %s", id, strerror (errno));
+            g_ptr_array_free (dev_infos, TRUE);
+            g_free (dev_info);
+            return NULL;
+        }
+
+        info = g_new0 (BDBtrfsDeviceInfo, 1);
+        info->id = dev_info->devid;
+        info->path = g_strndup ((gchar *) dev_info->path, BTRFS_DEVICE_PATH_NAME_MAX);
+        info->size = dev_info->total_bytes;
+        info->used = dev_info->bytes_used;
+        g_ptr_array_add (dev_infos, info);
+    }
+    g_free (dev_info);
+
+    if (dev_infos->len == 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE, "No devices found");
+        g_ptr_array_free (dev_infos, TRUE);
+        return NULL;
+    }
+
+    return dev_infos;
+}
+
+/**
+ * list_devices_native: (skip)
+ *
+ * Gets information about the devices with BTRFS_IOC_FS_INFO and
+ * BTRFS_IOC_DEV_INFO if the volume is mounted or from @device's superblock
+ * for an unmounted single-device volume.
+ */
+static BDBtrfsDeviceInfo** list_devices_native (gchar *device, GError **error) {
+    BtrfsSuperblockInfo sb_info;
+    gboolean have_sb = FALSE;
+    GPtrArray *dev_infos = NULL;
+    BDBtrfsDeviceInfo *info = NULL;
+    GError *l_error = NULL;
+    int fd = -1;
+
+    fd = open_mounted_fs (device, &sb_info, &have_sb, &l_error);
+    if (fd < 0) {
+        if (!have_sb || (sb_info.num_devices != 1)) {
+            /* not mounted and the superblock only describes its own device */
+            g_propagate_error (error, l_error);
+            return NULL;
+        }
+        g_clear_error (&l_error);
+
+        dev_infos = g_ptr_array_new ();
+        info = g_new0 (BDBtrfsDeviceInfo, 1);
+        info->id = sb_info.devid;
+        info->path = g_strdup (device);
+        info->size = sb_info.dev_total_bytes;
+        info->used = sb_info.dev_bytes_used;
+        g_ptr_array_add (dev_infos, info);
+        g_ptr_array_add (dev_infos, NULL);
+
+        return (BDBtrfsDeviceInfo**) g_ptr_array_free (dev_infos, FALSE);
+    }
+
+    dev_infos = get_dev_infos (fd, error);
+    close (fd);
+    if (!dev_infos)
+        /* error is already populated */
+        return NULL;
+
+    g_ptr_array_add (dev_infos, NULL);
+
+    return (BDBtrfsDeviceInfo**) g_ptr_array_free (dev_infos, FALSE);
+}
+
+/**
+ * list_devices_exec: (skip)
+ *
+ * Gets information about the devices by parsing 'btrfs filesystem show' output.
+ */
+static BDBtrfsDeviceInfo** list_devices_exec (gchar *device, GError **error) {
     gchar *argv[5] = {"btrfs", "filesystem", "show", device, NULL};
     gchar *output = NULL;
     gboolean success = FALSE;
@@ -478,109 +1046,437 @@ BDBtrfsDeviceInfo** bd_btrfs_list_devices (gchar *device, GError **error) {
 }
 
 /**
- * bd_btrfs_list_subvolumes:
- * @mountpoint: a mountpoint of the queried btrfs volume
- * @snapshots_only: whether to list only snapshot subvolumes or not
+ * bd_btrfs_list_devices:
+ * @device: a device that is part of the queried btrfs volume
  * @error: (out): place to store error (if any)
  *
- * Returns: (array zero-terminated=1): information about the subvolumes that are part of the btrfs volume
- * mounted at @mountpoint or %NULL in case of error
+ * Returns: (array zero-terminated=1): information about the devices that are part of the btrfs volume
+ * containing @device or %NULL in case of error
  *
- * The subvolumes are sorted in a way that no child subvolume appears in the
- * list before its parent (sub)volume.
+ * The information is queried with ioctl()s if the volume is mounted (@device
+ * can also be a mountpoint) or read from @device's superblock for unmounted
+ * single-device volumes, 'btrfs filesystem show' is only used as a fallback.
  */
-BDBtrfsSubvolumeInfo** bd_btrfs_list_subvolumes (gchar *mountpoint, gboolean snapshots_only, GError **error) {
-    gchar *argv[7] = {"btrfs", "subvol", "list", "-p", NULL, NULL, NULL};
-    gchar *output = NULL;
-    gboolean success = FALSE;
-    gchar **lines = NULL;
-    gchar **line_p = NULL;
-    gchar const * const pattern = "ID\\s+(?P<id>\\d+)\\s+gen\\s+\\d+\\s+(cgen\\s+\\d+\\s+)?" \
-                                  "parent\\s+(?P<parent_id>\\d+)\\s+top\\s+level\\s+\\d+\\s+" \
-                                  "(otime\\s+\\d{4}-\\d{2}-\\d{2}\\s+\\d\\d:\\d\\d:\\d\\d\\s+)?"\
-                                  "path\\s+(?P<path>\\S+)";
-    GRegex *regex = NULL;
-    GMatchInfo *match_info = NULL;
-    guint64 i = 0;
-    guint64 y = 0;
-    guint64 next_sorted_idx = 0;
-    GPtrArray *subvol_infos = g_ptr_array_new ();
-    BDBtrfsSubvolumeInfo* item = NULL;
-    BDBtrfsSubvolumeInfo* swap_item = NULL;
-    BDBtrfsSubvolumeInfo** ret = NULL;
+BDBtrfsDeviceInfo** bd_btrfs_list_devices (gchar *device, GError **error) {
+    BDBtrfsDeviceInfo **ret = NULL;
+    GError *l_error = NULL;
 
-    if (snapshots_only) {
-        argv[4] = "-s";
-        argv[5] = mountpoint;
-    } else
-        argv[4] = mountpoint;
+    ret = list_devices_native (device, &l_error);
+    if (ret)
+        return ret;
 
-    regex = g_regex_new (pattern, G_REGEX_EXTENDED, 0, error);
-    if (!regex) {
-        g_warning ("Failed to create new GRegex");
-        /* error is already populated */
-        return NULL;
-    }
+    g_debug ("Failed to get information about devices natively, falling back to btrfs: %s", l_error->message);
+    g_clear_error (&l_error);
 
-    success = bd_utils_exec_and_capture_output (argv, &output, error);
-    if (!success)
-        /* error is already populated from the call above or simply no output*/
-        return NULL;
+    return list_devices_exec (device, error);
+}
 
-    lines = g_strsplit (output, "\n", 0);
-    g_free (output);
+/**
+ * search_tree_next: (skip)
+ * @fd: file descriptor of a file/directory on the btrfs volume
+ * @args: search arguments (with the key and buf_size set up)
+ * @error: (out): place to store error (if any)
+ *
+ * Runs one BTRFS_IOC_TREE_SEARCH_V2 round and moves the search key past the
+ * last item returned so that the next call continues where this one stopped.
+ *
+ * Returns: number of items found (0 means the search is done) or -1 in case
+ * of error
+ */
+static gint search_tree_next (int fd, struct btrfs_ioctl_search_args_v2 *args, GError **error) {
+    struct btrfs_ioctl_search_header header;
+    guint64 offset = 0;
+    guint32 i = 0;
+
+    args->key.nr_items = G_MAXUINT32;
+    if (ioctl (fd, BTRFS_IOC_TREE_SEARCH_V2, args) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to search the btrfs tree: %s", strerror (errno));
+        return -1;
+    }
 
-    for (line_p = lines; *line_p; line_p++) {
-        success = g_regex_match (regex, *line_p, 0, &match_info);
-        if (!success) {
-            g_match_info_free (match_info);
-            continue;
-        }
+    if (args->key.nr_items == 0)
+        return 0;
 
-        g_ptr_array_add (subvol_infos, get_subvolume_info_from_match (match_info));
-        g_match_info_free (match_info);
+    /* find the last item's key */
+    for (i=0; i < args->key.nr_items; i++) {
+        memcpy (&header, ((guint8 *) args->buf) + offset, sizeof (header));
+        offset += sizeof (header) + header.len;
     }
 
-    g_strfreev (lines);
+    /* continue right after the last key (objectid, type, offset) */
+    args->key.min_objectid = header.objectid;
+    args->key.min_type = header.type;
+    args->key.min_offset = header.offset;
+    if (args->key.min_offset < G_MAXUINT64)
+        args->key.min_offset++;
+    else if (args->key.min_type < G_MAXUINT8) {
+        args->key.min_offset = 0;
+        args->key.min_type++;
+    } else if (args->key.min_objectid < G_MAXUINT64) {
+        args->key.min_offset = 0;
+        args->key.min_type = 0;
+        args->key.min_objectid++;
+    } else
+        /* nothing more to search for */
+        args->key.max_objectid = 0;
 
-    if (subvol_infos->len == 0) {
-        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_PARSE, "Failed to parse information about subvolumes");
+    return (gint) args->key.nr_items;
+}
+
+/**
+ * lookup_dir_path: (skip)
+ * @fd: file descriptor of a file/directory on the btrfs volume
+ * @tree_id: ID of the subvolume the directory is in
+ * @dir_id: inode number of the directory
+ * @cache: cache of the already looked up paths
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (transfer none): path of the @dir_id directory relative to the
+ * @tree_id subvolume (with a trailing '/' or empty) or %NULL in case of error
+ */
+static const gchar* lookup_dir_path (int fd, guint64 tree_id, guint64 dir_id, GHashTable *cache, GError **error) {
+    struct btrfs_ioctl_ino_lookup_args args;
+    gchar *key = NULL;
+    const gchar *path = NULL;
+
+    if (dir_id == BTRFS_FIRST_FREE_OBJECTID)
+        /* the top directory of the subvolume */
+        return "";
+
+    /* lots of subvolumes usually live in the same directory (e.g. Docker) */
+    key = g_strdup_printf ("%"G_GUINT64_FORMAT":%"G_GUINT64_FORMAT, tree_id, dir_id);
+    path = g_hash_table_lookup (cache, key);
+    if (path) {
+        g_free (key);
+        return path;
+    }
+
+    memset (&args, 0, sizeof (args));
+    args.treeid = tree_id;
+    args.objectid = dir_id;
+    if (ioctl (fd, BTRFS_IOC_INO_LOOKUP, &args) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to look up directory %"G_GUINT64_FORMAT" in subvolume %"G_GUINT64_FORMAT": %s",
+                     dir_id, tree_id, strerror (errno));
+        g_free (key);
         return NULL;
     }
+    args.name[BTRFS_INO_LOOKUP_PATH_MAX - 1] = '\0';
+
+    path = g_strdup (args.name);
+    g_hash_table_insert (cache, key, (gpointer) path);
+
+    return path;
+}
+
+/**
+ * resolve_subvolume_path: (skip)
+ * @subvols: table of all subvolumes (indexed by their IDs)
+ * @resolved: set of subvolumes with full paths already resolved
+ * @info: subvolume to resolve the full path of
+ *
+ * Prepends the full path of @info's parent subvolume to @info's path (which
+ * is relative to the parent when this function is called).
+ */
+static void resolve_subvolume_path (GHashTable *subvols, GHashTable *resolved, BDBtrfsSubvolumeInfo *info) {
+    BDBtrfsSubvolumeInfo *parent = NULL;
+    gchar *path = NULL;
+
+    if (g_hash_table_contains (resolved, info))
+        return;
+    g_hash_table_add (resolved, info);
+
+    parent = g_hash_table_lookup (subvols, &(info->parent_id));
+    if (!parent)
+        /* child of the top-level volume (or of an unknown subvolume) */
+        return;
+
+    resolve_subvolume_path (subvols, resolved, parent);
+    path = g_strdup_printf ("%s/%s", parent->path, info->path);
+    g_free (info->path);
+    info->path = path;
+}
+
+/**
+ * list_subvolumes_native: (skip)
+ * @mountpoint: a mountpoint of the queried btrfs volume
+ * @snapshots_only: whether to list only snapshot subvolumes or not
+ * @error: (out): place to store error (if any)
+ *
+ * Lists subvolumes by walking the root tree with BTRFS_IOC_TREE_SEARCH_V2
+ * and resolving their paths with BTRFS_IOC_INO_LOOKUP (requires
+ * CAP_SYS_ADMIN).
+ *
+ * Returns: (transfer full): unsorted subvolumes or %NULL in case of error
+ */
+static GPtrArray* list_subvolumes_native (gchar *mountpoint, gboolean snapshots_only, GError **error) {
+    int fd = -1;
+    struct btrfs_ioctl_search_args_v2 *args = NULL;
+    struct btrfs_ioctl_search_header header;
+    struct btrfs_root_ref ref;
+    gsize buf_size = 64 KiB;
+    guint64 offset = 0;
+    gint num_items = 0;
+    gint i = 0;
+    guint64 root_id = 0;
+    guint64 root_offset = 0;
+    guint16 name_len = 0;
+    const gchar *dir_path = NULL;
+    GHashTable *subvols = NULL;
+    GHashTable *snapshots = NULL;
+    GHashTable *resolved = NULL;
+    GHashTable *dir_paths = NULL;
+    GHashTableIter iter;
+    BDBtrfsSubvolumeInfo *info = NULL;
+    GPtrArray *ret = NULL;
+    gboolean success = TRUE;
+
+    fd = open (mountpoint, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", mountpoint, strerror (errno));
+        return NULL;
+    }
+
+    args = g_malloc0 (sizeof (struct btrfs_ioctl_search_args_v2) + buf_size);
+    args->buf_size = buf_size;
+    args->key.tree_id = BTRFS_ROOT_TREE_OBJECTID;
+    args->key.min_objectid = BTRFS_FIRST_FREE_OBJECTID;
+    args->key.max_objectid = BTRFS_LAST_FREE_OBJECTID;
+    args->key.min_type = BTRFS_ROOT_ITEM_KEY;
+    args->key.max_type = BTRFS_ROOT_BACKREF_KEY;
+    args->key.max_offset = G_MAXUINT64;
+    args->key.max_transid = G_MAXUINT64;
+
+    /* the table owns the items, the other ones just point to them */
+    subvols = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, (GDestroyNotify) bd_btrfs_subvolume_info_free);
+    snapshots = g_hash_table_new (g_direct_hash, g_direct_equal);
+    dir_paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+    while (success && (num_items = search_tree_next (fd, args, error)) > 0) {
+        offset = 0;
+        for (i=0; i < num_items; i++) {
+            memcpy (&header, ((guint8 *) args->buf) + offset, sizeof (header));
+            offset += sizeof (header);
+
+            if (header.type == BTRFS_ROOT_ITEM_KEY) {
+                /* root items go before the backrefs (lower key type) and
+                   snapshots have a non-zero offset (creation transid) */
+                root_id = header.objectid;
+                root_offset = header.offset;
+            } else if ((header.type == BTRFS_ROOT_BACKREF_KEY) && (header.len >= sizeof (ref)) &&
+                       !g_hash_table_contains (subvols, &(header.objectid))) {
+                memcpy (&ref, ((guint8 *) args->buf) + offset, sizeof (ref));
+                name_len = GUINT16_FROM_LE (ref.name_len);
+                if (sizeof (ref) + name_len > header.len) {
+                    offset += header.len;
+                    continue;
+                }
+
+                dir_path = lookup_dir_path (fd, header.offset, GUINT64_FROM_LE (ref.dirid), dir_paths, error);
+                if (!dir_path) {
+                    success = FALSE;
+                    break;
+                }
+
+                info = g_new0 (BDBtrfsSubvolumeInfo, 1);
+                info->id = header.objectid;
+                info->parent_id = header.offset;
+                info->path = g_strdup_printf ("%s%.*s", dir_path, (int) name_len,
+                                              ((gchar *) args->buf) + offset + sizeof (ref));
+                g_hash_table_insert (subvols, &(info->id), info);
+                if ((root_id == info->id) && (root_offset != 0))
+                    g_hash_table_add (snapshots, info);
+            }
+            offset += header.len;
+        }
+    }
+    success = success && (num_items == 0);
+
+    close (fd);
+    g_free (args);
+    g_hash_table_destroy (dir_paths);
+
+    if (!success) {
+        g_hash_table_destroy (snapshots);
+        g_hash_table_destroy (subvols);
+        return NULL;
+    }
+
+    /* the paths are now relative to the parent subvolumes, make them full */
+    resolved = g_hash_table_new (g_direct_hash, g_direct_equal);
+    g_hash_table_iter_init (&iter, subvols);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &info))
+        resolve_subvolume_path (subvols, resolved, info);
+    g_hash_table_destroy (resolved);
+
+    ret = g_ptr_array_new_full (g_hash_table_size (subvols), (GDestroyNotify) bd_btrfs_subvolume_info_free);
+    g_hash_table_iter_init (&iter, subvols);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &info)) {
+        g_hash_table_iter_steal (&iter);
+        if (!snapshots_only || g_hash_table_contains (snapshots, info))
+            g_ptr_array_add (ret, info);
+        else
+            bd_btrfs_subvolume_info_free (info);
+    }
+    g_hash_table_destroy (snapshots);
+    g_hash_table_destroy (subvols);
+
+    return ret;
+}
+
+/**
+ * list_subvolumes_exec: (skip)
+ * @mountpoint: a mountpoint of the queried btrfs volume
+ * @snapshots_only: whether to list only snapshot subvolumes or not
+ * @error: (out): place to store error (if any)
+ *
+ * Lists subvolumes by parsing the output of 'btrfs subvol list'.
+ *
+ * Returns: (transfer full): unsorted subvolumes or %NULL in case of error
+ */
+static GPtrArray* list_subvolumes_exec (gchar *mountpoint, gboolean snapshots_only, GError **error) {
+    gchar *argv[7] = {"btrfs", "subvol", "list", "-p", NULL, NULL, NULL};
+    gchar *output = NULL;
+    gboolean success = FALSE;
+    gchar **lines = NULL;
+    gchar **line_p = NULL;
+    gchar const * const pattern = "ID\\s+(?P<id>\\d+)\\s+gen\\s+\\d+\\s+(cgen\\s+\\d+\\s+)?" \
+                                  "parent\\s+(?P<parent_id>\\d+)\\s+top\\s+level\\s+\\d+\\s+" \
+                                  "(otime\\s+\\d{4}-\\d{2}-\\d{2}\\s+\\d\\d:\\d\\d:\\d\\d\\s+)?"\
+                                  "path\\s+(?P<path>\\S+)";
+    GRegex *regex = NULL;
+    GMatchInfo *match_info = NULL;
+    GPtrArray *subvol_infos = NULL;
+
+    if (snapshots_only) {
+        argv[4] = "-s";
+        argv[5] = mountpoint;
+    } else
+        argv[4] = mountpoint;
+
+    regex = g_regex_new (pattern, G_REGEX_EXTENDED, 0, error);
+    if (!regex) {
+        g_warning ("Failed to create new GRegex");
+        /* error is already populated */
+        return NULL;
+    }
+
+    success = bd_utils_exec_and_capture_output (argv, &output, error);
+    if (!success) {
+        /* error is already populated from the call above or simply no output*/
+        g_regex_unref (regex);
+        return NULL;
+    }
+
+    lines = g_strsplit (output, "\n", 0);
+    g_free (output);
+
+    subvol_infos = g_ptr_array_new_with_free_func ((GDestroyNotify) bd_btrfs_subvolume_info_free);
+    for (line_p = lines; *line_p; line_p++) {
+        success = g_regex_match (regex, *line_p, 0, &match_info);
+        if (!success) {
+            g_match_info_free (match_info);
+            continue;
+        }
+
+        g_ptr_array_add (subvol_infos, get_subvolume_info_from_match (match_info));
+        g_match_info_free (match_info);
+    }
+
+    g_strfreev (lines);
+    g_regex_unref (regex);
+
+    if (subvol_infos->len == 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_PARSE, "Failed to parse information about subvolumes");
+        g_ptr_array_free (subvol_infos, TRUE);
+        return NULL;
+    }
+
+    return subvol_infos;
+}
+
+/**
+ * sort_subvolumes: (skip)
+ * @subvol_infos: (transfer full): subvolumes to sort
+ *
+ * Sorts the subvolumes breadth-first starting with the top-level ones (and the
+ * ones with an unknown parent) in O(n) time. The relative order of siblings is
+ * preserved.
+ *
+ * Returns: (transfer full) (array zero-terminated=1): @subvol_infos sorted in a
+ * way that no child subvolume appears in the list before its parent (sub)volume
+ */
+static BDBtrfsSubvolumeInfo** sort_subvolumes (GPtrArray *subvol_infos) {
+    GHashTable *by_id = NULL;
+    GHashTable *children = NULL;
+    GHashTable *sorted = NULL;
+    GPtrArray *item_children = NULL;
+    guint64 i = 0;
+    guint64 y = 0;
+    guint64 next_sorted_idx = 0;
+    BDBtrfsSubvolumeInfo* item = NULL;
+    BDBtrfsSubvolumeInfo** ret = NULL;
+
+    /* the items are moved to the result */
+    g_ptr_array_set_free_func (subvol_infos, NULL);
 
     /* now we know how much space to allocate for the result (subvols + NULL) */
     ret = g_new0 (BDBtrfsSubvolumeInfo*, subvol_infos->len + 1);
 
-    /* we need to sort the subvolumes in a way that no child subvolume appears
-       in the list before its parent (sub)volume */
-
-    /* let's start by moving all top-level (sub)volumes to the beginning */
+    by_id = g_hash_table_new (g_int64_hash, g_int64_equal);
     for (i=0; i < subvol_infos->len; i++) {
         item = (BDBtrfsSubvolumeInfo*) g_ptr_array_index (subvol_infos, i);
-        if (item->parent_id == BD_BTRFS_MAIN_VOLUME_ID)
-            /* top-level (sub)volume */
-            ret[next_sorted_idx++] = item;
+        g_hash_table_insert (by_id, &(item->id), item);
     }
-    /* top-level (sub)volumes are now processed */
-    for (i=0; i < next_sorted_idx; i++)
-        g_ptr_array_remove_fast (subvol_infos, ret[i]);
 
-    /* now sort the rest in a way that we search for an already sorted parent or sibling */
+    /* start with the top-level (sub)volumes and those whose parent is not
+       listed (e.g. when listing only snapshots), all the others are indexed
+       by their parents' IDs */
+    children = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, (GDestroyNotify) g_ptr_array_unref);
     for (i=0; i < subvol_infos->len; i++) {
         item = (BDBtrfsSubvolumeInfo*) g_ptr_array_index (subvol_infos, i);
-        ret[next_sorted_idx] = item;
-        /* move the item towards beginning of the array checking if some parent
-           or sibling has been already processed/sorted before or we reached the
-           top-level (sub)volumes */
-        for (y=next_sorted_idx; (y > 0 && (ret[y-1]->id != item->parent_id) && (ret[y-1]->parent_id != item->parent_id) && (ret[y-1]->parent_id != BD_BTRFS_MAIN_VOLUME_ID)); y--) {
-            swap_item = ret[y-1];
-            ret[y-1] = ret[y];
-            ret[y] = swap_item;
+        if ((item->parent_id == BD_BTRFS_MAIN_VOLUME_ID) || !g_hash_table_contains (by_id, &(item->parent_id)))
+            ret[next_sorted_idx++] = item;
+        else {
+            item_children = g_hash_table_lookup (children, &(item->parent_id));
+            if (!item_children) {
+                item_children = g_ptr_array_new ();
+                g_hash_table_insert (children, &(item->parent_id), item_children);
+            }
+            g_ptr_array_add (item_children, item);
+        }
+    }
+
+    /* now walk the tree breadth-first using the result as the queue */
+    for (i=0; i < next_sorted_idx; i++) {
+        item_children = g_hash_table_lookup (children, &(ret[i]->id));
+        if (!item_children)
+            continue;
+        for (y=0; y < item_children->len; y++)
+            ret[next_sorted_idx++] = (BDBtrfsSubvolumeInfo*) g_ptr_array_index (item_children, y);
+        /* don't visit the children again in case of a (bogus) cycle */
+        g_hash_table_remove (children, &(ret[i]->id));
+    }
+
+    if (next_sorted_idx < subvol_infos->len) {
+        /* items in (bogus) parent cycles were not reached, just append them */
+        sorted = g_hash_table_new (g_direct_hash, g_direct_equal);
+        for (i=0; i < next_sorted_idx; i++)
+            g_hash_table_add (sorted, ret[i]);
+        for (i=0; i < subvol_infos->len; i++) {
+            item = (BDBtrfsSubvolumeInfo*) g_ptr_array_index (subvol_infos, i);
+            if (!g_hash_table_contains (sorted, item))
+                ret[next_sorted_idx++] = item;
         }
-        next_sorted_idx++;
+        g_hash_table_destroy (sorted);
     }
     ret[next_sorted_idx] = NULL;
 
+    g_hash_table_destroy (children);
+    g_hash_table_destroy (by_id);
+
     /* now just free the pointer array */
     g_ptr_array_free (subvol_infos, TRUE);
 
@@ -588,13 +1484,117 @@ BDBtrfsSubvolumeInfo** bd_btrfs_list_subvolumes (gchar *mountpoint, gboolean sna
 }
 
 /**
- * bd_btrfs_filesystem_info:
- * @device: a device that is part of the queried btrfs volume
+ * bd_btrfs_list_subvolumes:
+ * @mountpoint: a mountpoint of the queried btrfs volume
+ * @snapshots_only: whether to list only snapshot subvolumes or not
  * @error: (out): place to store error (if any)
  *
- * Returns: information about the @device's volume's filesystem or %NULL in case of error
+ * Returns: (array zero-terminated=1): information about the subvolumes that are part of the btrfs volume
+ * mounted at @mountpoint or %NULL in case of error
+ *
+ * The subvolumes are sorted in a way that no child subvolume appears in the
+ * list before its parent (sub)volume.
+ *
+ * The information is read directly from the filesystem's root tree with
+ * ioctl()s, 'btrfs subvol list' is only used as a fallback if that fails
+ * (e.g. because of missing privileges).
  */
-BDBtrfsFilesystemInfo* bd_btrfs_filesystem_info (gchar *device, GError **error) {
+BDBtrfsSubvolumeInfo** bd_btrfs_list_subvolumes (gchar *mountpoint, gboolean snapshots_only, GError **error) {
+    GPtrArray *subvol_infos = NULL;
+    GError *l_error = NULL;
+
+    subvol_infos = list_subvolumes_native (mountpoint, snapshots_only, &l_error);
+    if (!subvol_infos) {
+        g_debug ("Failed to list subvolumes natively, falling back to btrfs: %s", l_error->message);
+        g_clear_error (&l_error);
+        subvol_infos = list_subvolumes_exec (mountpoint, snapshots_only, error);
+        if (!subvol_infos)
+            /* error is already populated */
+            return NULL;
+    }
+
+    /* we need to sort the subvolumes in a way that no child subvolume appears
+       in the list before its parent (sub)volume */
+    return sort_subvolumes (subvol_infos);
+}
+
+/**
+ * filesystem_info_native: (skip)
+ *
+ * Gets information about the filesystem with BTRFS_IOC_FS_INFO,
+ * BTRFS_IOC_GET_FSLABEL and BTRFS_IOC_SPACE_INFO if the volume is mounted or
+ * from @device's superblock otherwise.
+ */
+static BDBtrfsFilesystemInfo* filesystem_info_native (gchar *device, GError **error) {
+    struct btrfs_ioctl_fs_info_args fs_info;
+    struct btrfs_ioctl_space_args *space_args = NULL;
+    gchar label[BTRFS_LABEL_SIZE];
+    BtrfsSuperblockInfo sb_info;
+    gboolean have_sb = FALSE;
+    BDBtrfsFilesystemInfo *ret = NULL;
+    GError *l_error = NULL;
+    guint64 i = 0;
+    int fd = -1;
+
+    fd = open_mounted_fs (device, &sb_info, &have_sb, &l_error);
+    if (fd < 0) {
+        if (!have_sb) {
+            g_propagate_error (error, l_error);
+            return NULL;
+        }
+        /* not mounted, the superblock has everything we need */
+        g_clear_error (&l_error);
+
+        ret = g_new0 (BDBtrfsFilesystemInfo, 1);
+        ret->label = g_strdup (sb_info.label);
+        ret->uuid = fsid_to_str (sb_info.fsid);
+        ret->num_devices = sb_info.num_devices;
+        ret->used = sb_info.bytes_used;
+
+        return ret;
+    }
+
+    memset (&fs_info, 0, sizeof (fs_info));
+    if (ioctl (fd, BTRFS_IOC_FS_INFO, &fs_info) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to get information about the filesystem: %s", strerror (errno));
+        close (fd);
+        return NULL;
+    }
+
+    memset (label, 0, sizeof (label));
+    if (ioctl (fd, BTRFS_IOC_GET_FSLABEL, label) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to get the filesystem label: %s", strerror (errno));
+        close (fd);
+        return NULL;
+    }
+    label[BTRFS_LABEL_SIZE - 1] = '\0';
+
+    space_args = get_space_args (fd, error);
+    close (fd);
+    if (!space_args)
+        /* error is already populated */
+        return NULL;
+
+    ret = g_new0 (BDBtrfsFilesystemInfo, 1);
+    ret->label = g_strdup (label);
+    ret->uuid = fsid_to_str (fs_info.fsid);
+    ret->num_devices = fs_info.num_devices;
+    /* the same as what 'btrfs filesystem show' reports as 'FS bytes used' */
+    for (i=0; i < space_args->total_spaces; i++)
+        ret->used += space_args->spaces[i].used_bytes;
+    g_free (space_args);
+
+    return ret;
+}
+
+/**
+ * filesystem_info_exec: (skip)
+ *
+ * Gets information about the filesystem by parsing 'btrfs filesystem show' output.
+ */
+static BDBtrfsFilesystemInfo* filesystem_info_exec (gchar *device, GError **error) {
     gchar *argv[5] = {"btrfs", "filesystem", "show", device, NULL};
     gchar *output = NULL;
     gboolean success = FALSE;
@@ -633,6 +1633,135 @@ BDBtrfsFilesystemInfo* bd_btrfs_filesystem_info (gchar *device, GError **error)
     return ret;
 }
 
+/**
+ * bd_btrfs_filesystem_info:
+ * @device: a device that is part of the queried btrfs volume
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: information about the @device's volume's filesystem or %NULL in case of error
+ *
+ * The information is queried with ioctl()s if the volume is mounted (@device
+ * can also be a mountpoint) or read from @device's superblock otherwise,
+ * 'btrfs filesystem show' is only used as a fallback.
+ */
+BDBtrfsFilesystemInfo* bd_btrfs_filesystem_info (gchar *device, GError **error) {
+    BDBtrfsFilesystemInfo *ret = NULL;
+    GError *l_error = NULL;
+
+    ret = filesystem_info_native (device, &l_error);
+    if (ret)
+        return ret;
+
+    g_debug ("Failed to get information about the filesystem natively, falling back to btrfs: %s", l_error->message);
+    g_clear_error (&l_error);
+
+    return filesystem_info_exec (device, error);
+}
+
+static const gchar* get_profile_name (guint64 flags) {
+    switch (flags & ALL_PROFILES_MASK) {
+        case BTRFS_BLOCK_GROUP_RAID0:
+            return "RAID0";
+        case BTRFS_BLOCK_GROUP_RAID1:
+            return "RAID1";
+        case BTRFS_BLOCK_GROUP_DUP:
+            return "DUP";
+        case BTRFS_BLOCK_GROUP_RAID10:
+            return "RAID10";
+        case BTRFS_BLOCK_GROUP_RAID5:
+            return "RAID5";
+        case BTRFS_BLOCK_GROUP_RAID6:
+            return "RAID6";
+        case BTRFS_BLOCK_GROUP_RAID1C3:
+            return "RAID1C3";
+        case BTRFS_BLOCK_GROUP_RAID1C4:
+            return "RAID1C4";
+        default:
+            return "single";
+    }
+}
+
+static BDBtrfsSpaceType get_space_type (guint64 flags) {
+    if (flags & BTRFS_SPACE_INFO_GLOBAL_RSV)
+        return BD_BTRFS_SPACE_GLOBAL_RESERVE;
+    if ((flags & BTRFS_BLOCK_GROUP_DATA) && (flags & BTRFS_BLOCK_GROUP_METADATA))
+        return BD_BTRFS_SPACE_MIXED;
+    if (flags & BTRFS_BLOCK_GROUP_DATA)
+        return BD_BTRFS_SPACE_DATA;
+    if (flags & BTRFS_BLOCK_GROUP_METADATA)
+        return BD_BTRFS_SPACE_METADATA;
+    return BD_BTRFS_SPACE_SYSTEM;
+}
+
+/**
+ * bd_btrfs_space_info:
+ * @mountpoint: a mountpoint of the queried btrfs volume (or a device that is part of it)
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (array zero-terminated=1): information about the space allocated
+ * for each chunk type and RAID profile (the same as what 'btrfs filesystem df'
+ * reports) followed by the space that is still unallocated on each of the
+ * volume's devices or %NULL in case of error
+ *
+ * For the %BD_BTRFS_SPACE_UNALLOCATED items @device is set and @total is the
+ * unallocated space on it, for the other ones @profile is set and @total and
+ * @used are the allocated and used space. Only a few ioctl()s are run so this
+ * is cheap enough to be called often.
+ */
+BDBtrfsSpaceInfo** bd_btrfs_space_info (gchar *mountpoint, GError **error) {
+    struct btrfs_ioctl_space_args *space_args = NULL;
+    BtrfsSuperblockInfo sb_info;
+    gboolean have_sb = FALSE;
+    GPtrArray *dev_infos = NULL;
+    BDBtrfsDeviceInfo *dev_info = NULL;
+    GPtrArray *ret = NULL;
+    BDBtrfsSpaceInfo *info = NULL;
+    guint64 i = 0;
+    int fd = -1;
+
+    fd = open_mounted_fs (mountpoint, &sb_info, &have_sb, error);
+    if (fd < 0)
+        /* error is already populated */
+        return NULL;
+
+    space_args = get_space_args (fd, error);
+    if (!space_args) {
+        close (fd);
+        return NULL;
+    }
+
+    dev_infos = get_dev_infos (fd, error);
+    close (fd);
+    if (!dev_infos) {
+        g_free (space_args);
+        return NULL;
+    }
+
+    ret = g_ptr_array_new ();
+    for (i=0; i < space_args->total_spaces; i++) {
+        info = g_new0 (BDBtrfsSpaceInfo, 1);
+        info->type = get_space_type (space_args->spaces[i].flags);
+        info->profile = g_strdup (get_profile_name (space_args->spaces[i].flags));
+        info->total = space_args->spaces[i].total_bytes;
+        info->used = space_args->spaces[i].used_bytes;
+        g_ptr_array_add (ret, info);
+    }
+    g_free (space_args);
+
+    for (i=0; i < dev_infos->len; i++) {
+        dev_info = (BDBtrfsDeviceInfo*) g_ptr_array_index (dev_infos, i);
+        info = g_new0 (BDBtrfsSpaceInfo, 1);
+        info->type = BD_BTRFS_SPACE_UNALLOCATED;
+        info->device = g_strdup (dev_info->path);
+        info->total = (dev_info->size > dev_info->used) ? (dev_info->size - dev_info->used) : 0;
+        g_ptr_array_add (ret, info);
+    }
+    g_ptr_array_free (dev_infos, TRUE);
+
+    g_ptr_array_add (ret, NULL);
+    return (BDBtrfsSpaceInfo**) g_ptr_array_free (ret, FALSE);
+}
+
 /**
  * bd_btrfs_mkfs:
  * @devices: (array zero-terminated=1): list of devices to create btrfs volume from
@@ -709,3 +1838,1392 @@ gboolean bd_btrfs_change_label (gchar *mountpoint, gchar *label, GError **error)
 
     return bd_utils_exec_and_report_error (argv, error);
 }
+
+/* Balance and scrub run in the kernel for as long as the ioctl() starting
+   them blocks so they are run in threads and the jobs started by this process
+   are tracked (per filesystem) to be able to report rate and ETA as well as
+   the results once they are finished. The threads may run for hours so the
+   plugin is pinned in memory once a job is started, unloading it (with
+   bd_reinit()) would pull the code from under their hands. */
+typedef struct BtrfsJob {
+    guint ref_count;
+    gint64 start_time;
+    gint64 end_time;
+    guint running;
+    gboolean canceled;
+    gint error_code;
+    struct btrfs_balance_progress balance_stat;
+    guint num_devs;
+    guint64 *devids;
+    struct btrfs_scrub_progress *scrub_stats;
+    gchar *fsid;
+    /* scrub bandwidth limits to restore once the scrub finishes (if changed) */
+    guint64 *old_speed_limits;
+} BtrfsJob;
+
+typedef struct BtrfsJobThreadData {
+    BtrfsJob *job;
+    int fd;
+    guint dev_idx;
+    BDBtrfsIOPrioClass ioprio_class;
+    gint ioprio_classdata;
+    struct btrfs_ioctl_balance_args balance_args;
+} BtrfsJobThreadData;
+
+/* protects the tables below as well as the jobs in them */
+static GMutex jobs_lock;
+static GHashTable *balance_jobs = NULL;
+static GHashTable *scrub_jobs = NULL;
+
+#define IOPRIO_CLASS_SHIFT_ 13
+#define IOPRIO_WHO_PROCESS_ 1
+
+/* how long to wait for a balance/scrub to start (in microseconds) */
+#define JOB_START_TIMEOUT (5 * G_USEC_PER_SEC)
+#define JOB_START_POLL_INTERVAL (10 * 1000)
+/* how long the job has to be running in the kernel with our thread(s) still
+   blocked in the ioctl() to be considered started by us (a refused start
+   makes the ioctl() return right away) */
+#define JOB_START_SETTLE_TIME (100 * 1000)
+
+static void restore_scrub_speed_limits (BtrfsJob *job);
+
+static void job_unref (BtrfsJob *job) {
+    /* jobs_lock has to be held */
+    job->ref_count--;
+    if (job->ref_count > 0)
+        return;
+
+    g_free (job->devids);
+    g_free (job->scrub_stats);
+    g_free (job->fsid);
+    g_free (job->old_speed_limits);
+    g_free (job);
+}
+
+static void job_finish_thread (BtrfsJob *job, int ret, int err) {
+    /* jobs_lock has to be held */
+    if (ret != 0) {
+        if (err == ECANCELED)
+            job->canceled = TRUE;
+        else if (job->error_code == 0)
+            job->error_code = err;
+    }
+    job->running--;
+    if (job->running == 0) {
+        job->end_time = g_get_monotonic_time ();
+        restore_scrub_speed_limits (job);
+    }
+    job_unref (job);
+}
+
+/**
+ * register_job: (skip)
+ * @jobs: (inout): table of jobs to register the new one in
+ * @fsid: fsid of the filesystem the job runs on
+ * @num_threads: number of threads the job is going to use
+ * @what: name of the operation (for the error message)
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (transfer none): a new job replacing the previous (finished) one
+ * for @fsid (if any) with one reference for the table and one per thread or
+ * %NULL if a job started by this process is still running on @fsid
+ */
+static BtrfsJob* register_job (GHashTable **jobs, const gchar *fsid, guint num_threads, const gchar *what, GError **error) {
+    BtrfsJob *job = NULL;
+
+    /* jobs_lock has to be held */
+    if (!*jobs)
+        *jobs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) job_unref);
+
+    job = g_hash_table_lookup (*jobs, fsid);
+    if (job && (job->running > 0)) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_STATE,
+                     "A %s is already running on the volume", what);
+        return NULL;
+    }
+
+    job = g_new0 (BtrfsJob, 1);
+    job->ref_count = 1 + num_threads;
+    job->running = num_threads;
+    job->start_time = g_get_monotonic_time ();
+    job->fsid = g_strdup (fsid);
+    g_hash_table_replace (*jobs, g_strdup (fsid), job);
+
+    return job;
+}
+
+static gchar* get_fsid (int fd, GError **error) {
+    struct btrfs_ioctl_fs_info_args fs_info;
+
+    memset (&fs_info, 0, sizeof (fs_info));
+    if (ioctl (fd, BTRFS_IOC_FS_INFO, &fs_info) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to get information about the filesystem: %s", strerror (errno));
+        return NULL;
+    }
+
+    return fsid_to_str (fs_info.fsid);
+}
+
+/**
+ * wait_for_job_start: (skip)
+ * @job: job to wait for
+ * @fd: file descriptor of the mounted btrfs volume
+ * @is_running: function telling whether the job is running in the kernel
+ * @what: name of the operation (for the error message)
+ * @error: (out): place to store error (if any)
+ *
+ * Waits until the job is running in the kernel with its threads still blocked
+ * in the ioctl() (for a while), or until the job's thread(s) report an error or
+ * the job finishes. No job may be running in the kernel when the job's threads
+ * are started, see check_job_not_running().
+ *
+ * Returns: whether the job started successfully (or already finished
+ * successfully) or not
+ */
+static gboolean wait_for_job_start (BtrfsJob *job, int fd, gboolean (*is_running) (int fd), const gchar *what, GError **error) {
+    gint64 deadline = g_get_monotonic_time () + JOB_START_TIMEOUT;
+    gint64 running_since = 0;
+    gboolean started = FALSE;
+    gboolean finished = FALSE;
+    gint error_code = 0;
+
+    while (!started && (g_get_monotonic_time () < deadline)) {
+        g_mutex_lock (&jobs_lock);
+        finished = (job->running == 0);
+        error_code = job->error_code;
+        g_mutex_unlock (&jobs_lock);
+        if (finished || (error_code != 0))
+            break;
+
+        if (is_running (fd)) {
+            if (running_since == 0)
+                running_since = g_get_monotonic_time ();
+            /* our thread(s) would have returned by now if the kernel refused to start */
+            started = (g_get_monotonic_time () - running_since) >= JOB_START_SETTLE_TIME;
+        } else
+            running_since = 0;
+
+        if (!started)
+            g_usleep (JOB_START_POLL_INTERVAL);
+    }
+
+    if (error_code != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, (error_code == EINPROGRESS) ? BD_BTRFS_ERROR_STATE : BD_BTRFS_ERROR_DEVICE,
+                     "Failed to start %s: %s", what, strerror (error_code));
+        return FALSE;
+    }
+
+    /* still not running nor finished means the kernel is just slow to start */
+    return TRUE;
+}
+
+/**
+ * check_job_not_running: (skip)
+ *
+ * Returns: whether no job is running on the @fd volume in the kernel (started
+ * by this or any other process) or not
+ */
+static gboolean check_job_not_running (int fd, gboolean (*is_running) (int fd), const gchar *what, GError **error) {
+    if (is_running (fd)) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_STATE,
+                     "A %s is already running on the volume", what);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void compute_rate_and_eta (BtrfsJob *job, guint64 done, guint64 total, gdouble *rate, guint64 *eta) {
+    gint64 end = job->running > 0 ? g_get_monotonic_time () : job->end_time;
+    gdouble elapsed = (gdouble) (end - job->start_time) / G_USEC_PER_SEC;
+
+    *rate = 0;
+    *eta = 0;
+    if (elapsed <= 0)
+        return;
+
+    *rate = done / elapsed;
+    if ((job->running > 0) && (*rate > 0) && (total > done))
+        *eta = (guint64) ((total - done) / *rate);
+}
+
+static gboolean balance_is_running (int fd) {
+    struct btrfs_ioctl_balance_args args;
+
+    memset (&args, 0, sizeof (args));
+    return ioctl (fd, BTRFS_IOC_BALANCE_PROGRESS, &args) == 0;
+}
+
+static gpointer balance_thread (gpointer data) {
+    BtrfsJobThreadData *thread_data = (BtrfsJobThreadData *) data;
+    int ret = 0;
+    int err = 0;
+
+    ret = ioctl (thread_data->fd, BTRFS_IOC_BALANCE_V2, &(thread_data->balance_args));
+    err = errno;
+    close (thread_data->fd);
+
+    g_mutex_lock (&jobs_lock);
+    thread_data->job->balance_stat = thread_data->balance_args.stat;
+    job_finish_thread (thread_data->job, ret, err);
+    g_mutex_unlock (&jobs_lock);
+
+    g_free (thread_data);
+    return NULL;
+}
+
+/**
+ * bd_btrfs_balance_start:
+ * @mountpoint: a mountpoint of the btrfs volume to balance
+ * @data_usage: only relocate data chunks that are used less than @data_usage percent (0 to relocate all)
+ * @metadata_usage: only relocate metadata (and system) chunks that are used less than @metadata_usage percent (0 to relocate all)
+ * @error: (out): place to store error (if any)
+ *
+ * Starts balancing the @mountpoint volume in the background, use
+ * bd_btrfs_balance_status() to monitor the progress and
+ * bd_btrfs_balance_cancel() to stop it.
+ *
+ * Returns: whether the balance was successfully started or not
+ */
+gboolean bd_btrfs_balance_start (gchar *mountpoint, guint data_usage, guint metadata_usage, GError **error) {
+    BtrfsJobThreadData *thread_data = NULL;
+    BtrfsJob *job = NULL;
+    gchar *fsid = NULL;
+    int fd = -1;
+    int thread_fd = -1;
+    gboolean ret = FALSE;
+
+    if ((data_usage > 100) || (metadata_usage > 100)) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_INVALID_ARGUMENT,
+                     "Invalid usage filter, has to be between 0 and 100 percent");
+        return FALSE;
+    }
+
+    fd = open (mountpoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", mountpoint, strerror (errno));
+        return FALSE;
+    }
+
+    fsid = get_fsid (fd, error);
+    if (!fsid) {
+        close (fd);
+        return FALSE;
+    }
+
+    if (!check_job_not_running (fd, balance_is_running, "balance", error)) {
+        g_free (fsid);
+        close (fd);
+        return FALSE;
+    }
+
+    /* the thread needs its own file descriptor as it may outlive this call */
+    thread_fd = dup (fd);
+    if (thread_fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to duplicate file descriptor: %s", strerror (errno));
+        g_free (fsid);
+        close (fd);
+        return FALSE;
+    }
+
+    thread_data = g_new0 (BtrfsJobThreadData, 1);
+    thread_data->fd = thread_fd;
+    /* system chunks are balanced together with metadata, just like
+       'btrfs balance start -m' does */
+    thread_data->balance_args.flags = BTRFS_BALANCE_DATA | BTRFS_BALANCE_METADATA | BTRFS_BALANCE_SYSTEM;
+    if (data_usage > 0) {
+        thread_data->balance_args.data.flags |= BTRFS_BALANCE_ARGS_USAGE;
+        thread_data->balance_args.data.usage = data_usage;
+    }
+    if (metadata_usage > 0) {
+        thread_data->balance_args.meta.flags |= BTRFS_BALANCE_ARGS_USAGE;
+        thread_data->balance_args.meta.usage = metadata_usage;
+        thread_data->balance_args.sys.flags |= BTRFS_BALANCE_ARGS_USAGE;
+        thread_data->balance_args.sys.usage = metadata_usage;
+    }
+    if ((data_usage == 0) && (metadata_usage == 0))
+        /* balancing everything (including system chunks) requires force */
+        thread_data->balance_args.flags |= BTRFS_BALANCE_FORCE;
+
+    g_mutex_lock (&jobs_lock);
+    job = register_job (&balance_jobs, fsid, 1, "balance", error);
+    if (!job) {
+        g_mutex_unlock (&jobs_lock);
+        close (thread_fd);
+        g_free (thread_data);
+        g_free (fsid);
+        close (fd);
+        return FALSE;
+    }
+    thread_data->job = job;
+    /* keep the job alive while waiting for it to start */
+    job->ref_count++;
+    g_mutex_unlock (&jobs_lock);
+
+    bd_utils_pin_module ((gpointer) bd_btrfs_balance_start);
+    g_thread_unref (g_thread_new ("bd-btrfs-balance", balance_thread, thread_data));
+
+    ret = wait_for_job_start (job, fd, balance_is_running, "balance", error);
+
+    g_mutex_lock (&jobs_lock);
+    job_unref (job);
+    g_mutex_unlock (&jobs_lock);
+
+    g_free (fsid);
+    close (fd);
+    return ret;
+}
+
+/**
+ * bd_btrfs_balance_status:
+ * @mountpoint: a mountpoint of the btrfs volume to get the balance status of
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (transfer full): status of the balance of the @mountpoint volume or
+ * %NULL in case of error
+ *
+ * The progress is reported in chunks, rate (chunks per second) and ETA
+ * (seconds) are only available for balances started by this process.
+ */
+BDBtrfsBalanceStatus* bd_btrfs_balance_status (gchar *mountpoint, GError **error) {
+    struct btrfs_ioctl_balance_args args;
+    BDBtrfsBalanceStatus *ret = NULL;
+    BtrfsJob *job = NULL;
+    gchar *fsid = NULL;
+    int fd = -1;
+    int status = 0;
+    int err = 0;
+
+    fd = open (mountpoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", mountpoint, strerror (errno));
+        return NULL;
+    }
+
+    fsid = get_fsid (fd, error);
+    if (!fsid) {
+        close (fd);
+        return NULL;
+    }
+
+    memset (&args, 0, sizeof (args));
+    status = ioctl (fd, BTRFS_IOC_BALANCE_PROGRESS, &args);
+    err = errno;
+    close (fd);
+    if ((status != 0) && (err != ENOTCONN)) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to get balance progress: %s", strerror (err));
+        g_free (fsid);
+        return NULL;
+    }
+
+    ret = g_new0 (BDBtrfsBalanceStatus, 1);
+
+    g_mutex_lock (&jobs_lock);
+    job = balance_jobs ? g_hash_table_lookup (balance_jobs, fsid) : NULL;
+    if (status == 0) {
+        /* a balance is known to the kernel */
+        ret->state = (args.state & BTRFS_BALANCE_STATE_RUNNING) ? BD_BTRFS_OP_STATE_RUNNING : BD_BTRFS_OP_STATE_PAUSED;
+        ret->expected = args.stat.expected;
+        ret->considered = args.stat.considered;
+        ret->completed = args.stat.completed;
+        if (job && (job->running == 0))
+            /* our job is over, this is some other balance */
+            job = NULL;
+    } else if (job) {
+        if (job->running > 0)
+            ret->state = BD_BTRFS_OP_STATE_RUNNING;
+        else if (job->canceled)
+            ret->state = BD_BTRFS_OP_STATE_CANCELED;
+        else if (job->error_code != 0)
+            ret->state = BD_BTRFS_OP_STATE_FAILED;
+        else
+            ret->state = BD_BTRFS_OP_STATE_FINISHED;
+        ret->expected = job->balance_stat.expected;
+        ret->considered = job->balance_stat.considered;
+        ret->completed = job->balance_stat.completed;
+    } else
+        ret->state = BD_BTRFS_OP_STATE_IDLE;
+
+    if (job)
+        compute_rate_and_eta (job, ret->completed, ret->expected, &(ret->rate), &(ret->eta));
+    g_mutex_unlock (&jobs_lock);
+
+    g_free (fsid);
+    return ret;
+}
+
+/**
+ * bd_btrfs_balance_cancel:
+ * @mountpoint: a mountpoint of the btrfs volume to cancel the balance of
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: whether the running balance of the @mountpoint volume was
+ * successfully canceled or not
+ */
+gboolean bd_btrfs_balance_cancel (gchar *mountpoint, GError **error) {
+    int fd = -1;
+
+    fd = open (mountpoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", mountpoint, strerror (errno));
+        return FALSE;
+    }
+
+    /* blocks until the balance is really canceled */
+    if (ioctl (fd, BTRFS_IOC_BALANCE_CTL, BTRFS_BALANCE_CTL_CANCEL) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to cancel balance: %s", strerror (errno));
+        close (fd);
+        return FALSE;
+    }
+
+    close (fd);
+    return TRUE;
+}
+
+static gboolean scrub_is_running (int fd) {
+    /* scrub is running if it is running on any of the devices */
+    GPtrArray *dev_infos = NULL;
+    struct btrfs_ioctl_scrub_args args;
+    gboolean ret = FALSE;
+    guint i = 0;
+
+    dev_infos = get_dev_infos (fd, NULL);
+    if (!dev_infos)
+        return FALSE;
+
+    for (i=0; !ret && (i < dev_infos->len); i++) {
+        memset (&args, 0, sizeof (args));
+        args.devid = ((BDBtrfsDeviceInfo*) g_ptr_array_index (dev_infos, i))->id;
+        ret = ioctl (fd, BTRFS_IOC_SCRUB_PROGRESS, &args) == 0;
+    }
+    g_ptr_array_free (dev_infos, TRUE);
+
+    return ret;
+}
+
+static gpointer scrub_thread (gpointer data) {
+    BtrfsJobThreadData *thread_data = (BtrfsJobThreadData *) data;
+    struct btrfs_ioctl_scrub_args args;
+    int ret = 0;
+    int err = 0;
+
+    if (thread_data->ioprio_class != BD_BTRFS_IOPRIO_CLASS_NONE)
+        /* applies to the calling thread only, failure is not fatal */
+        if (syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS_, 0,
+                     (thread_data->ioprio_class << IOPRIO_CLASS_SHIFT_) | thread_data->ioprio_classdata) != 0)
+            g_warning ("Failed to set I/O priority for scrub: %s", strerror (errno));
+
+    memset (&args, 0, sizeof (args));
+    args.devid = thread_data->job->devids[thread_data->dev_idx];
+    args.end = G_MAXUINT64;
+    ret = ioctl (thread_data->fd, BTRFS_IOC_SCRUB, &args);
+    err = errno;
+    close (thread_data->fd);
+
+    g_mutex_lock (&jobs_lock);
+    thread_data->job->scrub_stats[thread_data->dev_idx] = args.progress;
+    job_finish_thread (thread_data->job, ret, err);
+    g_mutex_unlock (&jobs_lock);
+
+    g_free (thread_data);
+    return NULL;
+}
+
+static gchar* get_scrub_speed_limit_path (const gchar *fsid, guint64 devid) {
+    return g_strdup_printf ("/sys/fs/btrfs/%s/devinfo/%"G_GUINT64_FORMAT"/scrub_speed_max", fsid, devid);
+}
+
+static gboolean get_scrub_speed_limit (const gchar *fsid, guint64 devid, guint64 *limit, GError **error) {
+    gchar *path = NULL;
+    gchar *value = NULL;
+
+    path = get_scrub_speed_limit_path (fsid, devid);
+    if (!g_file_get_contents (path, &value, NULL, error)) {
+        g_prefix_error (error, "Failed to get scrub bandwidth limit (not supported by the kernel?): ");
+        g_free (path);
+        return FALSE;
+    }
+    *limit = g_ascii_strtoull (value, NULL, 10);
+    g_free (value);
+    g_free (path);
+
+    return TRUE;
+}
+
+static gboolean set_scrub_speed_limit (const gchar *fsid, guint64 devid, guint64 limit, GError **error) {
+    gchar *path = NULL;
+    gchar *value = NULL;
+    gsize len = 0;
+    int fd = -1;
+    ssize_t written = 0;
+
+    path = get_scrub_speed_limit_path (fsid, devid);
+    /* sysfs attributes have to be written in place (no temporary file and
+       rename like g_file_set_contents() does) */
+    fd = open (path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to set scrub bandwidth limit (not supported by the kernel?): "
+                     "Failed to open '%s': %s", path, strerror (errno));
+        g_free (path);
+        return FALSE;
+    }
+
+    value = g_strdup_printf ("%"G_GUINT64_FORMAT, limit);
+    len = strlen (value);
+    do
+        written = write (fd, value, len);
+    while ((written < 0) && (errno == EINTR));
+    if (written != (ssize_t) len) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to set scrub bandwidth limit: Failed to write '%s': %s", path,
+                     (written < 0) ? strerror (errno) : "Short write");
+        close (fd);
+        g_free (value);
+        g_free (path);
+        return FALSE;
+    }
+    close (fd);
+    g_free (value);
+    g_free (path);
+
+    return TRUE;
+}
+
+static void reset_scrub_speed_limits (const gchar *fsid, guint64 *devids, guint64 *limits, guint num_devs) {
+    GError *l_error = NULL;
+    guint i = 0;
+
+    for (i=0; i < num_devs; i++)
+        if (!set_scrub_speed_limit (fsid, devids[i], limits[i], &l_error)) {
+            g_warning ("Failed to restore scrub bandwidth limit: %s", l_error->message);
+            g_clear_error (&l_error);
+        }
+}
+
+static void restore_scrub_speed_limits (BtrfsJob *job) {
+    /* jobs_lock has to be held */
+    if (!job->old_speed_limits)
+        return;
+
+    reset_scrub_speed_limits (job->fsid, job->devids, job->old_speed_limits, job->num_devs);
+    g_free (job->old_speed_limits);
+    job->old_speed_limits = NULL;
+}
+
+/**
+ * limit_scrub_speed: (skip)
+ *
+ * Sets the scrub bandwidth @limit for all the @devids devices.
+ *
+ * Returns: (transfer full): the previous limits to restore once the scrub
+ * finishes or %NULL in case of error
+ */
+static guint64* limit_scrub_speed (const gchar *fsid, guint64 *devids, guint num_devs, guint64 limit, GError **error) {
+    guint64 *old_limits = g_new0 (guint64, num_devs);
+    guint i = 0;
+
+    for (i=0; i < num_devs; i++) {
+        if (!get_scrub_speed_limit (fsid, devids[i], &(old_limits[i]), error) ||
+            !set_scrub_speed_limit (fsid, devids[i], limit, error)) {
+            /* put back the limits changed so far */
+            reset_scrub_speed_limits (fsid, devids, old_limits, i);
+            g_free (old_limits);
+            return NULL;
+        }
+    }
+
+    return old_limits;
+}
+
+/**
+ * bd_btrfs_scrub_start:
+ * @mountpoint: a mountpoint of the btrfs volume to scrub
+ * @ioprio_class: I/O priority class for the scrub (%BD_BTRFS_IOPRIO_CLASS_NONE to keep the default)
+ * @ioprio_classdata: I/O priority level within @ioprio_class (0-7 for the RT and BE classes)
+ * @bandwidth_limit: maximum scrub bandwidth per device in bytes per second (0 to keep the current limit)
+ * @error: (out): place to store error (if any)
+ *
+ * Starts scrubbing all the devices of the @mountpoint volume in the background,
+ * use bd_btrfs_scrub_status() to monitor the progress and
+ * bd_btrfs_scrub_cancel() to stop it. The previous bandwidth limits are
+ * restored once the scrub finishes.
+ *
+ * Returns: whether the scrub was successfully started or not
+ */
+gboolean bd_btrfs_scrub_start (gchar *mountpoint, BDBtrfsIOPrioClass ioprio_class, gint ioprio_classdata, guint64 bandwidth_limit, GError **error) {
+    BtrfsJobThreadData *thread_data = NULL;
+    GPtrArray *dev_infos = NULL;
+    BtrfsJob *job = NULL;
+    gchar *fsid = NULL;
+    guint64 *devids = NULL;
+    guint64 *old_limits = NULL;
+    guint num_devs = 0;
+    int fd = -1;
+    int *thread_fds = NULL;
+    guint i = 0;
+    gboolean ret = FALSE;
+
+    if ((ioprio_classdata < 0) || (ioprio_classdata > 7)) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_INVALID_ARGUMENT,
+                     "Invalid I/O priority level %d, has to be between 0 and 7", ioprio_classdata);
+        return FALSE;
+    }
+
+    fd = open (mountpoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", mountpoint, strerror (errno));
+        return FALSE;
+    }
+
+    fsid = get_fsid (fd, error);
+    if (!fsid) {
+        close (fd);
+        return FALSE;
+    }
+
+    if (!check_job_not_running (fd, scrub_is_running, "scrub", error)) {
+        g_free (fsid);
+        close (fd);
+        return FALSE;
+    }
+
+    dev_infos = get_dev_infos (fd, error);
+    if (!dev_infos) {
+        g_free (fsid);
+        close (fd);
+        return FALSE;
+    }
+    num_devs = dev_infos->len;
+    devids = g_new0 (guint64, num_devs);
+    for (i=0; i < num_devs; i++)
+        devids[i] = ((BDBtrfsDeviceInfo*) g_ptr_array_index (dev_infos, i))->id;
+    g_ptr_array_free (dev_infos, TRUE);
+
+    if (bandwidth_limit > 0) {
+        old_limits = limit_scrub_speed (fsid, devids, num_devs, bandwidth_limit, error);
+        if (!old_limits) {
+            g_free (devids);
+            g_free (fsid);
+            close (fd);
+            return FALSE;
+        }
+    }
+
+    /* the threads need their own file descriptors as they may outlive this call */
+    thread_fds = g_new0 (int, num_devs);
+    for (i=0; i < num_devs; i++) {
+        thread_fds[i] = dup (fd);
+        if (thread_fds[i] < 0) {
+            g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                         "Failed to duplicate file descriptor: %s", strerror (errno));
+            while (i > 0)
+                close (thread_fds[--i]);
+            g_free (thread_fds);
+            if (old_limits)
+                reset_scrub_speed_limits (fsid, devids, old_limits, num_devs);
+            g_free (old_limits);
+            g_free (devids);
+            g_free (fsid);
+            close (fd);
+            return FALSE;
+        }
+    }
+
+    g_mutex_lock (&jobs_lock);
+    job = register_job (&scrub_jobs, fsid, num_devs, "scrub", error);
+    if (!job) {
+        g_mutex_unlock (&jobs_lock);
+        for (i=0; i < num_devs; i++)
+            close (thread_fds[i]);
+        g_free (thread_fds);
+        if (old_limits)
+            reset_scrub_speed_limits (fsid, devids, old_limits, num_devs);
+        g_free (old_limits);
+        g_free (devids);
+        g_free (fsid);
+        close (fd);
+        return FALSE;
+    }
+    job->num_devs = num_devs;
+    job->devids = devids;
+    job->scrub_stats = g_new0 (struct btrfs_scrub_progress, num_devs);
+    /* restored by the last thread of the job */
+    job->old_speed_limits = old_limits;
+    /* keep the job alive while waiting for it to start */
+    job->ref_count++;
+    g_mutex_unlock (&jobs_lock);
+
+    bd_utils_pin_module ((gpointer) bd_btrfs_scrub_start);
+    /* one thread per device, just like 'btrfs scrub start' */
+    for (i=0; i < num_devs; i++) {
+        thread_data = g_new0 (BtrfsJobThreadData, 1);
+        thread_data->job = job;
+        thread_data->fd = thread_fds[i];
+        thread_data->dev_idx = i;
+        thread_data->ioprio_class = ioprio_class;
+        thread_data->ioprio_classdata = ioprio_classdata;
+        g_thread_unref (g_thread_new ("bd-btrfs-scrub", scrub_thread, thread_data));
+    }
+    g_free (thread_fds);
+
+    ret = wait_for_job_start (job, fd, scrub_is_running, "scrub", error);
+
+    g_mutex_lock (&jobs_lock);
+    job_unref (job);
+    g_mutex_unlock (&jobs_lock);
+
+    g_free (fsid);
+    close (fd);
+    return ret;
+}
+
+/**
+ * get_raw_used: (skip)
+ *
+ * Returns: estimated number of bytes scrub needs to read from the volume's
+ * devices (used bytes multiplied by the number of copies)
+ */
+static guint64 get_raw_used (int fd) {
+    struct btrfs_ioctl_space_args *space_args = NULL;
+    guint64 flags = 0;
+    guint64 ret = 0;
+    guint64 i = 0;
+
+    space_args = get_space_args (fd, NULL);
+    if (!space_args)
+        return 0;
+
+    for (i=0; i < space_args->total_spaces; i++) {
+        flags = space_args->spaces[i].flags;
+        if (flags & BTRFS_SPACE_INFO_GLOBAL_RSV)
+            /* part of the metadata space */
+            continue;
+        if (flags & (BTRFS_BLOCK_GROUP_DUP | BTRFS_BLOCK_GROUP_RAID1 | BTRFS_BLOCK_GROUP_RAID10))
+            ret += 2 * space_args->spaces[i].used_bytes;
+        else if (flags & BTRFS_BLOCK_GROUP_RAID1C3)
+            ret += 3 * space_args->spaces[i].used_bytes;
+        else if (flags & BTRFS_BLOCK_GROUP_RAID1C4)
+            ret += 4 * space_args->spaces[i].used_bytes;
+        else
+            ret += space_args->spaces[i].used_bytes;
+    }
+    g_free (space_args);
+
+    return ret;
+}
+
+static void add_scrub_progress (BDBtrfsScrubStatus *status, struct btrfs_scrub_progress *progress) {
+    status->bytes_scrubbed += progress->data_bytes_scrubbed + progress->tree_bytes_scrubbed;
+    status->read_errors += progress->read_errors;
+    status->csum_errors += progress->csum_errors;
+    status->verify_errors += progress->verify_errors;
+    status->corrected_errors += progress->corrected_errors;
+    status->uncorrectable_errors += progress->uncorrectable_errors;
+}
+
+/**
+ * bd_btrfs_scrub_status:
+ * @mountpoint: a mountpoint of the btrfs volume to get the scrub status of
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (transfer full): status of the scrub of the @mountpoint volume or
+ * %NULL in case of error
+ *
+ * The @bytes_total is an estimate based on the used space and RAID profiles,
+ * rate (bytes per second) and ETA (seconds) are only available for scrubs
+ * started by this process.
+ */
+BDBtrfsScrubStatus* bd_btrfs_scrub_status (gchar *mountpoint, GError **error) {
+    struct btrfs_ioctl_scrub_args args;
+    BDBtrfsScrubStatus *ret = NULL;
+    GPtrArray *dev_infos = NULL;
+    BtrfsJob *job = NULL;
+    gchar *fsid = NULL;
+    gboolean running = FALSE;
+    guint64 devid = 0;
+    guint i = 0;
+    guint y = 0;
+    int fd = -1;
+
+    fd = open (mountpoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", mountpoint, strerror (errno));
+        return NULL;
+    }
+
+    fsid = get_fsid (fd, error);
+    if (!fsid) {
+        close (fd);
+        return NULL;
+    }
+
+    dev_infos = get_dev_infos (fd, error);
+    if (!dev_infos) {
+        g_free (fsid);
+        close (fd);
+        return NULL;
+    }
+
+    ret = g_new0 (BDBtrfsScrubStatus, 1);
+    ret->bytes_total = get_raw_used (fd);
+
+    g_mutex_lock (&jobs_lock);
+    job = scrub_jobs ? g_hash_table_lookup (scrub_jobs, fsid) : NULL;
+    for (i=0; i < dev_infos->len; i++) {
+        devid = ((BDBtrfsDeviceInfo*) g_ptr_array_index (dev_infos, i))->id;
+        memset (&args, 0, sizeof (args));
+        args.devid = devid;
+        if (ioctl (fd, BTRFS_IOC_SCRUB_PROGRESS, &args) == 0) {
+            running = TRUE;
+            add_scrub_progress (ret, &(args.progress));
+        } else if (job) {
+            /* not running (anymore), use the final progress of our job */
+            for (y=0; y < job->num_devs; y++)
+                if (job->devids[y] == devid)
+                    add_scrub_progress (ret, &(job->scrub_stats[y]));
+        }
+    }
+    g_ptr_array_free (dev_infos, TRUE);
+    close (fd);
+
+    if (running || (job && job->running > 0))
+        ret->state = BD_BTRFS_OP_STATE_RUNNING;
+    else if (!job)
+        ret->state = BD_BTRFS_OP_STATE_IDLE;
+    else if (job->canceled)
+        ret->state = BD_BTRFS_OP_STATE_CANCELED;
+    else if (job->error_code != 0)
+        ret->state = BD_BTRFS_OP_STATE_FAILED;
+    else
+        ret->state = BD_BTRFS_OP_STATE_FINISHED;
+
+    if (job && !(running && (job->running == 0)))
+        /* only if the running scrub is ours */
+        compute_rate_and_eta (job, ret->bytes_scrubbed, ret->bytes_total, &(ret->rate), &(ret->eta));
+    g_mutex_unlock (&jobs_lock);
+
+    g_free (fsid);
+    return ret;
+}
+
+/**
+ * bd_btrfs_scrub_cancel:
+ * @mountpoint: a mountpoint of the btrfs volume to cancel the scrub of
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: whether the running scrub of the @mountpoint volume was
+ * successfully canceled or not
+ */
+gboolean bd_btrfs_scrub_cancel (gchar *mountpoint, GError **error) {
+    int fd = -1;
+
+    fd = open (mountpoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", mountpoint, strerror (errno));
+        return FALSE;
+    }
+
+    if (ioctl (fd, BTRFS_IOC_SCRUB_CANCEL) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to cancel scrub: %s", strerror (errno));
+        close (fd);
+        return FALSE;
+    }
+
+    close (fd);
+    return TRUE;
+}
+
+static int compare_qgroup_ids (const void *a, const void *b) {
+    guint64 id_a = ((const BDBtrfsQgroupInfo *) a)->id;
+    guint64 id_b = ((const BDBtrfsQgroupInfo *) b)->id;
+
+    return (id_a > id_b) - (id_a < id_b);
+}
+
+static BDBtrfsQgroupInfo* find_qgroup (BDBtrfsQgroupInfo *items, guint64 n_items, guint64 id) {
+    BDBtrfsQgroupInfo key;
+
+    if (n_items == 0)
+        return NULL;
+
+    key.id = id;
+    return bsearch (&key, items, n_items, sizeof (BDBtrfsQgroupInfo), compare_qgroup_ids);
+}
+
+/**
+ * search_qgroups: (skip)
+ * @mountpoint: a mountpoint of the btrfs volume to search the quota tree of
+ * @qgroups: (inout): qgroups to update (sorted by their IDs)
+ * @error: (out): place to store error (if any)
+ *
+ * Updates @qgroups with the information from the quota tree blocks changed in
+ * (or after) the @qgroups->generation transaction and sets it to the newest
+ * generation seen. New qgroups are added to @qgroups which stays sorted.
+ *
+ * Returns: whether the quota tree was successfully searched or not
+ */
+static gboolean search_qgroups (const gchar *mountpoint, BDBtrfsQgroupArray *qgroups, GError **error) {
+    struct btrfs_ioctl_search_args_v2 *args = NULL;
+    struct btrfs_ioctl_search_header header;
+    struct btrfs_qgroup_info_item info_item;
+    struct btrfs_qgroup_limit_item limit_item;
+    BDBtrfsQgroupInfo *qgroup = NULL;
+    gsize buf_size = 64 KiB;
+    guint64 n_old = qgroups->n_items;
+    guint64 allocated = qgroups->n_items;
+    guint64 generation = qgroups->generation;
+    guint64 offset = 0;
+    guint64 flags = 0;
+    gint num_items = 0;
+    gint i = 0;
+    int fd = -1;
+
+    fd = open (mountpoint, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", mountpoint, strerror (errno));
+        return FALSE;
+    }
+
+    args = g_malloc0 (sizeof (struct btrfs_ioctl_search_args_v2) + buf_size);
+    args->buf_size = buf_size;
+    args->key.tree_id = BTRFS_QUOTA_TREE_OBJECTID;
+    args->key.min_type = BTRFS_QGROUP_INFO_KEY;
+    args->key.max_type = BTRFS_QGROUP_LIMIT_KEY;
+    args->key.max_offset = G_MAXUINT64;
+    args->key.min_transid = qgroups->generation;
+    args->key.max_transid = G_MAXUINT64;
+
+    /* all the info items go before all the limit items (lower key type) and
+       both are sorted by the qgroup IDs (key offset) so the items newly added
+       to the end of the array are sorted too */
+    while ((num_items = search_tree_next (fd, args, error)) > 0) {
+        offset = 0;
+        for (i=0; i < num_items; i++) {
+            memcpy (&header, ((guint8 *) args->buf) + offset, sizeof (header));
+            offset += sizeof (header);
+            generation = MAX (generation, header.transid);
+
+            if ((header.type == BTRFS_QGROUP_INFO_KEY) && (header.len >= sizeof (info_item))) {
+                memcpy (&info_item, ((guint8 *) args->buf) + offset, sizeof (info_item));
+                qgroup = find_qgroup (qgroups->items, n_old, header.offset);
+                if (!qgroup) {
+                    if (qgroups->n_items == allocated) {
+                        allocated = MAX (2 * allocated, 64);
+                        qgroups->items = g_renew (BDBtrfsQgroupInfo, qgroups->items, allocated);
+                    }
+                    qgroup = &(qgroups->items[qgroups->n_items++]);
+                    memset (qgroup, 0, sizeof (BDBtrfsQgroupInfo));
+                    qgroup->id = header.offset;
+                }
+                qgroup->generation = GUINT64_FROM_LE (info_item.generation);
+                qgroup->referenced = GUINT64_FROM_LE (info_item.rfer);
+                qgroup->exclusive = GUINT64_FROM_LE (info_item.excl);
+            } else if ((header.type == BTRFS_QGROUP_LIMIT_KEY) && (header.len >= sizeof (limit_item))) {
+                memcpy (&limit_item, ((guint8 *) args->buf) + offset, sizeof (limit_item));
+                qgroup = find_qgroup (qgroups->items, n_old, header.offset);
+                if (!qgroup)
+                    qgroup = find_qgroup (qgroups->items + n_old, qgroups->n_items - n_old, header.offset);
+                if (qgroup) {
+                    flags = GUINT64_FROM_LE (limit_item.flags);
+                    qgroup->max_referenced = (flags & BTRFS_QGROUP_LIMIT_MAX_RFER) ? GUINT64_FROM_LE (limit_item.max_rfer) : 0;
+                    qgroup->max_exclusive = (flags & BTRFS_QGROUP_LIMIT_MAX_EXCL) ? GUINT64_FROM_LE (limit_item.max_excl) : 0;
+                }
+            }
+            offset += header.len;
+        }
+    }
+
+    close (fd);
+    g_free (args);
+
+    if (num_items < 0) {
+        g_prefix_error (error, "Failed to read the quota tree (are quotas enabled?): ");
+        /* the items found so far are valid, just not sorted */
+        if (qgroups->n_items > n_old)
+            qsort (qgroups->items, qgroups->n_items, sizeof (BDBtrfsQgroupInfo), compare_qgroup_ids);
+        return FALSE;
+    }
+
+    if (qgroups->n_items > n_old)
+        qsort (qgroups->items, qgroups->n_items, sizeof (BDBtrfsQgroupInfo), compare_qgroup_ids);
+    if (allocated > qgroups->n_items)
+        qgroups->items = g_renew (BDBtrfsQgroupInfo, qgroups->items, qgroups->n_items);
+    qgroups->generation = generation;
+
+    return TRUE;
+}
+
+/**
+ * bd_btrfs_qgroup_list:
+ * @mountpoint: a mountpoint of the btrfs volume to list the qgroups of
+ * @error: (out): place to store error (if any)
+ *
+ * Reads the quota tree of the @mountpoint volume directly (without running
+ * 'btrfs qgroup show'). The qgroups are stored in one contiguous array sorted
+ * by their IDs, the level of a qgroup is stored in the highest 16 bits of its
+ * ID. Limits that are not set are reported as 0. Use
+ * bd_btrfs_qgroup_list_refresh() to cheaply update the result later.
+ *
+ * Returns: (transfer full): qgroups of the @mountpoint volume (to be freed
+ * with bd_btrfs_qgroup_array_free()) or %NULL in case of error
+ */
+BDBtrfsQgroupArray* bd_btrfs_qgroup_list (gchar *mountpoint, GError **error) {
+    BDBtrfsQgroupArray *ret = g_new0 (BDBtrfsQgroupArray, 1);
+
+    if (!search_qgroups (mountpoint, ret, error)) {
+        bd_btrfs_qgroup_array_free (ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+/**
+ * bd_btrfs_qgroup_list_refresh:
+ * @mountpoint: a mountpoint of the btrfs volume to refresh the qgroups of
+ * @qgroups: qgroups of the @mountpoint volume as returned by bd_btrfs_qgroup_list()
+ * @error: (out): place to store error (if any)
+ *
+ * Updates @qgroups by only reading the parts of the quota tree that changed
+ * since @qgroups were listed or last refreshed (based on @qgroups->generation).
+ * New qgroups are added to @qgroups, but removed qgroups are not detected, use
+ * bd_btrfs_qgroup_list() for that. Pointers to the items of @qgroups may be
+ * invalidated by this function.
+ *
+ * Returns: whether @qgroups were successfully refreshed or not
+ */
+gboolean bd_btrfs_qgroup_list_refresh (gchar *mountpoint, BDBtrfsQgroupArray *qgroups, GError **error) {
+    return search_qgroups (mountpoint, qgroups, error);
+}
+
+/* size of the chunks the send streams are moved in */
+#define STREAM_CHUNK_SIZE (1 MiB)
+
+/* Writing to a pipe with no reader raises SIGPIPE which would kill the whole
+   process so it is blocked in the threads moving the send streams around (and
+   in the threads they create) and the signal is consumed afterwards (the write
+   fails with EPIPE anyway). */
+static void block_sigpipe (sigset_t *old_mask) {
+    sigset_t mask;
+
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGPIPE);
+    pthread_sigmask (SIG_BLOCK, &mask, old_mask);
+}
+
+static void unblock_sigpipe (sigset_t *old_mask) {
+    sigset_t mask;
+    struct timespec no_wait = {0, 0};
+
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGPIPE);
+    if (!sigismember (old_mask, SIGPIPE))
+        /* consume the SIGPIPE raised while it was blocked (if any) */
+        while ((sigtimedwait (&mask, NULL, &no_wait) < 0) && (errno == EINTR));
+    pthread_sigmask (SIG_SETMASK, old_mask, NULL);
+}
+
+/**
+ * pump_stream: (skip)
+ * @in_fd: file descriptor to read the stream from
+ * @out_fd: file descriptor to write the stream to
+ * @bytes: (inout): counter of the transferred bytes
+ * @error: (out): place to store error (if any)
+ *
+ * Moves all the data from @in_fd to @out_fd using splice() (one of them has to
+ * be a pipe) which doesn't copy the data to user space. Falls back to plain
+ * read() and write() if splice() is not supported by the other file descriptor.
+ *
+ * Returns: whether the whole stream was successfully transferred or not
+ */
+static gboolean pump_stream (int in_fd, int out_fd, guint64 *bytes, GError **error) {
+    gchar *buf = NULL;
+    ssize_t n_read = 0;
+    ssize_t n_written = 0;
+    ssize_t done = 0;
+
+    while ((n_read = splice (in_fd, NULL, out_fd, NULL, STREAM_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE)) != 0) {
+        if (n_read > 0)
+            *bytes += n_read;
+        else if (errno == EINVAL)
+            /* e.g. a file opened with O_APPEND */
+            break;
+        else if (errno != EINTR) {
+            g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                         "Failed to transfer the stream: %s", strerror (errno));
+            return FALSE;
+        }
+    }
+    if (n_read == 0)
+        return TRUE;
+
+    buf = g_malloc (STREAM_CHUNK_SIZE);
+    while ((n_read = read (in_fd, buf, STREAM_CHUNK_SIZE)) != 0) {
+        if ((n_read < 0) && (errno == EINTR))
+            continue;
+        if (n_read < 0) {
+            g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                         "Failed to read the stream: %s", strerror (errno));
+            g_free (buf);
+            return FALSE;
+        }
+        for (done=0; done < n_read; done += n_written) {
+            n_written = write (out_fd, buf + done, n_read - done);
+            if ((n_written < 0) && (errno == EINTR))
+                n_written = 0;
+            else if (n_written < 0) {
+                g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                             "Failed to write the stream: %s", strerror (errno));
+                g_free (buf);
+                return FALSE;
+            }
+        }
+        *bytes += n_read;
+    }
+    g_free (buf);
+
+    return TRUE;
+}
+
+static BDBtrfsTransferStats* get_transfer_stats (guint64 bytes, gint64 start_time) {
+    BDBtrfsTransferStats *ret = g_new0 (BDBtrfsTransferStats, 1);
+
+    ret->bytes = bytes;
+    ret->duration = (guint64) (g_get_monotonic_time () - start_time);
+    if (ret->duration > 0)
+        ret->rate = (gdouble) bytes * G_USEC_PER_SEC / ret->duration;
+
+    return ret;
+}
+
+static gboolean get_subvolume_id (const gchar *path, __u64 *id, GError **error) {
+    struct btrfs_ioctl_ino_lookup_args args;
+    int fd = -1;
+
+    fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", path, strerror (errno));
+        return FALSE;
+    }
+
+    /* looking up the top directory with tree ID 0 gives us the subvolume's ID */
+    memset (&args, 0, sizeof (args));
+    args.objectid = BTRFS_FIRST_FREE_OBJECTID;
+    if (ioctl (fd, BTRFS_IOC_INO_LOOKUP, &args) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to get subvolume ID of '%s': %s", path, strerror (errno));
+        close (fd);
+        return FALSE;
+    }
+    close (fd);
+
+    *id = args.treeid;
+    return TRUE;
+}
+
+typedef struct SendThreadData {
+    int subvol_fd;
+    struct btrfs_ioctl_send_args args;
+    int error_code;
+} SendThreadData;
+
+static gpointer send_thread (gpointer data) {
+    SendThreadData *thread_data = (SendThreadData *) data;
+
+    if (ioctl (thread_data->subvol_fd, BTRFS_IOC_SEND, &(thread_data->args)) != 0)
+        thread_data->error_code = errno;
+    /* let the reader know the stream is complete */
+    close ((int) thread_data->args.send_fd);
+
+    return NULL;
+}
+
+/**
+ * bd_btrfs_send:
+ * @subvolume: path to the (read-only) subvolume to send
+ * @fd: file descriptor to write the send stream to
+ * @parent: (allow-none): path to the (read-only) parent subvolume for an incremental send or %NULL
+ * @error: (out): place to store error (if any)
+ *
+ * Generates the send stream of @subvolume (with only the changes against
+ * @parent if given) using the BTRFS_IOC_SEND ioctl() and writes it to @fd. The
+ * stream is moved to @fd without copying it through user space if possible.
+ *
+ * Returns: (transfer full): statistics about the transferred stream or %NULL in
+ * case of error
+ */
+BDBtrfsTransferStats* bd_btrfs_send (gchar *subvolume, gint fd, gchar *parent, GError **error) {
+    SendThreadData thread_data;
+    GThread *thread = NULL;
+    GError *l_error = NULL;
+    __u64 parent_id = 0;
+    guint64 bytes = 0;
+    gint64 start_time = 0;
+    int pipe_fds[2] = {-1, -1};
+    sigset_t old_mask;
+
+    memset (&thread_data, 0, sizeof (thread_data));
+    if (parent) {
+        if (!get_subvolume_id (parent, &parent_id, error))
+            return NULL;
+        /* the parent is also used as a clone source, just like 'btrfs send -p' does */
+        thread_data.args.parent_root = parent_id;
+        thread_data.args.clone_sources = &parent_id;
+        thread_data.args.clone_sources_count = 1;
+    }
+
+    thread_data.subvol_fd = open (subvolume, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (thread_data.subvol_fd < 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to open '%s': %s", subvolume, strerror (errno));
+        return NULL;
+    }
+
+    /* the kernel writes the stream into the pipe and we splice it from there */
+    if (pipe2 (pipe_fds, O_CLOEXEC) != 0) {
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to create a pipe: %s", strerror (errno));
+        close (thread_data.subvol_fd);
+        return NULL;
+    }
+    thread_data.args.send_fd = pipe_fds[1];
+
+    start_time = g_get_monotonic_time ();
+    block_sigpipe (&old_mask);
+    thread = g_thread_new ("bd-btrfs-send", send_thread, &thread_data);
+    pump_stream (pipe_fds[0], fd, &bytes, &l_error);
+    /* makes the send fail with EPIPE if we failed to transfer the whole stream */
+    close (pipe_fds[0]);
+    g_thread_join (thread);
+    unblock_sigpipe (&old_mask);
+    close (thread_data.subvol_fd);
+
+    /* EPIPE only means we stopped reading the stream, report why */
+    if ((thread_data.error_code != 0) && !(l_error && (thread_data.error_code == EPIPE))) {
+        g_clear_error (&l_error);
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to send '%s': %s", subvolume, strerror (thread_data.error_code));
+        return NULL;
+    }
+    if (l_error) {
+        g_propagate_error (error, l_error);
+        return NULL;
+    }
+
+    return get_transfer_stats (bytes, start_time);
+}
+
+/**
+ * read_output: (skip)
+ * @data: file descriptor to read (passed with GINT_TO_POINTER())
+ *
+ * Reads everything from the given file descriptor until EOF or error.
+ *
+ * Returns: (transfer full): a #GString with the data read
+ */
+static gpointer read_output (gpointer data) {
+    gint fd = GPOINTER_TO_INT (data);
+    GString *output = g_string_new (NULL);
+    gchar buf[4 KiB];
+    ssize_t n_read = 0;
+
+    while ((n_read = read (fd, buf, sizeof (buf))) != 0) {
+        if (n_read > 0)
+            g_string_append_len (output, buf, n_read);
+        else if (errno != EINTR)
+            break;
+    }
+
+    return output;
+}
+
+/**
+ * bd_btrfs_receive:
+ * @mountpoint: path to the directory on a btrfs volume to receive the subvolume into
+ * @fd: file descriptor to read the send stream from
+ * @error: (out): place to store error (if any)
+ *
+ * Feeds the send stream read from @fd to 'btrfs receive' (there is no kernel
+ * interface for receiving, the stream has to be replayed in user space). The
+ * stream is moved from @fd without copying it through user space if possible.
+ *
+ * Returns: (transfer full): statistics about the transferred stream or %NULL in
+ * case of error
+ */
+BDBtrfsTransferStats* bd_btrfs_receive (gchar *mountpoint, gint fd, GError **error) {
+    gchar *argv[4] = {"btrfs", "receive", mountpoint, NULL};
+    GError *l_error = NULL;
+    gchar *exit_msg = NULL;
+    GString *err_output = NULL;
+    GThread *err_thread = NULL;
+    guint64 bytes = 0;
+    gint64 start_time = 0;
+    gint in_fd = -1;
+    gint err_fd = -1;
+    gint status = 0;
+    GPid pid = 0;
+    sigset_t old_mask;
+
+    if (!g_spawn_async_with_pipes (NULL, argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL,
+                                   NULL, NULL, &pid, &in_fd, NULL, &err_fd, error))
+        return NULL;
+
+    /* read the error output while the stream is being fed, 'btrfs receive'
+       could otherwise block on a full stderr pipe and never read the rest of
+       the stream */
+    err_thread = g_thread_new ("bd-btrfs-receive-stderr", read_output, GINT_TO_POINTER (err_fd));
+
+    start_time = g_get_monotonic_time ();
+    block_sigpipe (&old_mask);
+    pump_stream (fd, in_fd, &bytes, &l_error);
+    close (in_fd);
+    unblock_sigpipe (&old_mask);
+
+    /* finishes once 'btrfs receive' closes its stderr (i.e. exits) */
+    err_output = (GString *) g_thread_join (err_thread);
+    close (err_fd);
+
+    while ((waitpid (pid, &status, 0) < 0) && (errno == EINTR));
+    g_spawn_close_pid (pid);
+
+    if (!WIFEXITED (status) || (WEXITSTATUS (status) != 0)) {
+        if (WIFEXITED (status))
+            exit_msg = g_strdup_printf ("exited with code %d", WEXITSTATUS (status));
+        else if (WIFSIGNALED (status))
+            exit_msg = g_strdup_printf ("killed by signal %d", WTERMSIG (status));
+        else
+            exit_msg = g_strdup ("terminated abnormally");
+        /* report both, the failure of 'btrfs receive' is most likely the
+           reason for any transfer error, but not necessarily */
+        g_set_error (error, BD_BTRFS_ERROR, BD_BTRFS_ERROR_DEVICE,
+                     "Failed to receive into '%s' (%s)%s%s: %s", mountpoint, exit_msg,
+                     l_error ? ", " : "", l_error ? l_error->message : "", g_strstrip (err_output->str));
+        g_free (exit_msg);
+        g_clear_error (&l_error);
+        g_string_free (err_output, TRUE);
+        return NULL;
+    }
+    g_string_free (err_output, TRUE);
+
+    if (l_error) {
+        g_propagate_error (error, l_error);
+        return NULL;
+    }
+
+    return get_transfer_stats (bytes, start_time);
+}
@@ -15,6 +15,8 @@ GQuark bd_btrfs_error_quark (void);
 typedef enum {
     BD_BTRFS_ERROR_DEVICE,
     BD_BTRFS_ERROR_PARSE,
+    BD_BTRFS_ERROR_INVALID_ARGUMENT,
+    BD_BTRFS_ERROR_STATE,
 } BDBtrfsError;
 
 typedef struct BDBtrfsDeviceInfo {
@@ -46,6 +48,112 @@ typedef struct BDBtrfsFilesystemInfo {
 void bd_btrfs_filesystem_info_free (BDBtrfsFilesystemInfo *info);
 BDBtrfsFilesystemInfo* bd_btrfs_filesystem_info_copy (BDBtrfsFilesystemInfo *info);
 
+typedef enum {
+    BD_BTRFS_SPACE_DATA,
+    BD_BTRFS_SPACE_METADATA,
+    BD_BTRFS_SPACE_MIXED,
+    BD_BTRFS_SPACE_SYSTEM,
+    BD_BTRFS_SPACE_GLOBAL_RESERVE,
+    BD_BTRFS_SPACE_UNALLOCATED,
+} BDBtrfsSpaceType;
+
+typedef struct BDBtrfsSpaceInfo {
+    BDBtrfsSpaceType type;
+    gchar *profile;
+    gchar *device;
+    guint64 total;
+    guint64 used;
+} BDBtrfsSpaceInfo;
+
+void bd_btrfs_space_info_free (BDBtrfsSpaceInfo *info);
+BDBtrfsSpaceInfo* bd_btrfs_space_info_copy (BDBtrfsSpaceInfo *info);
+
+typedef enum {
+    BD_BTRFS_OP_STATE_IDLE,
+    BD_BTRFS_OP_STATE_RUNNING,
+    BD_BTRFS_OP_STATE_PAUSED,
+    BD_BTRFS_OP_STATE_FINISHED,
+    BD_BTRFS_OP_STATE_CANCELED,
+    BD_BTRFS_OP_STATE_FAILED,
+} BDBtrfsOpState;
+
+typedef enum {
+    BD_BTRFS_IOPRIO_CLASS_NONE,
+    BD_BTRFS_IOPRIO_CLASS_RT,
+    BD_BTRFS_IOPRIO_CLASS_BE,
+    BD_BTRFS_IOPRIO_CLASS_IDLE,
+} BDBtrfsIOPrioClass;
+
+typedef struct BDBtrfsBalanceStatus {
+    BDBtrfsOpState state;
+    guint64 expected;
+    guint64 considered;
+    guint64 completed;
+    gdouble rate;
+    guint64 eta;
+} BDBtrfsBalanceStatus;
+
+void bd_btrfs_balance_status_free (BDBtrfsBalanceStatus *status);
+BDBtrfsBalanceStatus* bd_btrfs_balance_status_copy (BDBtrfsBalanceStatus *status);
+
+typedef struct BDBtrfsScrubStatus {
+    BDBtrfsOpState state;
+    guint64 bytes_total;
+    guint64 bytes_scrubbed;
+    guint64 read_errors;
+    guint64 csum_errors;
+    guint64 verify_errors;
+    guint64 corrected_errors;
+    guint64 uncorrectable_errors;
+    gdouble rate;
+    guint64 eta;
+} BDBtrfsScrubStatus;
+
+void bd_btrfs_scrub_status_free (BDBtrfsScrubStatus *status);
+BDBtrfsScrubStatus* bd_btrfs_scrub_status_copy (BDBtrfsScrubStatus *status);
+
+typedef struct BDBtrfsSnapshotResult {
+    gchar *source;
+    gchar *dest;
+    gboolean success;
+    gchar *error_message;
+} BDBtrfsSnapshotResult;
+
+void bd_btrfs_snapshot_result_free (BDBtrfsSnapshotResult *result);
+BDBtrfsSnapshotResult* bd_btrfs_snapshot_result_copy (BDBtrfsSnapshotResult *result);
+
+typedef struct BDBtrfsQgroupInfo {
+    guint64 id;
+    guint64 generation;
+    guint64 referenced;
+    guint64 exclusive;
+    guint64 max_referenced;
+    guint64 max_exclusive;
+} BDBtrfsQgroupInfo;
+
+void bd_btrfs_qgroup_info_free (BDBtrfsQgroupInfo *info);
+BDBtrfsQgroupInfo* bd_btrfs_qgroup_info_copy (BDBtrfsQgroupInfo *info);
+
+typedef struct BDBtrfsQgroupArray {
+    BDBtrfsQgroupInfo *items;
+    guint64 n_items;
+    /* generation to refresh the items from */
+    guint64 generation;
+} BDBtrfsQgroupArray;
+
+void bd_btrfs_qgroup_array_free (BDBtrfsQgroupArray *qgroups);
+BDBtrfsQgroupArray* bd_btrfs_qgroup_array_copy (BDBtrfsQgroupArray *qgroups);
+BDBtrfsQgroupInfo* bd_btrfs_qgroup_array_get_item (BDBtrfsQgroupArray *qgroups, guint64 index);
+
+typedef struct BDBtrfsTransferStats {
+    guint64 bytes;
+    guint64 duration;
+    gdouble rate;
+} BDBtrfsTransferStats;
+
+void bd_btrfs_transfer_stats_free (BDBtrfsTransferStats *stats);
+BDBtrfsTransferStats* bd_btrfs_transfer_stats_copy (BDBtrfsTransferStats *stats);
+
 gboolean bd_btrfs_create_volume (gchar **devices, gchar *label, gchar *data_level, gchar *md_level, GError **error);
 gboolean bd_btrfs_add_device (gchar *mountpoint, gchar *device, GError **error);
 gboolean bd_btrfs_remove_device (gchar *mountpoint, gchar *device, GError **error);
@@ -54,9 +162,11 @@ gboolean bd_btrfs_delete_subvolume (gchar *mountpoint, gchar *name, GError **err
 guint64 bd_btrfs_get_default_subvolume_id (gchar *mountpoint, GError **error);
 gboolean bd_btrfs_set_default_subvolume (gchar *mountpoint, guint64 subvol_id, GError **error);
 gboolean bd_btrfs_create_snapshot (gchar *source, gchar *dest, gboolean ro, GError **error);
+BDBtrfsSnapshotResult** bd_btrfs_create_snapshots (gchar **sources, gchar **dests, gboolean ro, guint max_threads, GError **error);
 BDBtrfsDeviceInfo** bd_btrfs_list_devices (gchar *device, GError **error);
 BDBtrfsSubvolumeInfo** bd_btrfs_list_subvolumes (gchar *mountpoint, gboolean snapshots_only, GError **error);
 BDBtrfsFilesystemInfo* bd_btrfs_filesystem_info (gchar *device, GError **error);
+BDBtrfsSpaceInfo** bd_btrfs_space_info (gchar *mountpoint, GError **error);
 
 gboolean bd_btrfs_mkfs (gchar **devices, gchar *label, gchar *data_level, gchar *md_level, GError **error);
 gboolean bd_btrfs_resize (gchar *mountpoint, guint64 size, GError **error);
@@ -64,4 +174,15 @@ gboolean bd_btrfs_check (gchar *device, GError **error);
 gboolean bd_btrfs_repair (gchar *device, GError **error);
 gboolean bd_btrfs_change_label (gchar *mountpoint, gchar *label, GError **error);
 
+gboolean bd_btrfs_balance_start (gchar *mountpoint, guint data_usage, guint metadata_usage, GError **error);
+BDBtrfsBalanceStatus* bd_btrfs_balance_status (gchar *mountpoint, GError **error);
+gboolean bd_btrfs_balance_cancel (gchar *mountpoint, GError **error);
+gboolean bd_btrfs_scrub_start (gchar *mountpoint, BDBtrfsIOPrioClass ioprio_class, gint ioprio_classdata, guint64 bandwidth_limit, GError **error);
+BDBtrfsScrubStatus* bd_btrfs_scrub_status (gchar *mountpoint, GError **error);
+gboolean bd_btrfs_scrub_cancel (gchar *mountpoint, GError **error);
+BDBtrfsQgroupArray* bd_btrfs_qgroup_list (gchar *mountpoint, GError **error);
+gboolean bd_btrfs_qgroup_list_refresh (gchar *mountpoint, BDBtrfsQgroupArray *qgroups, GError **error);
+BDBtrfsTransferStats* bd_btrfs_send (gchar *subvolume, gint fd, gchar *parent, GError **error);
+BDBtrfsTransferStats* bd_btrfs_receive (gchar *mountpoint, gint fd, GError **error);
+
 #endif  /* BD_BTRFS */
@@ -18,12 +18,15 @@
  */
 
 #include <string.h>
+#include <errno.h>
 #include <glib.h>
 #include <libcryptsetup.h>
 #include <nss.h>
 #include <libvolume_key.h>
+#include <libdevmapper.h>
 #include <sys/fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <linux/random.h>
 #include <unistd.h>
 
@@ -53,6 +56,97 @@ GQuark bd_crypto_error_quark (void)
     return g_quark_from_static_string ("g-bd-crypto-error-quark");
 }
 
+BDCryptoLUKSOpenResult* bd_crypto_luks_open_result_copy (BDCryptoLUKSOpenResult *result) {
+    BDCryptoLUKSOpenResult *new_result = g_new0 (BDCryptoLUKSOpenResult, 1);
+
+    new_result->device = g_strdup (result->device);
+    new_result->name = g_strdup (result->name);
+    new_result->success = result->success;
+    new_result->error_message = g_strdup (result->error_message);
+
+    return new_result;
+}
+
+void bd_crypto_luks_open_result_free (BDCryptoLUKSOpenResult *result) {
+    g_free (result->device);
+    g_free (result->name);
+    g_free (result->error_message);
+    g_free (result);
+}
+
+BDCryptoCipherBenchmark* bd_crypto_cipher_benchmark_copy (BDCryptoCipherBenchmark *benchmark) {
+    BDCryptoCipherBenchmark *new_benchmark = g_new0 (BDCryptoCipherBenchmark, 1);
+
+    new_benchmark->cipher = g_strdup (benchmark->cipher);
+    new_benchmark->mode = g_strdup (benchmark->mode);
+    new_benchmark->key_size = benchmark->key_size;
+    new_benchmark->encryption_speed = benchmark->encryption_speed;
+    new_benchmark->decryption_speed = benchmark->decryption_speed;
+
+    return new_benchmark;
+}
+
+void bd_crypto_cipher_benchmark_free (BDCryptoCipherBenchmark *benchmark) {
+    g_free (benchmark->cipher);
+    g_free (benchmark->mode);
+    g_free (benchmark);
+}
+
+BDCryptoActiveDevice* bd_crypto_active_device_copy (BDCryptoActiveDevice *device) {
+    BDCryptoActiveDevice *new_device = g_new0 (BDCryptoActiveDevice, 1);
+
+    new_device->name = g_strdup (device->name);
+    new_device->uuid = g_strdup (device->uuid);
+    new_device->backing_device = g_strdup (device->backing_device);
+    new_device->cipher = g_strdup (device->cipher);
+    new_device->key_size = device->key_size;
+    new_device->sector_size = device->sector_size;
+    new_device->flags = device->flags;
+    new_device->offset = device->offset;
+
+    return new_device;
+}
+
+void bd_crypto_active_device_free (BDCryptoActiveDevice *device) {
+    g_free (device->name);
+    g_free (device->uuid);
+    g_free (device->backing_device);
+    g_free (device->cipher);
+    g_free (device);
+}
+
+BDCryptoLUKSReencryptStatus* bd_crypto_luks_reencrypt_status_copy (BDCryptoLUKSReencryptStatus *status) {
+    BDCryptoLUKSReencryptStatus *new_status = g_new0 (BDCryptoLUKSReencryptStatus, 1);
+
+    new_status->state = status->state;
+    new_status->size = status->size;
+    new_status->processed = status->processed;
+    new_status->rate = status->rate;
+    new_status->eta = status->eta;
+
+    return new_status;
+}
+
+void bd_crypto_luks_reencrypt_status_free (BDCryptoLUKSReencryptStatus *status) {
+    g_free (status);
+}
+
+BDCryptoEscrowResult* bd_crypto_escrow_result_copy (BDCryptoEscrowResult *result) {
+    BDCryptoEscrowResult *new_result = g_new0 (BDCryptoEscrowResult, 1);
+
+    new_result->device = g_strdup (result->device);
+    new_result->success = result->success;
+    new_result->error_message = g_strdup (result->error_message);
+
+    return new_result;
+}
+
+void bd_crypto_escrow_result_free (BDCryptoEscrowResult *result) {
+    g_free (result->device);
+    g_free (result->error_message);
+    g_free (result);
+}
+
 /**
  * bd_crypto_generate_backup_passphrase:
  * @error: (out): place to store error (if any)
@@ -81,6 +175,169 @@ gchar* bd_crypto_generate_backup_passphrase(GError **error __attribute__((unused
     return ret;
 }
 
+/* Loaded LUKS contexts of the backing devices are cached (for the sequences
+   of operations on the same device) and validated against a fingerprint of the
+   on-disk header which is much cheaper to compute than loading the header
+   again. A context is removed from the cache while in use so that it's never
+   shared by multiple threads and dropped by every operation changing the
+   header. */
+#define LUKS_HEADER_FINGERPRINT_SIZE (4 KiB)
+#define MAX_CACHED_DEVICES 16
+
+typedef struct CachedDevice {
+    struct crypt_device *cd;
+    gchar *fingerprint;
+} CachedDevice;
+
+static GMutex cache_lock;
+static GHashTable *device_cache = NULL;
+
+static void cached_device_free (CachedDevice *cached) {
+    if (cached->cd)
+        crypt_free (cached->cd);
+    g_free (cached->fingerprint);
+    g_free (cached);
+}
+
+/**
+ * get_header_fingerprint: (skip)
+ * @device: device to get the header fingerprint of
+ *
+ * Returns: (transfer full): checksum of the first
+ * %LUKS_HEADER_FINGERPRINT_SIZE bytes of @device (covering the LUKS header and
+ * its key slots description) or %NULL if failed to read them
+ */
+static gchar* get_header_fingerprint (const gchar *device) {
+    guint8 buf[LUKS_HEADER_FINGERPRINT_SIZE];
+    ssize_t n_read = 0;
+    gint fd = -1;
+
+    fd = open (device, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    n_read = pread (fd, buf, sizeof (buf), 0);
+    close (fd);
+    if (n_read <= 0)
+        return NULL;
+
+    return g_compute_checksum_for_data (G_CHECKSUM_SHA256, buf, n_read);
+}
+
+/**
+ * acquire_luks_device: (skip)
+ * @device: device to get the LUKS context for
+ * @fingerprint: (out) (transfer full): fingerprint of the @device's header to
+ *                                      release the context with
+ * @not_luks: (out) (allow-none): whether @device failed to load as LUKS
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (transfer full): loaded LUKS context for @device (from the cache if
+ * the header didn't change) to be released with release_luks_device() or
+ * invalidate_luks_device() or %NULL in case of error
+ */
+static struct crypt_device* acquire_luks_device (const gchar *device, gchar **fingerprint, gboolean *not_luks, GError **error) {
+    struct crypt_device *cd = NULL;
+    CachedDevice *cached = NULL;
+    gint ret = 0;
+
+    if (not_luks)
+        *not_luks = FALSE;
+
+    *fingerprint = get_header_fingerprint (device);
+    if (*fingerprint) {
+        g_mutex_lock (&cache_lock);
+        cached = device_cache ? g_hash_table_lookup (device_cache, device) : NULL;
+        if (cached && (g_strcmp0 (cached->fingerprint, *fingerprint) == 0)) {
+            cd = cached->cd;
+            cached->cd = NULL;
+        }
+        if (cached)
+            /* either taken over or stale */
+            g_hash_table_remove (device_cache, device);
+        g_mutex_unlock (&cache_lock);
+        if (cd)
+            return cd;
+    }
+
+    ret = crypt_init (&cd, device);
+    if (ret != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to initialize device: %s", strerror(-ret));
+        g_free (*fingerprint);
+        *fingerprint = NULL;
+        return NULL;
+    }
+
+    /* any LUKS version */
+    ret = crypt_load (cd, CRYPT_LUKS, NULL);
+    if (ret != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to load device's parameters: %s", strerror(-ret));
+        if (not_luks)
+            *not_luks = TRUE;
+        crypt_free (cd);
+        g_free (*fingerprint);
+        *fingerprint = NULL;
+        return NULL;
+    }
+
+    return cd;
+}
+
+/**
+ * release_luks_device: (skip)
+ * @device: device @cd is the LUKS context of
+ * @cd: (transfer full): LUKS context acquired with acquire_luks_device()
+ * @fingerprint: (transfer full): fingerprint of the @device's header from acquire_luks_device()
+ *
+ * Puts @cd back to the cache for the next operation on @device. Only for
+ * operations not changing the header, see invalidate_luks_device().
+ */
+static void release_luks_device (const gchar *device, struct crypt_device *cd, gchar *fingerprint) {
+    CachedDevice *cached = NULL;
+
+    if (!fingerprint) {
+        /* cannot be validated */
+        crypt_free (cd);
+        return;
+    }
+
+    cached = g_new0 (CachedDevice, 1);
+    cached->cd = cd;
+    cached->fingerprint = fingerprint;
+
+    g_mutex_lock (&cache_lock);
+    if (!device_cache)
+        device_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) cached_device_free);
+    if (g_hash_table_size (device_cache) >= MAX_CACHED_DEVICES)
+        /* no need for anything smarter, the cache is for sequences of
+           operations on the same device */
+        g_hash_table_remove_all (device_cache);
+    g_hash_table_replace (device_cache, g_strdup (device), cached);
+    g_mutex_unlock (&cache_lock);
+}
+
+/**
+ * invalidate_luks_device: (skip)
+ * @device: device to invalidate the cached LUKS context of
+ * @cd: (allow-none) (transfer full): LUKS context acquired with acquire_luks_device() or %NULL
+ * @fingerprint: (allow-none) (transfer full): fingerprint from acquire_luks_device() or %NULL
+ *
+ * Drops @cd and any cached LUKS context of @device, to be used by operations
+ * changing the header.
+ */
+static void invalidate_luks_device (const gchar *device, struct crypt_device *cd, gchar *fingerprint) {
+    if (cd)
+        crypt_free (cd);
+    g_free (fingerprint);
+
+    g_mutex_lock (&cache_lock);
+    if (device_cache)
+        g_hash_table_remove (device_cache, device);
+    g_mutex_unlock (&cache_lock);
+}
+
 /**
  * bd_crypto_device_is_luks:
  * @device: the queried device
@@ -92,18 +349,21 @@ gchar* bd_crypto_generate_backup_passphrase(GError **error __attribute__((unused
  */
 gboolean bd_crypto_device_is_luks (const gchar *device, GError **error) {
     struct crypt_device *cd = NULL;
-    gint ret;
-
-    ret = crypt_init (&cd, device);
-    if (ret != 0) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to initialize device: %s", strerror(-ret));
+    gchar *fingerprint = NULL;
+    gboolean not_luks = FALSE;
+    GError *l_error = NULL;
+
+    cd = acquire_luks_device (device, &fingerprint, &not_luks, &l_error);
+    if (!cd) {
+        if (not_luks)
+            g_clear_error (&l_error);
+        else
+            g_propagate_error (error, l_error);
         return FALSE;
     }
 
-    ret = crypt_load (cd, CRYPT_LUKS1, NULL);
-    crypt_free (cd);
-    return (ret == 0);
+    release_luks_device (device, cd, fingerprint);
+    return TRUE;
 }
 
 /**
@@ -116,26 +376,15 @@ gboolean bd_crypto_device_is_luks (const gchar *device, GError **error) {
  */
 gchar* bd_crypto_luks_uuid (const gchar *device, GError **error) {
     struct crypt_device *cd = NULL;
-    gint ret_num;
+    gchar *fingerprint = NULL;
     gchar *ret;
 
-    ret_num = crypt_init (&cd, device);
-    if (ret_num != 0) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to initialize device: %s", strerror(-ret_num));
-        return NULL;
-    }
-
-    ret_num = crypt_load (cd, CRYPT_LUKS1, NULL);
-    if (ret_num != 0) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to load device: %s", strerror(-ret_num));
-        crypt_free (cd);
+    cd = acquire_luks_device (device, &fingerprint, NULL, error);
+    if (!cd)
         return NULL;
-    }
 
     ret = g_strdup (crypt_get_uuid (cd));
-    crypt_free (cd);
+    release_luks_device (device, cd, fingerprint);
 
     return ret;
 }
@@ -194,32 +443,184 @@ static int give_passphrase (const char *msg __attribute__((unused)), char *buf,
         return 0;
 }
 
+/* the same set of ciphers 'cryptsetup benchmark' tests, key sizes in bits */
+static const struct {
+    const gchar *cipher;
+    const gchar *mode;
+    guint64 key_size;
+} benchmark_ciphers[] = {
+    {"aes", "cbc", 128},
+    {"serpent", "cbc", 128},
+    {"twofish", "cbc", 128},
+    {"aes", "cbc", 256},
+    {"serpent", "cbc", 256},
+    {"twofish", "cbc", 256},
+    {"aes", "xts", 256},
+    {"serpent", "xts", 256},
+    {"twofish", "xts", 256},
+    {"aes", "xts", 512},
+    {"serpent", "xts", 512},
+    {"twofish", "xts", 512},
+};
+
+/* ciphers BD_CRYPTO_LUKS_CIPHER_AUTO chooses from (all used in the XTS mode) */
+static const gchar *auto_ciphers[] = {"aes", "serpent", "twofish", NULL};
+
+#define BENCHMARK_BUFFER_SIZE (1 MiB)
+#define BENCHMARK_IV_SIZE 16
+
+/* cipher chosen by BD_CRYPTO_LUKS_CIPHER_AUTO for each key size (in bytes),
+   the CPU doesn't change so there's no need to benchmark again */
+static GMutex auto_cipher_lock;
+static GHashTable *auto_cipher_cache = NULL;
+
 /**
- * bd_crypto_luks_format:
- * @device: a device to format as LUKS
- * @cipher: (allow-none): cipher specification (type-mode, e.g. "aes-xts-plain64") or %NULL to use the default
- * @key_size: size of the volume key in bits or 0 to use the default
- * @passphrase: (allow-none): a passphrase for the new LUKS device or %NULL if not requested
- * @key_file: (allow-none): a key file for the new LUKS device or %NULL if not requested
- * @min_entropy: minimum random data entropy (in bits) required to format @device as LUKS
+ * bd_crypto_benchmark:
  * @error: (out): place to store error (if any)
  *
- * Formats the given @device as LUKS according to the other parameters given. If
- * @min_entropy is specified (greater than 0), the function waits for enough
- * entropy to be available in the random data pool (WHICH MAY POTENTIALLY TAKE
- * FOREVER).
+ * Measures the in-memory encryption and decryption speed of the commonly used
+ * ciphers on this machine (the same set of ciphers 'cryptsetup benchmark'
+ * tests). Ciphers not supported by the kernel are left out.
  *
- * Either @passhphrase or @key_file has to be != %NULL.
+ * Returns: (array zero-terminated=1): results of the benchmark for the
+ * individual cipher-mode-key size combinations or %NULL in case of error
+ */
+BDCryptoCipherBenchmark** bd_crypto_benchmark (GError **error) {
+    GPtrArray *results = g_ptr_array_new ();
+    BDCryptoCipherBenchmark *result = NULL;
+    gdouble enc_speed = 0;
+    gdouble dec_speed = 0;
+    gint ret = 0;
+    guint i = 0;
+
+    for (i=0; i < G_N_ELEMENTS (benchmark_ciphers); i++) {
+        ret = crypt_benchmark (NULL, benchmark_ciphers[i].cipher, benchmark_ciphers[i].mode,
+                               benchmark_ciphers[i].key_size / 8, BENCHMARK_IV_SIZE, BENCHMARK_BUFFER_SIZE,
+                               &enc_speed, &dec_speed);
+        if (ret == -ENOTSUP || ret == -ENOENT)
+            /* cipher not available in the kernel */
+            continue;
+        else if (ret < 0) {
+            g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                         "Failed to benchmark cipher '%s-%s': %s", benchmark_ciphers[i].cipher,
+                         benchmark_ciphers[i].mode, strerror(-ret));
+            for (i=0; i < results->len; i++)
+                bd_crypto_cipher_benchmark_free (g_ptr_array_index (results, i));
+            g_ptr_array_free (results, TRUE);
+            return NULL;
+        }
+
+        result = g_new0 (BDCryptoCipherBenchmark, 1);
+        result->cipher = g_strdup (benchmark_ciphers[i].cipher);
+        result->mode = g_strdup (benchmark_ciphers[i].mode);
+        result->key_size = benchmark_ciphers[i].key_size;
+        result->encryption_speed = enc_speed;
+        result->decryption_speed = dec_speed;
+        g_ptr_array_add (results, result);
+    }
+
+    g_ptr_array_add (results, NULL);
+    return (BDCryptoCipherBenchmark **) g_ptr_array_free (results, FALSE);
+}
+
+/**
+ * bd_crypto_benchmark_pbkdf:
+ * @hash: (allow-none): hash algorithm to use for PBKDF2 or %NULL to use "sha256"
+ * @key_size: size of the volume key (in bits) the derived key is for or 0 to use the default
+ * @error: (out): place to store error (if any)
  *
- * Returns: whether the given @device was successfully formatted as LUKS or not
- * (the @error) contains the error in such cases)
+ * Returns: the number of PBKDF2 iterations per second this machine can do with
+ * @hash or 0 in case of error
  */
-gboolean bd_crypto_luks_format (const gchar *device, const gchar *cipher, guint64 key_size, const gchar *passphrase, const gchar *key_file, guint64 min_entropy, GError **error) {
+guint64 bd_crypto_benchmark_pbkdf (const gchar *hash, guint64 key_size, GError **error) {
+    struct crypt_pbkdf_type pbkdf;
+    gint ret = 0;
+
+    memset (&pbkdf, 0, sizeof (pbkdf));
+    pbkdf.type = CRYPT_KDF_PBKDF2;
+    pbkdf.hash = hash ? hash : "sha256";
+    /* iterations needed to spend one second in the PBKDF */
+    pbkdf.time_ms = 1000;
+
+    key_size = (key_size != 0) ? (key_size / 8) : (DEFAULT_LUKS_KEYSIZE_BITS / 8);
+
+    ret = crypt_benchmark_pbkdf (NULL, &pbkdf, "foo", 3, "bar", 3, key_size, NULL, NULL);
+    if (ret < 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to benchmark PBKDF2 with '%s': %s", pbkdf.hash, strerror(-ret));
+        return 0;
+    }
+
+    return (guint64) pbkdf.iterations;
+}
+
+/**
+ * get_auto_cipher: (skip)
+ * @key_size: size of the volume key in bytes
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (transfer full): the fastest of the ciphers suitable for
+ * %BD_CRYPTO_LUKS_CIPHER_AUTO with @key_size on this machine (or the default
+ * cipher if none of them can be benchmarked) or %NULL in case of error
+ */
+static gchar* get_auto_cipher (guint64 key_size, GError **error) {
+    const gchar **cipher = NULL;
+    const gchar *best = NULL;
+    gdouble best_speed = 0;
+    gdouble enc_speed = 0;
+    gdouble dec_speed = 0;
+    gchar *ret = NULL;
+
+    /* XTS splits the key into two keys of the same size and all the ciphers
+       support 128, 192 and 256 bits long keys, with any other key size all the
+       benchmarks would just fail */
+    if ((key_size != 32) && (key_size != 48) && (key_size != 64)) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_INVALID_SPEC,
+                     "Invalid key size for the '%s' cipher: %"G_GUINT64_FORMAT" bits, has to be 256, 384 or 512",
+                     BD_CRYPTO_LUKS_CIPHER_AUTO, key_size * 8);
+        return NULL;
+    }
+
+    g_mutex_lock (&auto_cipher_lock);
+    if (!auto_cipher_cache)
+        auto_cipher_cache = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+
+    ret = g_strdup (g_hash_table_lookup (auto_cipher_cache, GUINT_TO_POINTER (key_size)));
+    if (ret) {
+        g_mutex_unlock (&auto_cipher_lock);
+        return ret;
+    }
+
+    for (cipher=auto_ciphers; *cipher; cipher++) {
+        if (crypt_benchmark (NULL, *cipher, "xts", key_size, BENCHMARK_IV_SIZE, BENCHMARK_BUFFER_SIZE,
+                             &enc_speed, &dec_speed) < 0)
+            continue;
+        /* both directions matter, the slower one is the limit */
+        if (MIN (enc_speed, dec_speed) > best_speed) {
+            best_speed = MIN (enc_speed, dec_speed);
+            best = *cipher;
+        }
+    }
+
+    if (best) {
+        ret = g_strdup_printf ("%s-xts-plain64", best);
+        g_hash_table_insert (auto_cipher_cache, GUINT_TO_POINTER (key_size), g_strdup (ret));
+    } else
+        /* nothing could be benchmarked, don't remember anything and just use the default */
+        ret = g_strdup (DEFAULT_LUKS_CIPHER);
+    g_mutex_unlock (&auto_cipher_lock);
+
+    return ret;
+}
+
+static gboolean luks_format (const gchar *device, const gchar *cipher, guint64 key_size, const gchar *passphrase, const gchar *key_file, guint64 min_entropy,
+                             const gchar *type, void *params, GError **error) {
     struct crypt_device *cd = NULL;
     gint ret;
     gchar **cipher_specs = NULL;
     guint32 current_entropy = 0;
     gint dev_random_fd = -1;
+    gchar *auto_cipher = NULL;
 
     if (!passphrase && !key_file) {
         g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_NO_KEY,
@@ -227,6 +628,9 @@ gboolean bd_crypto_luks_format (const gchar *device, const gchar *cipher, guint6
         return FALSE;
     }
 
+    /* whatever happens, the current header is going to be gone */
+    invalidate_luks_device (device, NULL, NULL);
+
     ret = crypt_init (&cd, device);
     if (ret != 0) {
         g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
@@ -234,6 +638,18 @@ gboolean bd_crypto_luks_format (const gchar *device, const gchar *cipher, guint6
         return FALSE;
     }
 
+    /* resolve requested/default key_size (should be in bytes) */
+    key_size = (key_size != 0) ? (key_size / 8) : (DEFAULT_LUKS_KEYSIZE_BITS / 8);
+
+    if (g_strcmp0 (cipher, BD_CRYPTO_LUKS_CIPHER_AUTO) == 0) {
+        auto_cipher = get_auto_cipher (key_size, error);
+        if (!auto_cipher) {
+            crypt_free (cd);
+            return FALSE;
+        }
+        cipher = auto_cipher;
+    }
+
     cipher = cipher ? cipher : DEFAULT_LUKS_CIPHER;
     cipher_specs = g_strsplit (cipher, "-", 2);
     if (g_strv_length (cipher_specs) != 2) {
@@ -241,12 +657,10 @@ gboolean bd_crypto_luks_format (const gchar *device, const gchar *cipher, guint6
                      "Invalid cipher specification: '%s'", cipher);
         crypt_free (cd);
         g_strfreev (cipher_specs);
+        g_free (auto_cipher);
         return FALSE;
     }
 
-    /* resolve requested/default key_size (should be in bytes) */
-    key_size = (key_size != 0) ? (key_size / 8) : (DEFAULT_LUKS_KEYSIZE_BITS / 8);
-
     /* wait for enough random data entropy (if requested) */
     if (min_entropy > 0) {
         dev_random_fd = open ("/dev/random", O_RDONLY);
@@ -258,9 +672,10 @@ gboolean bd_crypto_luks_format (const gchar *device, const gchar *cipher, guint6
         close (dev_random_fd);
     }
 
-    ret = crypt_format (cd, CRYPT_LUKS1, cipher_specs[0], cipher_specs[1],
-                        NULL, NULL, key_size, NULL);
+    ret = crypt_format (cd, type, cipher_specs[0], cipher_specs[1],
+                        NULL, NULL, key_size, params);
     g_strfreev (cipher_specs);
+    g_free (auto_cipher);
 
     if (ret != 0) {
         g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_FORMAT_FAILED,
@@ -294,6 +709,147 @@ gboolean bd_crypto_luks_format (const gchar *device, const gchar *cipher, guint6
     return TRUE;
 }
 
+/**
+ * bd_crypto_luks_format:
+ * @device: a device to format as LUKS
+ * @cipher: (allow-none): cipher specification (type-mode, e.g. "aes-xts-plain64"),
+ *          %BD_CRYPTO_LUKS_CIPHER_AUTO to use the fastest XTS cipher on this machine
+ *          or %NULL to use the default
+ * @key_size: size of the volume key in bits or 0 to use the default
+ * @passphrase: (allow-none): a passphrase for the new LUKS device or %NULL if not requested
+ * @key_file: (allow-none): a key file for the new LUKS device or %NULL if not requested
+ * @min_entropy: minimum random data entropy (in bits) required to format @device as LUKS
+ * @error: (out): place to store error (if any)
+ *
+ * Formats the given @device as LUKS according to the other parameters given. If
+ * @min_entropy is specified (greater than 0), the function waits for enough
+ * entropy to be available in the random data pool (WHICH MAY POTENTIALLY TAKE
+ * FOREVER).
+ *
+ * With %BD_CRYPTO_LUKS_CIPHER_AUTO, the cipher (AES, Serpent or Twofish in the
+ * XTS mode) with the best in-memory speed (the slower of encryption and
+ * decryption) for @key_size is used, there is no other policy to choose. The
+ * @key_size has to be 256, 384 or 512 bits in such case. If none of the
+ * ciphers can be benchmarked, the default cipher is used.
+ *
+ * Either @passhphrase or @key_file has to be != %NULL.
+ *
+ * Returns: whether the given @device was successfully formatted as LUKS or not
+ * (the @error) contains the error in such cases)
+ */
+gboolean bd_crypto_luks_format (const gchar *device, const gchar *cipher, guint64 key_size, const gchar *passphrase, const gchar *key_file, guint64 min_entropy, GError **error) {
+    return luks_format (device, cipher, key_size, passphrase, key_file, min_entropy, CRYPT_LUKS1, NULL, error);
+}
+
+/**
+ * bd_crypto_luks_format_luks2:
+ * @device: a device to format as LUKS2
+ * @cipher: (allow-none): cipher specification (type-mode, e.g. "aes-xts-plain64"),
+ *          %BD_CRYPTO_LUKS_CIPHER_AUTO to use the fastest XTS cipher on this machine
+ *          or %NULL to use the default
+ * @key_size: size of the volume key in bits or 0 to use the default
+ * @passphrase: (allow-none): a passphrase for the new LUKS device or %NULL if not requested
+ * @key_file: (allow-none): a key file for the new LUKS device or %NULL if not requested
+ * @min_entropy: minimum random data entropy (in bits) required to format @device as LUKS
+ * @sector_size: encryption sector size in bytes (512, 1024, 2048 or 4096) or 0 to let
+ *               libcryptsetup choose it (based on the device)
+ * @pbkdf: (allow-none): PBKDF to use for the key slots ("pbkdf2", "argon2i" or "argon2id") or %NULL to use the default
+ * @iter_time: time (in milliseconds) the PBKDF should take or 0 to use the default
+ * @max_memory_kb: maximum memory (in KiB) the Argon2 PBKDF can use or 0 to use the default
+ * @parallel_threads: maximum number of threads the Argon2 PBKDF can use or 0 to use the default
+ * @error: (out): place to store error (if any)
+ *
+ * Formats the given @device as LUKS2, see bd_crypto_luks_format() for details
+ * about the common parameters. Bigger encryption sectors make the encryption
+ * cheaper, but the sector size must not be smaller than the logical sector size
+ * of the filesystem on the device. @max_memory_kb and @parallel_threads are
+ * ignored for "pbkdf2".
+ *
+ * Returns: whether the given @device was successfully formatted as LUKS2 or not
+ * (the @error) contains the error in such cases)
+ */
+gboolean bd_crypto_luks_format_luks2 (const gchar *device, const gchar *cipher, guint64 key_size, const gchar *passphrase, const gchar *key_file, guint64 min_entropy,
+                                      guint32 sector_size, const gchar *pbkdf, guint32 iter_time, guint32 max_memory_kb, guint32 parallel_threads, GError **error) {
+    struct crypt_params_luks2 params;
+    struct crypt_pbkdf_type pbkdf_type;
+    const struct crypt_pbkdf_type *default_pbkdf = NULL;
+
+    if ((sector_size != 0) && ((sector_size < 512) || (sector_size > 4096) || (sector_size & (sector_size - 1)))) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_INVALID_SPEC,
+                     "Invalid sector size: %"G_GUINT32_FORMAT", has to be a power of 2 between 512 and 4096", sector_size);
+        return FALSE;
+    }
+
+    if (pbkdf && (g_strcmp0 (pbkdf, CRYPT_KDF_PBKDF2) != 0) && (g_strcmp0 (pbkdf, CRYPT_KDF_ARGON2I) != 0) &&
+        (g_strcmp0 (pbkdf, CRYPT_KDF_ARGON2ID) != 0)) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_INVALID_SPEC,
+                     "Invalid PBKDF specification: '%s'", pbkdf);
+        return FALSE;
+    }
+
+    default_pbkdf = crypt_get_pbkdf_default (CRYPT_LUKS2);
+    if (!default_pbkdf) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_FORMAT_FAILED,
+                     "Failed to get the default PBKDF for LUKS2");
+        return FALSE;
+    }
+
+    pbkdf_type = *default_pbkdf;
+    if (pbkdf)
+        pbkdf_type.type = pbkdf;
+    if (iter_time != 0)
+        pbkdf_type.time_ms = iter_time;
+    if (g_strcmp0 (pbkdf_type.type, CRYPT_KDF_PBKDF2) == 0) {
+        /* not applicable to PBKDF2 (and refused by libcryptsetup) */
+        pbkdf_type.max_memory_kb = 0;
+        pbkdf_type.parallel_threads = 0;
+    } else {
+        if (max_memory_kb != 0)
+            pbkdf_type.max_memory_kb = max_memory_kb;
+        if (parallel_threads != 0)
+            pbkdf_type.parallel_threads = parallel_threads;
+    }
+
+    memset (&params, 0, sizeof (params));
+    params.pbkdf = &pbkdf_type;
+    /* 0 means libcryptsetup picks the sector size */
+    params.sector_size = sector_size;
+
+    return luks_format (device, cipher, key_size, passphrase, key_file, min_entropy, CRYPT_LUKS2, &params, error);
+}
+
+/* (BDCryptoLUKSOpenFlags, libcryptsetup activation flag) pairs */
+static const guint32 open_flags_map[][2] = {
+    {BD_CRYPTO_LUKS_OPEN_READONLY, CRYPT_ACTIVATE_READONLY},
+    {BD_CRYPTO_LUKS_OPEN_ALLOW_DISCARDS, CRYPT_ACTIVATE_ALLOW_DISCARDS},
+    {BD_CRYPTO_LUKS_OPEN_SAME_CPU_CRYPT, CRYPT_ACTIVATE_SAME_CPU_CRYPT},
+    {BD_CRYPTO_LUKS_OPEN_SUBMIT_FROM_CRYPT_CPUS, CRYPT_ACTIVATE_SUBMIT_FROM_CRYPT_CPUS},
+    {BD_CRYPTO_LUKS_OPEN_NO_READ_WORKQUEUE, CRYPT_ACTIVATE_NO_READ_WORKQUEUE},
+    {BD_CRYPTO_LUKS_OPEN_NO_WRITE_WORKQUEUE, CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE},
+};
+
+static guint32 get_activate_flags (BDCryptoLUKSOpenFlags flags) {
+    guint32 ret = 0;
+    guint i = 0;
+
+    for (i=0; i < G_N_ELEMENTS (open_flags_map); i++)
+        if (flags & open_flags_map[i][0])
+            ret |= open_flags_map[i][1];
+
+    return ret;
+}
+
+static BDCryptoLUKSOpenFlags get_open_flags (guint32 activate_flags) {
+    guint32 ret = 0;
+    guint i = 0;
+
+    for (i=0; i < G_N_ELEMENTS (open_flags_map); i++)
+        if (activate_flags & open_flags_map[i][1])
+            ret |= open_flags_map[i][0];
+
+    return (BDCryptoLUKSOpenFlags) ret;
+}
+
 /**
  * bd_crypto_luks_open:
  * @device: the device to open
@@ -307,7 +863,26 @@ gboolean bd_crypto_luks_format (const gchar *device, const gchar *cipher, guint6
  * One of @passphrase, @key_file has to be != %NULL.
  */
 gboolean bd_crypto_luks_open (const gchar *device, const gchar *name, const gchar *passphrase, const gchar *key_file, GError **error) {
+    return bd_crypto_luks_open_with_flags (device, name, passphrase, key_file, 0, error);
+}
+
+/**
+ * bd_crypto_luks_open_with_flags:
+ * @device: the device to open
+ * @name: name for the LUKS device
+ * @passphrase: (allow-none): passphrase to open the @device or %NULL
+ * @key_file: (allow-none): key file path to use for opening the @device or %NULL
+ * @flags: flags to activate the LUKS device with
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: whether the @device was successfully opened or not
+ *
+ * One of @passphrase, @key_file has to be != %NULL. If some of the @flags
+ * are not supported by the running kernel, the activation fails.
+ */
+gboolean bd_crypto_luks_open_with_flags (const gchar *device, const gchar *name, const gchar *passphrase, const gchar *key_file, BDCryptoLUKSOpenFlags flags, GError **error) {
     struct crypt_device *cd = NULL;
+    gchar *fingerprint = NULL;
     gint ret = 0;
 
     if (!passphrase && !key_file) {
@@ -316,29 +891,68 @@ gboolean bd_crypto_luks_open (const gchar *device, const gchar *name, const gcha
         return FALSE;
     }
 
-    ret = crypt_init (&cd, device);
-    if (ret != 0) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to initialize device: %s", strerror(-ret));
+    cd = acquire_luks_device (device, &fingerprint, NULL, error);
+    if (!cd)
         return FALSE;
-    }
 
-    ret = crypt_load (cd, CRYPT_LUKS1, NULL);
-    if (ret != 0) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to load device's parameters: %s", strerror(-ret));
-        crypt_free (cd);
+    if (passphrase)
+        ret = crypt_activate_by_passphrase (cd, name, CRYPT_ANY_SLOT, passphrase, strlen(passphrase), get_activate_flags (flags));
+    else
+        ret = crypt_activate_by_keyfile (cd, name, CRYPT_ANY_SLOT, key_file, 0, get_activate_flags (flags));
+
+    /* activation doesn't change the header */
+    release_luks_device (device, cd, fingerprint);
+    if (ret < 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to activate device: %s", strerror(-ret));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * bd_crypto_luks_refresh:
+ * @luks_device: opened LUKS device to change the flags of
+ * @passphrase: (allow-none): passphrase to open the backing device or %NULL
+ * @key_file: (allow-none): key file path to use for opening the backing device or %NULL
+ * @flags: new flags for the @luks_device
+ * @error: (out): place to store error (if any)
+ *
+ * Reloads the @luks_device mapping with @flags replacing its current flags
+ * without closing it. The key is required because the mapping is recreated.
+ *
+ * Returns: whether the flags of the @luks_device were successfully changed or not
+ *
+ * One of @passphrase, @key_file has to be != %NULL.
+ */
+gboolean bd_crypto_luks_refresh (const gchar *luks_device, const gchar *passphrase, const gchar *key_file, BDCryptoLUKSOpenFlags flags, GError **error) {
+    struct crypt_device *cd = NULL;
+    gint ret = 0;
+
+    if (!passphrase && !key_file) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_NO_KEY,
+                     "No passphrase nor key file specified, cannot refresh.");
+        return FALSE;
+    }
+
+    ret = crypt_init_by_name (&cd, luks_device);
+    if (ret != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to initialize device: %s", strerror(-ret));
         return FALSE;
     }
 
     if (passphrase)
-        ret = crypt_activate_by_passphrase (cd, name, CRYPT_ANY_SLOT, passphrase, strlen(passphrase), 0);
+        ret = crypt_activate_by_passphrase (cd, luks_device, CRYPT_ANY_SLOT, passphrase, strlen(passphrase),
+                                            get_activate_flags (flags) | CRYPT_ACTIVATE_REFRESH);
     else
-        ret = crypt_activate_by_keyfile (cd, name, CRYPT_ANY_SLOT, key_file, 0, 0);
+        ret = crypt_activate_by_keyfile (cd, luks_device, CRYPT_ANY_SLOT, key_file, 0,
+                                         get_activate_flags (flags) | CRYPT_ACTIVATE_REFRESH);
 
     if (ret < 0) {
         g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to activate device: %s", strerror(-ret));
+                     "Failed to refresh device: %s", strerror(-ret));
         crypt_free (cd);
         return FALSE;
     }
@@ -347,6 +961,441 @@ gboolean bd_crypto_luks_open (const gchar *device, const gchar *name, const gcha
     return TRUE;
 }
 
+/**
+ * bd_crypto_luks_get_flags:
+ * @luks_device: the queried LUKS device
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: flags the @luks_device is currently active with (0 with @error set
+ * in case of error)
+ */
+BDCryptoLUKSOpenFlags bd_crypto_luks_get_flags (const gchar *luks_device, GError **error) {
+    struct crypt_device *cd = NULL;
+    struct crypt_active_device cad;
+    gint ret = 0;
+
+    ret = crypt_init_by_name (&cd, luks_device);
+    if (ret != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to initialize device: %s", strerror(-ret));
+        return 0;
+    }
+
+    ret = crypt_get_active_device (cd, luks_device, &cad);
+    crypt_free (cd);
+    if (ret != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to get information about the device: %s", strerror(-ret));
+        return 0;
+    }
+
+    return get_open_flags (cad.flags);
+}
+
+/* optional parameters of the dm-crypt table and the corresponding flags */
+static const struct {
+    const gchar *param;
+    BDCryptoLUKSOpenFlags flag;
+} crypt_table_flags[] = {
+    {"allow_discards", BD_CRYPTO_LUKS_OPEN_ALLOW_DISCARDS},
+    {"same_cpu_crypt", BD_CRYPTO_LUKS_OPEN_SAME_CPU_CRYPT},
+    {"submit_from_crypt_cpus", BD_CRYPTO_LUKS_OPEN_SUBMIT_FROM_CRYPT_CPUS},
+    {"no_read_workqueue", BD_CRYPTO_LUKS_OPEN_NO_READ_WORKQUEUE},
+    {"no_write_workqueue", BD_CRYPTO_LUKS_OPEN_NO_WRITE_WORKQUEUE},
+};
+
+/**
+ * get_block_device_path: (skip)
+ * @dev: device as given in a DM table ("major:minor" or a path)
+ *
+ * Returns: (transfer full): path of the @dev device node
+ */
+static gchar* get_block_device_path (const gchar *dev) {
+    gchar *sys_path = NULL;
+    gchar *link = NULL;
+    gchar *ret = NULL;
+
+    if (dev[0] == '/')
+        return g_strdup (dev);
+
+    sys_path = g_strdup_printf ("/sys/dev/block/%s", dev);
+    link = g_file_read_link (sys_path, NULL);
+    g_free (sys_path);
+    if (!link)
+        return g_strdup (dev);
+
+    ret = g_strdup_printf ("/dev/%s", strrchr (link, '/') ? strrchr (link, '/') + 1 : link);
+    g_free (link);
+    return ret;
+}
+
+/**
+ * parse_crypt_table: (skip)
+ * @params: parameters of the crypt target
+ * @device: (out): active device to fill in
+ *
+ * Parses the '<cipher> <key> <iv_offset> <device> <offset> [<#opt_params>
+ * <opt_params>]' dm-crypt table.
+ *
+ * Returns: whether the @params were successfully parsed or not
+ */
+static gboolean parse_crypt_table (const gchar *params, BDCryptoActiveDevice *device) {
+    gchar **fields = NULL;
+    gchar **key_fields = NULL;
+    guint num_fields = 0;
+    guint num_opts = 0;
+    guint i = 0;
+    guint j = 0;
+
+    fields = g_strsplit (params, " ", -1);
+    num_fields = g_strv_length (fields);
+    if (num_fields < 5) {
+        if (num_fields > 1)
+            explicit_bzero (fields[1], strlen (fields[1]));
+        g_strfreev (fields);
+        return FALSE;
+    }
+
+    device->cipher = g_strdup (fields[0]);
+    if (fields[1][0] == ':') {
+        /* key in the kernel keyring, ":<key size>:<key type>:<key description>" */
+        key_fields = g_strsplit (fields[1] + 1, ":", 2);
+        device->key_size = g_ascii_strtoull (key_fields[0], NULL, 10) * 8;
+        g_strfreev (key_fields);
+    } else
+        /* hex-encoded key */
+        device->key_size = strlen (fields[1]) * 4;
+    /* the key itself is not needed for anything */
+    explicit_bzero (fields[1], strlen (fields[1]));
+
+    device->backing_device = get_block_device_path (fields[3]);
+    device->offset = g_ascii_strtoull (fields[4], NULL, 10) * 512;
+    device->sector_size = 512;
+
+    if (num_fields > 5)
+        num_opts = (guint) g_ascii_strtoull (fields[5], NULL, 10);
+    for (i=6; (i < num_fields) && (i < 6 + num_opts); i++) {
+        if (g_str_has_prefix (fields[i], "sector_size:"))
+            device->sector_size = g_ascii_strtoull (fields[i] + strlen ("sector_size:"), NULL, 10);
+        else
+            for (j=0; j < G_N_ELEMENTS (crypt_table_flags); j++)
+                if (g_strcmp0 (fields[i], crypt_table_flags[j].param) == 0)
+                    device->flags |= crypt_table_flags[j].flag;
+    }
+
+    g_strfreev (fields);
+    return TRUE;
+}
+
+/**
+ * get_active_device: (skip)
+ * @name: name of the DM map
+ *
+ * Returns: (transfer full): information about the @name dm-crypt mapping or
+ * %NULL if @name is not a dm-crypt mapping (or went away)
+ */
+static BDCryptoActiveDevice* get_active_device (const gchar *name) {
+    BDCryptoActiveDevice *ret = NULL;
+    struct dm_task *task = NULL;
+    struct dm_info info;
+    void *next = NULL;
+    guint64 start = 0;
+    guint64 length = 0;
+    gchar *target_type = NULL;
+    gchar *params = NULL;
+
+    task = dm_task_create (DM_DEVICE_TABLE);
+    if (!task)
+        return NULL;
+
+    /* the table contains the volume key, make sure it's wiped */
+    if (!dm_task_secure_data (task) || !dm_task_set_name (task, name) || !dm_task_run (task) ||
+        !dm_task_get_info (task, &info) || !info.exists) {
+        dm_task_destroy (task);
+        return NULL;
+    }
+
+    do {
+        next = dm_get_next_target (task, next, &start, &length, &target_type, &params);
+        if (g_strcmp0 (target_type, "crypt") != 0 || !params)
+            continue;
+
+        ret = g_new0 (BDCryptoActiveDevice, 1);
+        if (!parse_crypt_table (params, ret)) {
+            bd_crypto_active_device_free (ret);
+            ret = NULL;
+            continue;
+        }
+        ret->name = g_strdup (name);
+        ret->uuid = g_strdup (dm_task_get_uuid (task));
+        if (info.read_only)
+            ret->flags |= BD_CRYPTO_LUKS_OPEN_READONLY;
+        /* only the first crypt target is interesting */
+        break;
+    } while (next);
+
+    dm_task_destroy (task);
+    return ret;
+}
+
+/**
+ * bd_crypto_list_active:
+ * @error: (out): place to store error (if any)
+ *
+ * Lists all the active dm-crypt mappings (not only LUKS) in one sweep over the
+ * device-mapper devices, without initializing libcryptsetup for each of them.
+ *
+ * Returns: (array zero-terminated=1): information about the active dm-crypt
+ * mappings or %NULL in case of error
+ */
+BDCryptoActiveDevice** bd_crypto_list_active (GError **error) {
+    GPtrArray *devices = NULL;
+    BDCryptoActiveDevice *device = NULL;
+    struct dm_task *task_list = NULL;
+    struct dm_names *names = NULL;
+    guint next = 0;
+
+    task_list = dm_task_create (DM_DEVICE_LIST);
+    if (!task_list) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to create DM task");
+        return NULL;
+    }
+
+    if (!dm_task_run (task_list)) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to list DM devices");
+        dm_task_destroy (task_list);
+        return NULL;
+    }
+
+    devices = g_ptr_array_new ();
+    names = dm_task_get_names (task_list);
+    if (names && names->dev) {
+        do {
+            names = (struct dm_names *) ((gchar *) names + next);
+            next = names->next;
+            device = get_active_device (names->name);
+            if (device)
+                g_ptr_array_add (devices, device);
+        } while (next);
+    }
+    dm_task_destroy (task_list);
+
+    g_ptr_array_add (devices, NULL);
+    return (BDCryptoActiveDevice **) g_ptr_array_free (devices, FALSE);
+}
+
+/* volume key derived from a passphrase shared by multiple devices */
+typedef struct LUKSSharedKey {
+    gchar *volume_key;
+    gsize vk_size;
+} LUKSSharedKey;
+
+typedef struct LUKSOpenItem {
+    BDCryptoLUKSOpenResult *result;
+    const gchar *passphrase;
+    LUKSSharedKey *shared_key;
+} LUKSOpenItem;
+
+static void luks_shared_key_free (LUKSSharedKey *shared_key) {
+    if (shared_key->volume_key) {
+        explicit_bzero (shared_key->volume_key, shared_key->vk_size);
+        g_free (shared_key->volume_key);
+    }
+    g_free (shared_key);
+}
+
+static void set_open_result (BDCryptoLUKSOpenResult *result, gint ret) {
+    result->success = (ret >= 0);
+    if (ret < 0)
+        result->error_message = g_strdup_printf ("Failed to activate device: %s", strerror(-ret));
+}
+
+/**
+ * open_item_with_shared_key: (skip)
+ *
+ * Derives the volume key from the item's passphrase (the expensive part), makes
+ * it available to the other items sharing the passphrase and activates the
+ * item's device with it.
+ */
+static void open_item_with_shared_key (gpointer data, gpointer user_data __attribute__((unused))) {
+    LUKSOpenItem *item = (LUKSOpenItem *) data;
+    LUKSSharedKey *shared_key = item->shared_key;
+    struct crypt_device *cd = NULL;
+    gchar *fingerprint = NULL;
+    GError *l_error = NULL;
+    gint ret = 0;
+
+    cd = acquire_luks_device (item->result->device, &fingerprint, NULL, &l_error);
+    if (!cd) {
+        item->result->error_message = g_strdup (l_error->message);
+        g_clear_error (&l_error);
+        return;
+    }
+
+    shared_key->vk_size = crypt_get_volume_key_size (cd);
+    shared_key->volume_key = g_malloc (shared_key->vk_size);
+    ret = crypt_volume_key_get (cd, CRYPT_ANY_SLOT, shared_key->volume_key, &(shared_key->vk_size),
+                                item->passphrase, strlen (item->passphrase));
+    if (ret >= 0)
+        ret = crypt_activate_by_volume_key (cd, item->result->name, shared_key->volume_key, shared_key->vk_size, 0);
+    else {
+        /* nothing to share */
+        explicit_bzero (shared_key->volume_key, shared_key->vk_size);
+        g_free (shared_key->volume_key);
+        shared_key->volume_key = NULL;
+    }
+
+    release_luks_device (item->result->device, cd, fingerprint);
+    set_open_result (item->result, ret);
+}
+
+static void open_item (gpointer data, gpointer user_data __attribute__((unused))) {
+    LUKSOpenItem *item = (LUKSOpenItem *) data;
+    struct crypt_device *cd = NULL;
+    gchar *fingerprint = NULL;
+    GError *l_error = NULL;
+    gint ret = -EPERM;
+
+    cd = acquire_luks_device (item->result->device, &fingerprint, NULL, &l_error);
+    if (!cd) {
+        item->result->error_message = g_strdup (l_error->message);
+        g_clear_error (&l_error);
+        return;
+    }
+
+    if (item->shared_key && item->shared_key->volume_key)
+        /* only works if the devices share the volume key too, but checking
+           that is much cheaper than deriving the key from the passphrase
+           (the device's key slots are not checked at all in that case, see
+           the documentation of bd_crypto_luks_open_many()) */
+        ret = crypt_activate_by_volume_key (cd, item->result->name, item->shared_key->volume_key,
+                                            item->shared_key->vk_size, 0);
+    if (ret < 0)
+        ret = crypt_activate_by_passphrase (cd, item->result->name, CRYPT_ANY_SLOT, item->passphrase,
+                                            strlen (item->passphrase), 0);
+
+    release_luks_device (item->result->device, cd, fingerprint);
+    set_open_result (item->result, ret);
+}
+
+/**
+ * run_items_in_pool: (skip)
+ * @items: items to run @func on
+ * @func: function to run on every item
+ *
+ * Runs @func on all the @items in a thread pool with at most as many threads as
+ * there are CPUs (for CPU-bound work like PBKDF), waits for all of them to
+ * finish. Falls back to running @func sequentially if no thread pool can be
+ * used.
+ */
+static void run_items_in_pool (GPtrArray *items, GFunc func) {
+    GThreadPool *pool = NULL;
+    guint n_threads = 0;
+    guint i = 0;
+
+    if (items->len == 0)
+        return;
+
+    /* the PBKDF is CPU-bound, no point in running more threads than CPUs */
+    n_threads = MIN ((guint) g_get_num_processors (), items->len);
+    if (n_threads > 1)
+        pool = g_thread_pool_new (func, NULL, (gint) n_threads, TRUE, NULL);
+
+    for (i=0; i < items->len; i++)
+        if (!pool || !g_thread_pool_push (pool, g_ptr_array_index (items, i), NULL))
+            /* no (working) thread pool, just do it here */
+            func (g_ptr_array_index (items, i), NULL);
+
+    if (pool)
+        /* wait for all the items to be processed */
+        g_thread_pool_free (pool, FALSE, TRUE);
+}
+
+/**
+ * bd_crypto_luks_open_many:
+ * @devices: (array zero-terminated=1): the devices to open
+ * @names: (array zero-terminated=1): names for the LUKS devices (one for each of @devices)
+ * @passphrases: (array zero-terminated=1): passphrases to open the @devices (one for each of @devices)
+ * @share_volume_key: whether to try the volume key derived for one device on the other devices with the same passphrase
+ *                    (skips the key slot checks for those devices, see below)
+ * @error: (out): place to store error (if any)
+ *
+ * Opens all the @devices in parallel (using as many threads as there are CPUs).
+ * If @share_volume_key is %TRUE, the volume key is only derived from the
+ * passphrase (which is the slow part of opening a LUKS device) for one device
+ * with the given passphrase and tried for the other ones first, which helps if
+ * the devices share the volume key (e.g. were created from the same header).
+ *
+ * Warning: a device that is activated with the shared volume key is NOT checked
+ * against its own key slots. If a device shares the volume key with the first
+ * device with the same passphrase, it is opened even if the passphrase was
+ * removed from (or never added to) its own key slots. Only use
+ * @share_volume_key if all the devices with the same passphrase are trusted
+ * equally, e.g. were all cloned from the same header.
+ *
+ * Returns: (array zero-terminated=1): results of opening the @devices (in the
+ * same order as @devices) or %NULL if the arguments are invalid
+ *
+ * A failure to open some devices is not an error, check the results for the
+ * individual devices.
+ */
+BDCryptoLUKSOpenResult** bd_crypto_luks_open_many (const gchar **devices, const gchar **names, const gchar **passphrases, gboolean share_volume_key, GError **error) {
+    BDCryptoLUKSOpenResult **ret = NULL;
+    GHashTable *shared_keys = NULL;
+    LUKSOpenItem *items = NULL;
+    GPtrArray *leaders = NULL;
+    GPtrArray *others = NULL;
+    guint num_items = 0;
+    guint i = 0;
+
+    num_items = devices ? g_strv_length ((gchar **) devices) : 0;
+    if ((num_items != (names ? g_strv_length ((gchar **) names) : 0)) ||
+        (num_items != (passphrases ? g_strv_length ((gchar **) passphrases) : 0))) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_INVALID_SPEC,
+                     "Exactly one name and passphrase have to be given for every device.");
+        return NULL;
+    }
+
+    ret = g_new0 (BDCryptoLUKSOpenResult*, num_items + 1);
+    items = g_new0 (LUKSOpenItem, num_items);
+    leaders = g_ptr_array_new ();
+    others = g_ptr_array_new ();
+    shared_keys = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) luks_shared_key_free);
+
+    for (i=0; i < num_items; i++) {
+        ret[i] = g_new0 (BDCryptoLUKSOpenResult, 1);
+        ret[i]->device = g_strdup (devices[i]);
+        ret[i]->name = g_strdup (names[i]);
+
+        items[i].result = ret[i];
+        items[i].passphrase = passphrases[i];
+        if (share_volume_key) {
+            items[i].shared_key = g_hash_table_lookup (shared_keys, passphrases[i]);
+            if (!items[i].shared_key) {
+                /* the first device with this passphrase derives the key */
+                items[i].shared_key = g_new0 (LUKSSharedKey, 1);
+                g_hash_table_insert (shared_keys, (gpointer) passphrases[i], items[i].shared_key);
+                g_ptr_array_add (leaders, &(items[i]));
+                continue;
+            }
+        }
+        g_ptr_array_add (others, &(items[i]));
+    }
+
+    /* first derive the shared keys, then open the rest of the devices */
+    run_items_in_pool (leaders, open_item_with_shared_key);
+    run_items_in_pool (others, open_item);
+
+    g_ptr_array_free (others, TRUE);
+    g_ptr_array_free (leaders, TRUE);
+    g_hash_table_destroy (shared_keys);
+    g_free (items);
+
+    return ret;
+}
+
 /**
  * bd_crypto_luks_close:
  * @luks_device: LUKS device to close
@@ -394,6 +1443,7 @@ gboolean bd_crypto_luks_close (const gchar *luks_device, GError **error) {
  */
 gboolean bd_crypto_luks_add_key (const gchar *device, const gchar *pass, const gchar *key_file, const gchar *npass, const gchar *nkey_file, GError **error) {
     struct crypt_device *cd = NULL;
+    gchar *fingerprint = NULL;
     gint ret = 0;
 
     if (!pass && !key_file) {
@@ -408,20 +1458,9 @@ gboolean bd_crypto_luks_add_key (const gchar *device, const gchar *pass, const g
         return FALSE;
     }
 
-    ret = crypt_init (&cd, device);
-    if (ret != 0) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to initialize device: %s", strerror(-ret));
-        return FALSE;
-    }
-
-    ret = crypt_load (cd, CRYPT_LUKS1, NULL);
-    if (ret != 0) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to load device's parameters: %s", strerror(-ret));
-        crypt_free (cd);
+    cd = acquire_luks_device (device, &fingerprint, NULL, error);
+    if (!cd)
         return FALSE;
-    }
 
     if (pass && npass)
         ret = crypt_keyslot_add_by_passphrase (cd, CRYPT_ANY_SLOT, pass, strlen(pass), npass, strlen(npass));
@@ -438,11 +1477,11 @@ gboolean bd_crypto_luks_add_key (const gchar *device, const gchar *pass, const g
     if (ret < 0) {
         g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_ADD_KEY,
                      "Failed to add key: %s", strerror(-ret));
-        crypt_free (cd);
+        invalidate_luks_device (device, cd, fingerprint);
         return FALSE;
     }
 
-    crypt_free (cd);
+    invalidate_luks_device (device, cd, fingerprint);
     return TRUE;
 }
 
@@ -459,6 +1498,7 @@ gboolean bd_crypto_luks_add_key (const gchar *device, const gchar *pass, const g
  */
 gboolean bd_crypto_luks_remove_key (const gchar *device, const gchar *pass, const gchar *key_file, GError **error) {
     struct crypt_device *cd = NULL;
+    gchar *fingerprint = NULL;
     gint ret = 0;
 
     if (!pass && !key_file) {
@@ -467,20 +1507,9 @@ gboolean bd_crypto_luks_remove_key (const gchar *device, const gchar *pass, cons
         return FALSE;
     }
 
-    ret = crypt_init (&cd, device);
-    if (ret != 0) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to initialize device: %s", strerror(-ret));
-        return FALSE;
-    }
-
-    ret = crypt_load (cd, CRYPT_LUKS1, NULL);
-    if (ret != 0) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to load device's parameters: %s", strerror(-ret));
-        crypt_free (cd);
+    cd = acquire_luks_device (device, &fingerprint, NULL, error);
+    if (!cd)
         return FALSE;
-    }
 
     crypt_set_password_callback (cd, give_passphrase, (void*) pass);
     if (pass)
@@ -491,7 +1520,7 @@ gboolean bd_crypto_luks_remove_key (const gchar *device, const gchar *pass, cons
     if (ret < 0) {
         g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_KEY_SLOT,
                      "Failed to determine key slot: %s", strerror(-ret));
-        crypt_free (cd);
+        invalidate_luks_device (device, cd, fingerprint);
         return FALSE;
     }
 
@@ -499,11 +1528,11 @@ gboolean bd_crypto_luks_remove_key (const gchar *device, const gchar *pass, cons
     if (ret != 0) {
         g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_REMOVE_KEY,
                      "Failed to remove key: %s", strerror(-ret));
-        crypt_free (cd);
+        invalidate_luks_device (device, cd, fingerprint);
         return FALSE;
     }
 
-    crypt_free (cd);
+    invalidate_luks_device (device, cd, fingerprint);
     return TRUE;
 }
 
@@ -520,24 +1549,14 @@ gboolean bd_crypto_luks_remove_key (const gchar *device, const gchar *pass, cons
  */
 gboolean bd_crypto_luks_change_key (const gchar *device, const gchar *pass, const gchar *npass, GError **error) {
     struct crypt_device *cd = NULL;
+    gchar *fingerprint = NULL;
     gint ret = 0;
     gchar *volume_key = NULL;
     gsize vk_size = 0;
 
-    ret = crypt_init (&cd, device);
-    if (ret != 0) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to initialize device: %s", strerror(-ret));
-        return FALSE;
-    }
-
-    ret = crypt_load (cd, CRYPT_LUKS1, NULL);
-    if (ret != 0) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to load device's parameters: %s", strerror(-ret));
-        crypt_free (cd);
+    cd = acquire_luks_device (device, &fingerprint, NULL, error);
+    if (!cd)
         return FALSE;
-    }
 
     vk_size = crypt_get_volume_key_size(cd);
     volume_key = (gchar *) g_malloc (vk_size);
@@ -546,7 +1565,7 @@ gboolean bd_crypto_luks_change_key (const gchar *device, const gchar *pass, cons
     if (ret < 0) {
         g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
                      "Failed to load device's volume key: %s", strerror(-ret));
-        crypt_free (cd);
+        invalidate_luks_device (device, cd, fingerprint);
         return FALSE;
     }
 
@@ -555,7 +1574,7 @@ gboolean bd_crypto_luks_change_key (const gchar *device, const gchar *pass, cons
     if (ret != 0) {
         g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_REMOVE_KEY,
                      "Failed to remove the old passphrase: %s", strerror(-ret));
-        crypt_free (cd);
+        invalidate_luks_device (device, cd, fingerprint);
         return FALSE;
     }
 
@@ -563,62 +1582,1015 @@ gboolean bd_crypto_luks_change_key (const gchar *device, const gchar *pass, cons
     if (ret < 0) {
         g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_ADD_KEY,
                      "Failed to add the new passphrase: %s", strerror(-ret));
-        crypt_free (cd);
+        invalidate_luks_device (device, cd, fingerprint);
         return FALSE;
     }
 
-    crypt_free (cd);
+    invalidate_luks_device (device, cd, fingerprint);
     return TRUE;
 }
 
+/* A key session keeps the unlocked volume key of a device in locked memory
+   so that key slot operations can use it directly instead of deriving it from
+   a passphrase (running the PBKDF) over and over again. Sessions are referred
+   to by IDs, an operation holds a reference so that the session cannot go
+   away under its hands when closed by some other thread. */
+typedef struct LUKSKeySession {
+    gint ref_count;
+    GMutex lock;
+    gchar *device;
+    struct crypt_device *cd;
+    gchar *fingerprint;
+    gboolean changed;
+    gchar *volume_key;
+    gsize vk_size;
+    gsize vk_alloc_size;
+    gint keyslot;
+} LUKSKeySession;
+
+static GMutex sessions_lock;
+static GHashTable *sessions = NULL;
+static guint64 next_session_id = 1;
+
 /**
- * bd_crypto_luks_resize:
- * @luks_device: opened LUKS device to resize
- * @size: requested size in sectors or 0 to adapt to the backing device
+ * read_key_file: (skip)
+ * @key_file: key file to read
+ * @len: (out): length of the key
  * @error: (out): place to store error (if any)
  *
- * Returns: whether the @luks_device was successfully resized or not
+ * Returns: (transfer full): contents of @key_file (to be zeroed and freed with
+ * free_key()) or %NULL in case of error
  */
-gboolean bd_crypto_luks_resize (const gchar *luks_device, guint64 size, GError **error) {
-    struct crypt_device *cd = NULL;
-    gint ret = 0;
+static gchar* read_key_file (const gchar *key_file, gsize *len, GError **error) {
+    gchar *contents = NULL;
 
-    ret = crypt_init_by_name (&cd, luks_device);
-    if (ret != 0) {
+    if (!g_file_get_contents (key_file, &contents, len, error)) {
+        g_prefix_error (error, "Failed to read key file: ");
+        return NULL;
+    }
+
+    return contents;
+}
+
+static void free_key (gchar *key, gsize len) {
+    if (key) {
+        explicit_bzero (key, len);
+        g_free (key);
+    }
+}
+
+/**
+ * alloc_locked_key: (skip)
+ * @size: size of the key
+ * @alloc_size: (out): size of the allocated memory (to be passed to free_locked_key())
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (transfer full): zeroed memory for a key of @size bytes or %NULL in
+ * case of error
+ *
+ * The memory is allocated in whole pages not shared with anything else (locking
+ * and unlocking works on pages and doesn't nest), locked so that it's never
+ * swapped out and excluded from core dumps.
+ */
+static gchar* alloc_locked_key (gsize size, gsize *alloc_size, GError **error) {
+    gsize page_size = (gsize) sysconf (_SC_PAGESIZE);
+    gpointer ret = NULL;
+
+    *alloc_size = ((size + page_size - 1) / page_size) * page_size;
+    ret = mmap (NULL, *alloc_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ret == MAP_FAILED) {
         g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
-                     "Failed to initialize device: %s", strerror(-ret));
-        return FALSE;
+                     "Failed to allocate memory for the volume key: %s", strerror (errno));
+        return NULL;
     }
 
-    ret = crypt_resize (cd, luks_device, size);
-    if (ret != 0) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_RESIZE_FAILED,
-                     "Failed to resize device: %s", strerror(-ret));
-        crypt_free (cd);
-        return FALSE;
+    if (mlock (ret, *alloc_size) != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to lock the memory for the volume key: %s", strerror (errno));
+        munmap (ret, *alloc_size);
+        return NULL;
     }
+#ifdef MADV_DONTDUMP
+    madvise (ret, *alloc_size, MADV_DONTDUMP);
+#endif
 
-    crypt_free (cd);
-    return TRUE;
+    return (gchar *) ret;
 }
 
-static gchar *always_fail_cb (gpointer data __attribute__((unused)), const gchar *prompt __attribute__((unused)), int echo __attribute__((unused))) {
-    return NULL;
-}
+static void free_locked_key (gchar *key, gsize alloc_size) {
+    if (!key)
+        return;
 
-static gchar *give_passphrase_cb (gpointer data, const gchar *prompt __attribute__((unused)), unsigned failed_attempts) {
-    if (failed_attempts == 0)
-        /* Return a copy of the passphrase that will be freed by volume_key */
-        return g_strdup (data);
-    return NULL;
+    explicit_bzero (key, alloc_size);
+    munlock (key, alloc_size);
+    munmap (key, alloc_size);
 }
 
-static void free_passphrase_cb (gpointer data) {
-    g_free (data);
-}
+static void key_session_unref (LUKSKeySession *session) {
+    if (!g_atomic_int_dec_and_test (&(session->ref_count)))
+        return;
 
-/**
- * replace_char:
+    free_locked_key (session->volume_key, session->vk_alloc_size);
+
+    if (session->changed)
+        invalidate_luks_device (session->device, session->cd, session->fingerprint);
+    else
+        release_luks_device (session->device, session->cd, session->fingerprint);
+
+    g_mutex_clear (&session->lock);
+    g_free (session->device);
+    g_free (session);
+}
+
+/**
+ * get_key_session: (skip)
+ * @session_id: ID of the session to get
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (transfer full): a reference to the session with @session_id (to be
+ * dropped with key_session_unref()) or %NULL if no such session exists
+ */
+static LUKSKeySession* get_key_session (guint64 session_id, GError **error) {
+    LUKSKeySession *session = NULL;
+
+    g_mutex_lock (&sessions_lock);
+    session = sessions ? g_hash_table_lookup (sessions, &session_id) : NULL;
+    if (session)
+        g_atomic_int_inc (&(session->ref_count));
+    g_mutex_unlock (&sessions_lock);
+
+    if (!session)
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_STATE,
+                     "No key session with ID %"G_GUINT64_FORMAT, session_id);
+
+    return session;
+}
+
+/**
+ * bd_crypto_luks_key_session_open:
+ * @device: device to unlock the volume key of
+ * @passphrase: (allow-none): passphrase for the @device or %NULL
+ * @key_file: (allow-none): key file for the @device or %NULL
+ * @error: (out): place to store error (if any)
+ *
+ * Unlocks the volume key of @device (running the PBKDF once) and keeps it in
+ * locked memory (never swapped out) until the session is closed with
+ * bd_crypto_luks_key_session_close(). Key slot operations with the session
+ * don't need to run the PBKDF to unlock the volume key again. Fails if the
+ * memory cannot be locked (e.g. because of RLIMIT_MEMLOCK).
+ *
+ * Changes of the header done outside of the session (e.g. with
+ * bd_crypto_luks_add_key()) are picked up before every key slot operation with
+ * the session so that they are never overwritten.
+ *
+ * Returns: ID of the new key session for @device or 0 in case of error
+ *
+ * Either @passphrase or @key_file has to be != %NULL.
+ */
+guint64 bd_crypto_luks_key_session_open (const gchar *device, const gchar *passphrase, const gchar *key_file, GError **error) {
+    LUKSKeySession *session = NULL;
+    struct crypt_device *cd = NULL;
+    gchar *fingerprint = NULL;
+    gchar *key = NULL;
+    gsize key_len = 0;
+    guint64 *session_id = NULL;
+    gint ret = 0;
+
+    if (!passphrase && !key_file) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_NO_KEY,
+                     "No passphrase nor key file given, cannot unlock the volume key.");
+        return 0;
+    }
+
+    if (!passphrase) {
+        key = read_key_file (key_file, &key_len, error);
+        if (!key)
+            return 0;
+    }
+
+    cd = acquire_luks_device (device, &fingerprint, NULL, error);
+    if (!cd) {
+        free_key (key, key_len);
+        return 0;
+    }
+
+    session = g_new0 (LUKSKeySession, 1);
+    session->ref_count = 1;
+    g_mutex_init (&session->lock);
+    session->device = g_strdup (device);
+    session->cd = cd;
+    session->fingerprint = fingerprint;
+    session->vk_size = crypt_get_volume_key_size (cd);
+    session->volume_key = alloc_locked_key (session->vk_size, &(session->vk_alloc_size), error);
+    if (!session->volume_key) {
+        free_key (key, key_len);
+        key_session_unref (session);
+        return 0;
+    }
+
+    if (passphrase)
+        ret = crypt_volume_key_get (cd, CRYPT_ANY_SLOT, session->volume_key, &(session->vk_size),
+                                    passphrase, strlen(passphrase));
+    else
+        ret = crypt_volume_key_get (cd, CRYPT_ANY_SLOT, session->volume_key, &(session->vk_size),
+                                    key, key_len);
+    free_key (key, key_len);
+
+    if (ret < 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to load device's volume key: %s", strerror(-ret));
+        key_session_unref (session);
+        return 0;
+    }
+
+    /* ret is the number of the slot with the given key */
+    session->keyslot = ret;
+
+    session_id = g_new0 (guint64, 1);
+    g_mutex_lock (&sessions_lock);
+    if (!sessions)
+        sessions = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, (GDestroyNotify) key_session_unref);
+    *session_id = next_session_id++;
+    g_hash_table_insert (sessions, session_id, session);
+    g_mutex_unlock (&sessions_lock);
+
+    return *session_id;
+}
+
+/**
+ * bd_crypto_luks_key_session_close:
+ * @session: ID of the key session to close
+ * @error: (out): place to store error (if any)
+ *
+ * Closes the @session, the volume key is zeroed and freed (once the operations
+ * running with the @session finish).
+ *
+ * Returns: whether the @session was successfully closed or not
+ */
+gboolean bd_crypto_luks_key_session_close (guint64 session, GError **error) {
+    gboolean found = FALSE;
+
+    g_mutex_lock (&sessions_lock);
+    found = sessions && g_hash_table_remove (sessions, &session);
+    g_mutex_unlock (&sessions_lock);
+
+    if (!found)
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_STATE,
+                     "No key session with ID %"G_GUINT64_FORMAT, session);
+
+    return found;
+}
+
+/**
+ * bd_crypto_luks_key_session_get_keyslot:
+ * @session: ID of the key session to get the key slot of
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: number of the key slot @session was unlocked with (or the new one
+ * after bd_crypto_luks_key_session_change_key()) or -1 in case of error
+ */
+gint bd_crypto_luks_key_session_get_keyslot (guint64 session, GError **error) {
+    LUKSKeySession *key_session = NULL;
+    gint ret = 0;
+
+    key_session = get_key_session (session, error);
+    if (!key_session)
+        return -1;
+
+    g_mutex_lock (&key_session->lock);
+    ret = key_session->keyslot;
+    g_mutex_unlock (&key_session->lock);
+
+    key_session_unref (key_session);
+    return ret;
+}
+
+/**
+ * session_sync_header: (skip)
+ *
+ * Makes sure the session's LUKS context matches the header on the disk which
+ * may have been changed outside of the session (e.g. by
+ * bd_crypto_luks_add_key()). Writing a stale header back would silently drop
+ * or resurrect key slots. Has to be called with session->lock held before
+ * every change of the header.
+ *
+ * Returns: whether the session's LUKS context is up to date or not
+ */
+static gboolean session_sync_header (LUKSKeySession *session, GError **error) {
+    struct crypt_device *cd = NULL;
+    gchar *fingerprint = NULL;
+    gint ret = 0;
+
+    fingerprint = get_header_fingerprint (session->device);
+    if (fingerprint && (g_strcmp0 (fingerprint, session->fingerprint) == 0)) {
+        g_free (fingerprint);
+        return TRUE;
+    }
+
+    /* changed (or cannot be validated), reload the header */
+    ret = crypt_init (&cd, session->device);
+    if (ret != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to initialize device: %s", strerror(-ret));
+        g_free (fingerprint);
+        return FALSE;
+    }
+
+    ret = crypt_load (cd, CRYPT_LUKS, NULL);
+    if (ret != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to load device's parameters: %s", strerror(-ret));
+        crypt_free (cd);
+        g_free (fingerprint);
+        return FALSE;
+    }
+
+    ret = crypt_volume_key_verify (cd, session->volume_key, session->vk_size);
+    if (ret < 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_STATE,
+                     "The volume key of the session doesn't match the device's header anymore");
+        crypt_free (cd);
+        g_free (fingerprint);
+        return FALSE;
+    }
+
+    crypt_free (session->cd);
+    session->cd = cd;
+    g_free (session->fingerprint);
+    session->fingerprint = fingerprint;
+
+    return TRUE;
+}
+
+/**
+ * session_header_written: (skip)
+ *
+ * To be called (with session->lock held) after the session changed the header.
+ */
+static void session_header_written (LUKSKeySession *session) {
+    /* the header on the disk is now different from the cached ones */
+    session->changed = TRUE;
+    invalidate_luks_device (session->device, NULL, NULL);
+
+    /* but it matches the session's context */
+    g_free (session->fingerprint);
+    session->fingerprint = get_header_fingerprint (session->device);
+}
+
+/* has to be called with session->lock held */
+static gint session_add_key (LUKSKeySession *session, const gchar *npass, const gchar *nkey_file, GError **error) {
+    gchar *key = NULL;
+    gsize key_len = 0;
+    gint ret = 0;
+
+    if (!session_sync_header (session, error))
+        return -1;
+
+    if (npass)
+        ret = crypt_keyslot_add_by_volume_key (session->cd, CRYPT_ANY_SLOT, session->volume_key, session->vk_size,
+                                               npass, strlen(npass));
+    else {
+        key = read_key_file (nkey_file, &key_len, error);
+        if (!key)
+            return -1;
+        ret = crypt_keyslot_add_by_volume_key (session->cd, CRYPT_ANY_SLOT, session->volume_key, session->vk_size,
+                                               key, key_len);
+        free_key (key, key_len);
+    }
+
+    if (ret < 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_ADD_KEY,
+                     "Failed to add key: %s", strerror(-ret));
+        return -1;
+    }
+
+    session_header_written (session);
+
+    return ret;
+}
+
+/**
+ * bd_crypto_luks_key_session_add_key:
+ * @session: ID of the key session for the device to add new key to
+ * @npass: (allow-none): new passphrase for the device or %NULL
+ * @nkey_file: (allow-none): new key file for the device or %NULL
+ * @error: (out): place to store error (if any)
+ *
+ * Adds a new key using the unlocked volume key (only the PBKDF for the new key
+ * slot is run).
+ *
+ * Returns: number of the key slot the new key was added to or -1 in case of error
+ *
+ * Either @npass or @nkey_file has to be != %NULL.
+ */
+gint bd_crypto_luks_key_session_add_key (guint64 session, const gchar *npass, const gchar *nkey_file, GError **error) {
+    LUKSKeySession *key_session = NULL;
+    gint ret = 0;
+
+    if (!npass && !nkey_file) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_NO_KEY,
+                     "No new passphrase nor key file given, nothing to add.");
+        return -1;
+    }
+
+    key_session = get_key_session (session, error);
+    if (!key_session)
+        return -1;
+
+    g_mutex_lock (&key_session->lock);
+    ret = session_add_key (key_session, npass, nkey_file, error);
+    g_mutex_unlock (&key_session->lock);
+
+    key_session_unref (key_session);
+    return ret;
+}
+
+/**
+ * bd_crypto_luks_key_session_remove_key:
+ * @session: ID of the key session for the device to remove the key from
+ * @keyslot: key slot to remove
+ * @error: (out): place to store error (if any)
+ *
+ * Removes the key in @keyslot without the need to run the PBKDF. The key slot
+ * @session was unlocked with can be removed too, the session stays usable.
+ *
+ * Returns: whether the key was successfully removed or not
+ */
+gboolean bd_crypto_luks_key_session_remove_key (guint64 session, gint keyslot, GError **error) {
+    LUKSKeySession *key_session = NULL;
+    gint ret = 0;
+
+    key_session = get_key_session (session, error);
+    if (!key_session)
+        return FALSE;
+
+    g_mutex_lock (&key_session->lock);
+    if (!session_sync_header (key_session, error)) {
+        g_mutex_unlock (&key_session->lock);
+        key_session_unref (key_session);
+        return FALSE;
+    }
+
+    ret = crypt_keyslot_destroy (key_session->cd, keyslot);
+    if (ret != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_REMOVE_KEY,
+                     "Failed to remove key: %s", strerror(-ret));
+        g_mutex_unlock (&key_session->lock);
+        key_session_unref (key_session);
+        return FALSE;
+    }
+
+    session_header_written (key_session);
+    g_mutex_unlock (&key_session->lock);
+
+    key_session_unref (key_session);
+    return TRUE;
+}
+
+/**
+ * bd_crypto_luks_key_session_change_key:
+ * @session: ID of the key session for the device to change key of
+ * @npass: (allow-none): new passphrase or %NULL
+ * @nkey_file: (allow-none): new key file or %NULL
+ * @error: (out): place to store error (if any)
+ *
+ * Replaces the key @session was unlocked with by the new one. The new key is
+ * added first so that the device is never left without the key if something
+ * fails, see bd_crypto_luks_key_session_get_keyslot() for the resulting key
+ * slot.
+ *
+ * Returns: whether the key was successfully changed or not
+ *
+ * Either @npass or @nkey_file has to be != %NULL.
+ */
+gboolean bd_crypto_luks_key_session_change_key (guint64 session, const gchar *npass, const gchar *nkey_file, GError **error) {
+    LUKSKeySession *key_session = NULL;
+    gint new_slot = 0;
+    gint ret = 0;
+
+    if (!npass && !nkey_file) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_NO_KEY,
+                     "No new passphrase nor key file given, cannot change key.");
+        return FALSE;
+    }
+
+    key_session = get_key_session (session, error);
+    if (!key_session)
+        return FALSE;
+
+    g_mutex_lock (&key_session->lock);
+    new_slot = session_add_key (key_session, npass, nkey_file, error);
+    if (new_slot < 0) {
+        g_mutex_unlock (&key_session->lock);
+        key_session_unref (key_session);
+        return FALSE;
+    }
+
+    ret = crypt_keyslot_destroy (key_session->cd, key_session->keyslot);
+    if (ret != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_REMOVE_KEY,
+                     "Failed to remove the old key: %s", strerror(-ret));
+        g_mutex_unlock (&key_session->lock);
+        key_session_unref (key_session);
+        return FALSE;
+    }
+    session_header_written (key_session);
+    key_session->keyslot = new_slot;
+    g_mutex_unlock (&key_session->lock);
+
+    key_session_unref (key_session);
+    return TRUE;
+}
+
+/**
+ * bd_crypto_luks_resize:
+ * @luks_device: opened LUKS device to resize
+ * @size: requested size in sectors or 0 to adapt to the backing device
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: whether the @luks_device was successfully resized or not
+ */
+gboolean bd_crypto_luks_resize (const gchar *luks_device, guint64 size, GError **error) {
+    struct crypt_device *cd = NULL;
+    gint ret = 0;
+
+    ret = crypt_init_by_name (&cd, luks_device);
+    if (ret != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to initialize device: %s", strerror(-ret));
+        return FALSE;
+    }
+
+    ret = crypt_resize (cd, luks_device, size);
+    if (ret != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_RESIZE_FAILED,
+                     "Failed to resize device: %s", strerror(-ret));
+        crypt_free (cd);
+        return FALSE;
+    }
+
+    crypt_free (cd);
+    return TRUE;
+}
+
+/* Reencryption runs in libcryptsetup for as long as crypt_reencrypt_run()
+   blocks so it is run in a thread and the jobs started by this process are
+   tracked (per backing device) to be able to report rate and ETA and to
+   throttle and abort them from the progress callback. An aborted reencryption
+   stays recorded in the LUKS2 header and can be resumed later. The plugin is
+   pinned in memory once a reencryption is started so that unloading it (with
+   bd_reinit()) cannot pull the code from under the thread's hands. */
+typedef struct LUKSReencryptJob {
+    guint ref_count;
+    gchar *device;
+    struct crypt_device *cd;
+    gint64 start_time;
+    gint64 end_time;
+    gboolean running;
+    gboolean abort;
+    gint error_code;
+    guint64 size;
+    gboolean progress_seen;
+    guint64 start_offset;
+    guint64 offset;
+    guint64 max_rate;
+} LUKSReencryptJob;
+
+/* protects the table below as well as the jobs in it */
+static GMutex reencrypt_lock;
+/* signalled when a job finishes or is asked to abort */
+static GCond reencrypt_cond;
+static GHashTable *reencrypt_jobs = NULL;
+
+static void reencrypt_job_unref (LUKSReencryptJob *job) {
+    /* reencrypt_lock has to be held */
+    job->ref_count--;
+    if (job->ref_count > 0)
+        return;
+
+    g_free (job->device);
+    g_free (job);
+}
+
+/**
+ * fail_reencrypt_job: (skip)
+ *
+ * Drops the @job registered by bd_crypto_luks_reencrypt_start() if the
+ * reencryption failed to start.
+ */
+static void fail_reencrypt_job (LUKSReencryptJob *job) {
+    g_mutex_lock (&reencrypt_lock);
+    job->running = FALSE;
+    if (g_hash_table_lookup (reencrypt_jobs, job->device) == job)
+        g_hash_table_remove (reencrypt_jobs, job->device);
+    /* wake up bd_crypto_luks_reencrypt_abort() (if waiting) */
+    g_cond_broadcast (&reencrypt_cond);
+    reencrypt_job_unref (job);
+    g_mutex_unlock (&reencrypt_lock);
+}
+
+static int reencrypt_progress (uint64_t size, uint64_t offset, void *usrptr) {
+    LUKSReencryptJob *job = (LUKSReencryptJob *) usrptr;
+    gint64 deadline = 0;
+    gboolean abort = FALSE;
+
+    g_mutex_lock (&reencrypt_lock);
+    job->size = size;
+    if (!job->progress_seen) {
+        /* resumed reencryption doesn't start from the beginning */
+        job->start_offset = offset;
+        job->progress_seen = TRUE;
+    }
+    job->offset = offset;
+
+    if (job->max_rate > 0) {
+        /* sleep until the average rate drops to the limit (or an abort comes) */
+        deadline = job->start_time + (gint64) ((gdouble) (offset - job->start_offset) / job->max_rate * G_USEC_PER_SEC);
+        while (!job->abort && (g_get_monotonic_time () < deadline))
+            g_cond_wait_until (&reencrypt_cond, &reencrypt_lock, deadline);
+    }
+    abort = job->abort;
+    g_mutex_unlock (&reencrypt_lock);
+
+    /* non-zero interrupts the reencryption */
+    return abort ? 1 : 0;
+}
+
+static gpointer reencrypt_thread (gpointer data) {
+    LUKSReencryptJob *job = (LUKSReencryptJob *) data;
+    gint ret = 0;
+
+    ret = crypt_reencrypt_run (job->cd, reencrypt_progress, job);
+
+    /* the header has been changed */
+    invalidate_luks_device (job->device, job->cd, NULL);
+
+    g_mutex_lock (&reencrypt_lock);
+    job->cd = NULL;
+    if (ret < 0)
+        job->error_code = -ret;
+    job->running = FALSE;
+    job->end_time = g_get_monotonic_time ();
+    g_cond_broadcast (&reencrypt_cond);
+    reencrypt_job_unref (job);
+    g_mutex_unlock (&reencrypt_lock);
+
+    return NULL;
+}
+
+/**
+ * init_reencryption: (skip)
+ * @cd: loaded LUKS2 context of the device to reencrypt
+ * @luks_device: (allow-none): name of the active LUKS device or %NULL
+ * @passphrase: passphrase for the device
+ * @cipher: (allow-none): new cipher specification or %NULL
+ * @key_size: size of the new volume key in bits or 0
+ * @max_rate: maximum rate (in bytes per second) or 0
+ * @drop_other_keys: whether other active key slots may be made unusable or not
+ * @error: (out): place to store error (if any)
+ *
+ * Initializes a new reencryption of the device or loads the interrupted one.
+ *
+ * Returns: whether the reencryption was successfully initialized or not
+ */
+static gboolean init_reencryption (struct crypt_device *cd, const gchar *luks_device, const gchar *passphrase, const gchar *cipher,
+                                   guint64 key_size, guint64 max_rate, gboolean drop_other_keys, GError **error) {
+    struct crypt_params_reencrypt params;
+    struct crypt_params_luks2 luks2_params;
+    crypt_reencrypt_info info;
+    gchar **cipher_specs = NULL;
+    gchar *auto_cipher = NULL;
+    gint keyslot_old = 0;
+    gint keyslot_new = 0;
+    gint max_slots = 0;
+    gint slot = 0;
+    crypt_keyslot_info slot_info;
+    gint ret = 0;
+
+    memset (&params, 0, sizeof (params));
+    memset (&luks2_params, 0, sizeof (luks2_params));
+    params.mode = CRYPT_REENCRYPT_REENCRYPT;
+    params.direction = CRYPT_REENCRYPT_FORWARD;
+    params.resilience = "checksum";
+    params.hash = "sha256";
+    /* process (about) one second worth of data at a time so that the
+       throttling is smooth */
+    params.max_hotzone_size = max_rate / 512;
+    luks2_params.sector_size = crypt_get_sector_size (cd);
+    params.luks2 = &luks2_params;
+
+    info = crypt_reencrypt_status (cd, NULL);
+    if (info == CRYPT_REENCRYPT_CLEAN) {
+        /* continue with the interrupted reencryption (cipher and key size
+           were set when it was started) */
+        params.flags = CRYPT_REENCRYPT_RESUME_ONLY;
+        ret = crypt_reencrypt_init_by_passphrase (cd, luks_device, passphrase, strlen(passphrase),
+                                                  CRYPT_ANY_SLOT, CRYPT_ANY_SLOT, NULL, NULL, &params);
+        if (ret < 0) {
+            g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                         "Failed to resume reencryption: %s", strerror(-ret));
+            return FALSE;
+        }
+        return TRUE;
+    } else if (info != CRYPT_REENCRYPT_NONE) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_STATE,
+                     "Reencryption of the device crashed, it needs to be repaired first");
+        return FALSE;
+    }
+
+    key_size = (key_size != 0) ? (key_size / 8) : (DEFAULT_LUKS_KEYSIZE_BITS / 8);
+    if (g_strcmp0 (cipher, BD_CRYPTO_LUKS_CIPHER_AUTO) == 0) {
+        auto_cipher = get_auto_cipher (key_size, error);
+        if (!auto_cipher)
+            return FALSE;
+        cipher = auto_cipher;
+    }
+    cipher = cipher ? cipher : DEFAULT_LUKS_CIPHER;
+    cipher_specs = g_strsplit (cipher, "-", 2);
+    if (g_strv_length (cipher_specs) != 2) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_INVALID_SPEC,
+                     "Invalid cipher specification: '%s'", cipher);
+        g_strfreev (cipher_specs);
+        g_free (auto_cipher);
+        return FALSE;
+    }
+
+    keyslot_old = crypt_activate_by_passphrase (cd, NULL, CRYPT_ANY_SLOT, passphrase, strlen(passphrase), 0);
+    if (keyslot_old < 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_KEY_SLOT,
+                     "Failed to determine key slot: %s", strerror(-keyslot_old));
+        g_strfreev (cipher_specs);
+        g_free (auto_cipher);
+        return FALSE;
+    }
+
+    /* the other key slots (e.g. the escrowed backup passphrase) are bound to
+       the old volume key, don't make them unusable behind the caller's back */
+    if (!drop_other_keys) {
+        max_slots = crypt_keyslot_max (CRYPT_LUKS2);
+        for (slot=0; slot < max_slots; slot++) {
+            if (slot == keyslot_old)
+                continue;
+            slot_info = crypt_keyslot_status (cd, slot);
+            if ((slot_info == CRYPT_SLOT_ACTIVE) || (slot_info == CRYPT_SLOT_ACTIVE_LAST)) {
+                g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_KEY_SLOT,
+                             "Key slot %d would become unusable by the reencryption", slot);
+                g_strfreev (cipher_specs);
+                g_free (auto_cipher);
+                return FALSE;
+            }
+        }
+    }
+
+    /* a new volume key (not used by any segment yet) the data is going to be
+       reencrypted with */
+    keyslot_new = crypt_keyslot_add_by_key (cd, CRYPT_ANY_SLOT, NULL, key_size, passphrase, strlen(passphrase),
+                                            CRYPT_VOLUME_KEY_NO_SEGMENT);
+    if (keyslot_new < 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_ADD_KEY,
+                     "Failed to add key for the new volume key: %s", strerror(-keyslot_new));
+        g_strfreev (cipher_specs);
+        g_free (auto_cipher);
+        return FALSE;
+    }
+
+    ret = crypt_reencrypt_init_by_passphrase (cd, luks_device, passphrase, strlen(passphrase), keyslot_old, keyslot_new,
+                                              cipher_specs[0], cipher_specs[1], &params);
+    g_strfreev (cipher_specs);
+    g_free (auto_cipher);
+    if (ret < 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_DEVICE,
+                     "Failed to initialize reencryption: %s", strerror(-ret));
+        crypt_keyslot_destroy (cd, keyslot_new);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * bd_crypto_luks_reencrypt_start:
+ * @device: LUKS2 device to reencrypt
+ * @luks_device: (allow-none): name of the LUKS device if @device is open (the
+ *                             reencryption then runs online) or %NULL
+ * @passphrase: passphrase for the @device
+ * @cipher: (allow-none): new cipher specification (type-mode, e.g. "aes-xts-plain64"),
+ *          %BD_CRYPTO_LUKS_CIPHER_AUTO to use the fastest XTS cipher on this machine
+ *          or %NULL to use the default
+ * @key_size: size of the new volume key in bits or 0 to use the default
+ * @max_rate: maximum rate (in bytes per second) to reencrypt the data with or 0
+ *            for no limit
+ * @drop_other_keys: whether to allow making the other active key slots unusable
+ * @error: (out): place to store error (if any)
+ *
+ * Starts reencrypting the data of @device with a new volume key (and
+ * @cipher) in the background, use bd_crypto_luks_reencrypt_status() to
+ * monitor the progress and bd_crypto_luks_reencrypt_abort() to stop it. An
+ * interrupted reencryption is resumed (with its original cipher and key size)
+ * instead of starting a new one.
+ *
+ * Only the key slot for @passphrase is kept, the other key slots are bound to
+ * the old volume key and become unusable (including the backup passphrase
+ * added by bd_crypto_escrow_device(), the escrow packet contains the old volume
+ * key too). That's why a new reencryption is refused if there are other active
+ * key slots unless @drop_other_keys is %TRUE. The keys can be added back with
+ * bd_crypto_luks_add_key() once the reencryption finishes.
+ *
+ * Returns: whether the reencryption was successfully started or not
+ */
+gboolean bd_crypto_luks_reencrypt_start (const gchar *device, const gchar *luks_device, const gchar *passphrase, const gchar *cipher, guint64 key_size, guint64 max_rate, gboolean drop_other_keys, GError **error) {
+    struct crypt_device *cd = NULL;
+    LUKSReencryptJob *job = NULL;
+    LUKSReencryptJob *old_job = NULL;
+    gchar *fingerprint = NULL;
+
+    if (!passphrase) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_NO_KEY,
+                     "No passphrase given, cannot reencrypt.");
+        return FALSE;
+    }
+
+    job = g_new0 (LUKSReencryptJob, 1);
+    /* one reference for the table and one for this function (passed to the
+       thread later) */
+    job->ref_count = 2;
+    job->device = g_strdup (device);
+    job->running = TRUE;
+    job->max_rate = max_rate;
+    job->start_time = g_get_monotonic_time ();
+
+    /* check and register in one go so that concurrent starts cannot both
+       succeed */
+    g_mutex_lock (&reencrypt_lock);
+    old_job = reencrypt_jobs ? g_hash_table_lookup (reencrypt_jobs, device) : NULL;
+    if (old_job && old_job->running) {
+        job->ref_count = 1;
+        reencrypt_job_unref (job);
+        g_mutex_unlock (&reencrypt_lock);
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_STATE,
+                     "Reencryption of '%s' is already running", device);
+        return FALSE;
+    }
+    if (!reencrypt_jobs)
+        reencrypt_jobs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) reencrypt_job_unref);
+    g_hash_table_replace (reencrypt_jobs, g_strdup (device), job);
+    g_mutex_unlock (&reencrypt_lock);
+
+    cd = acquire_luks_device (device, &fingerprint, NULL, error);
+    if (!cd) {
+        fail_reencrypt_job (job);
+        return FALSE;
+    }
+
+    /* the header is going to be changed */
+    invalidate_luks_device (device, NULL, fingerprint);
+
+    if (g_strcmp0 (crypt_get_type (cd), CRYPT_LUKS2) != 0) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_INVALID_SPEC,
+                     "Only LUKS2 devices can be reencrypted");
+        crypt_free (cd);
+        fail_reencrypt_job (job);
+        return FALSE;
+    }
+
+    if (!init_reencryption (cd, luks_device, passphrase, cipher, key_size, max_rate, drop_other_keys, error)) {
+        crypt_free (cd);
+        fail_reencrypt_job (job);
+        return FALSE;
+    }
+
+    g_mutex_lock (&reencrypt_lock);
+    job->cd = cd;
+    /* the rate is computed from the start of the actual reencryption */
+    job->start_time = g_get_monotonic_time ();
+    g_mutex_unlock (&reencrypt_lock);
+
+    bd_utils_pin_module ((gpointer) bd_crypto_luks_reencrypt_start);
+    g_thread_unref (g_thread_new ("bd-crypto-reencrypt", reencrypt_thread, job));
+
+    return TRUE;
+}
+
+/**
+ * bd_crypto_luks_reencrypt_status:
+ * @device: LUKS2 device to get the reencryption status of
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (transfer full): status of the reencryption of @device or %NULL in
+ * case of error
+ *
+ * The progress, rate (bytes per second) and ETA (seconds) are only available
+ * for reencryptions started by this process, an interrupted reencryption
+ * recorded in the header of @device is reported as
+ * %BD_CRYPTO_LUKS_REENCRYPT_STATE_INTERRUPTED.
+ */
+BDCryptoLUKSReencryptStatus* bd_crypto_luks_reencrypt_status (const gchar *device, GError **error) {
+    BDCryptoLUKSReencryptStatus *ret = NULL;
+    LUKSReencryptJob *job = NULL;
+    struct crypt_device *cd = NULL;
+    crypt_reencrypt_info info;
+    gchar *fingerprint = NULL;
+    gint64 end = 0;
+    gdouble elapsed = 0;
+
+    ret = g_new0 (BDCryptoLUKSReencryptStatus, 1);
+
+    g_mutex_lock (&reencrypt_lock);
+    job = reencrypt_jobs ? g_hash_table_lookup (reencrypt_jobs, device) : NULL;
+    if (job) {
+        if (job->running)
+            ret->state = BD_CRYPTO_LUKS_REENCRYPT_STATE_RUNNING;
+        else if (job->error_code != 0)
+            ret->state = BD_CRYPTO_LUKS_REENCRYPT_STATE_FAILED;
+        else if (job->abort)
+            ret->state = BD_CRYPTO_LUKS_REENCRYPT_STATE_INTERRUPTED;
+        else
+            ret->state = BD_CRYPTO_LUKS_REENCRYPT_STATE_FINISHED;
+        ret->size = job->size;
+        ret->processed = (ret->state == BD_CRYPTO_LUKS_REENCRYPT_STATE_FINISHED) ? job->size : job->offset;
+
+        end = job->running ? g_get_monotonic_time () : job->end_time;
+        elapsed = (gdouble) (end - job->start_time) / G_USEC_PER_SEC;
+        if (elapsed > 0)
+            ret->rate = (job->offset - job->start_offset) / elapsed;
+        if (job->running && (ret->rate > 0) && (ret->size > ret->processed))
+            ret->eta = (guint64) ((ret->size - ret->processed) / ret->rate);
+        g_mutex_unlock (&reencrypt_lock);
+        return ret;
+    }
+    g_mutex_unlock (&reencrypt_lock);
+
+    /* not started by this process, the header tells the rest */
+    cd = acquire_luks_device (device, &fingerprint, NULL, error);
+    if (!cd) {
+        bd_crypto_luks_reencrypt_status_free (ret);
+        return NULL;
+    }
+
+    info = crypt_reencrypt_status (cd, NULL);
+    release_luks_device (device, cd, fingerprint);
+    if (info == CRYPT_REENCRYPT_CLEAN)
+        ret->state = BD_CRYPTO_LUKS_REENCRYPT_STATE_INTERRUPTED;
+    else if (info == CRYPT_REENCRYPT_NONE)
+        ret->state = BD_CRYPTO_LUKS_REENCRYPT_STATE_IDLE;
+    else
+        ret->state = BD_CRYPTO_LUKS_REENCRYPT_STATE_FAILED;
+
+    return ret;
+}
+
+/**
+ * bd_crypto_luks_reencrypt_abort:
+ * @device: LUKS2 device to abort the reencryption of
+ * @error: (out): place to store error (if any)
+ *
+ * Interrupts the reencryption of @device started by this process and waits
+ * for it to stop. The progress is kept in the header of @device and the
+ * reencryption can be resumed with bd_crypto_luks_reencrypt_start().
+ *
+ * Returns: whether the reencryption was successfully interrupted or not
+ */
+gboolean bd_crypto_luks_reencrypt_abort (const gchar *device, GError **error) {
+    LUKSReencryptJob *job = NULL;
+
+    g_mutex_lock (&reencrypt_lock);
+    job = reencrypt_jobs ? g_hash_table_lookup (reencrypt_jobs, device) : NULL;
+    if (!job || !job->running) {
+        g_mutex_unlock (&reencrypt_lock);
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_STATE,
+                     "No reencryption of '%s' is running", device);
+        return FALSE;
+    }
+
+    job->abort = TRUE;
+    /* wake up the progress callback if throttling */
+    g_cond_broadcast (&reencrypt_cond);
+    job->ref_count++;
+    while (job->running)
+        g_cond_wait (&reencrypt_cond, &reencrypt_lock);
+    reencrypt_job_unref (job);
+    g_mutex_unlock (&reencrypt_lock);
+
+    return TRUE;
+}
+
+static gchar *always_fail_cb (gpointer data __attribute__((unused)), const gchar *prompt __attribute__((unused)), int echo __attribute__((unused))) {
+    return NULL;
+}
+
+static gchar *give_passphrase_cb (gpointer data, const gchar *prompt __attribute__((unused)), unsigned failed_attempts) {
+    if (failed_attempts == 0)
+        /* Return a copy of the passphrase that will be freed by volume_key */
+        return g_strdup (data);
+    return NULL;
+}
+
+static void free_passphrase_cb (gpointer data) {
+    g_free (data);
+}
+
+/**
+ * replace_char:
  *
  * Replaces all appereances of @orig in @str with @new (in place).
  */
@@ -633,95 +2605,128 @@ static gchar *replace_char (gchar *str, gchar orig, gchar new) {
     return str;
 }
 
+/**
+ * write_packet_file: (skip)
+ * @out_path: path of the file to write
+ * @data: data to write
+ * @size: size of @data
+ * @error: (out): place to store error (if any)
+ *
+ * Writes @data into a new @out_path with a single write() (unless interrupted).
+ *
+ * Returns: whether @data was successfully written or not
+ */
+static gboolean write_packet_file (const gchar *out_path, const guint8 *data, gsize size, GError **error) {
+    ssize_t n_written = 0;
+    gint fd = -1;
+
+    fd = open (out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "Failed to open '%s': %s", out_path, strerror (errno));
+        return FALSE;
+    }
+
+    while (size > 0) {
+        n_written = write (fd, data, size);
+        if (n_written < 0) {
+            if (errno == EINTR)
+                continue;
+            g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                         "Failed to write '%s': %s", out_path, strerror (errno));
+            close (fd);
+            return FALSE;
+        }
+        data += n_written;
+        size -= n_written;
+    }
+
+    if (close (fd) != 0) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "Failed to close '%s': %s", out_path, strerror (errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 static gboolean write_escrow_data_file (struct libvk_volume *volume, struct libvk_ui *ui, enum libvk_packet_format format, const gchar *out_path,
                                         CERTCertificate *cert, GError **error) {
     gpointer packet_data = NULL;
     gsize packet_data_size = 0;
-    GIOChannel *out_file = NULL;
-    GIOStatus status = G_IO_STATUS_ERROR;
-    gsize bytes_written = 0;
-    GError *tmp_error = NULL;
+    gboolean ret = FALSE;
 
     packet_data = libvk_volume_create_packet_asymmetric_with_format (volume, &packet_data_size, format, cert,
                                                                      ui, LIBVK_PACKET_FORMAT_ASYMMETRIC_WRAP_SECRET_ONLY, error);
 
     if (!packet_data) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_ESCROW_FAILED,
-                     "Failed to get escrow data");
-        libvk_volume_free (volume);
+        if (error && *error)
+            /* keep the specific error from libvk */
+            g_prefix_error (error, "Failed to get escrow data: ");
+        else
+            g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_ESCROW_FAILED,
+                         "Failed to get escrow data");
         return FALSE;
     }
 
-    out_file = g_io_channel_new_file (out_path, "w", error);
-    if (!out_file) {
-        /* error is already populated */
-        g_free (packet_data);
-        return FALSE;
-    }
+    ret = write_packet_file (out_path, packet_data, packet_data_size, error);
+    g_free (packet_data);
 
-    status = g_io_channel_set_encoding (out_file, NULL, error);
-    if (status != G_IO_STATUS_NORMAL) {
-        g_free(packet_data);
+    return ret;
+}
 
-        /* try to shutdown the channel, but if it fails, we cannot do anything about it here */
-        g_io_channel_shutdown (out_file, TRUE, &tmp_error);
+static gboolean init_nss (GError **error) {
+    static GMutex nss_lock;
+    gboolean ret = TRUE;
 
-        /* error is already populated */
-        g_io_channel_unref (out_file);
-        return FALSE;
-    }
+    g_mutex_lock (&nss_lock);
+    if (!NSS_IsInitialized())
+        if (NSS_NoDB_Init(NULL) != SECSuccess) {
+            g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_NSS_INIT_FAILED,
+                         "Failed to initialize NSS");
+            ret = FALSE;
+        }
+    g_mutex_unlock (&nss_lock);
 
-    status = g_io_channel_write_chars (out_file, (gchar *) packet_data, (gssize) packet_data_size,
-                                       &bytes_written, error);
-    g_free (packet_data);
-    if (status != G_IO_STATUS_NORMAL) {
-        /* try to shutdown the channel, but if it fails, we cannot do anything about it here */
-        g_io_channel_shutdown (out_file, TRUE, &tmp_error);
+    return ret;
+}
 
-        /* error is already populated */
-        g_io_channel_unref (out_file);
-        return FALSE;
-    }
+static CERTCertificate* decode_cert (const gchar *cert_data, GError **error) {
+    CERTCertificate *cert = NULL;
+    gchar *cert_data_copy = NULL;
 
-    if (g_io_channel_shutdown (out_file, TRUE, error) != G_IO_STATUS_NORMAL) {
-        /* error is already populated */
-        g_io_channel_unref (out_file);
-        return FALSE;
-    }
-    g_io_channel_unref (out_file);
+    cert_data_copy = g_strdup (cert_data);
+    cert = CERT_DecodeCertFromPackage (cert_data_copy, strlen(cert_data_copy));
+    g_free (cert_data_copy);
+    if (!cert)
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_CERT_DECODE,
+                     "Failed to decode the certificate data");
 
-    return TRUE;
+    return cert;
 }
 
 /**
- * bd_crypto_escrow_device:
+ * escrow_volume: (skip)
  * @device: path of the device to create escrow data for
  * @passphrase: passphrase used for the device
- * @cert_data: (array zero-terminated=1) (element-type gchar): certificate data to use for escrow
+ * @cert: decoded certificate to use for escrow
  * @directory: directory to put escrow data into
  * @backup_passphrase: (allow-none): backup passphrase for the device or %NULL
  * @error: (out): place to store error (if any)
  *
+ * The per-device part of the escrow, NSS has to be initialized.
+ *
  * Returns: whether the escrow data was successfully created for @device or not
  */
-gboolean bd_crypto_escrow_device (const gchar *device, const gchar *passphrase, const gchar *cert_data, const gchar *directory, const gchar *backup_passphrase, GError **error) {
+static gboolean escrow_volume (const gchar *device, const gchar *passphrase, CERTCertificate *cert, const gchar *directory, const gchar *backup_passphrase, GError **error) {
     struct libvk_volume *volume = NULL;
     struct libvk_ui *ui = NULL;
     gchar *label = NULL;
     gchar *uuid = NULL;
-    CERTCertificate *cert = NULL;
     gchar *volume_ident = NULL;
     gchar *out_path = NULL;
     gboolean ret = FALSE;
     gchar *passphrase_copy = NULL;
-    gchar *cert_data_copy = NULL;
-
-    if (!NSS_IsInitialized())
-        if (NSS_NoDB_Init(NULL) != SECSuccess) {
-            g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_NSS_INIT_FAILED,
-                         "Failed to initialize NSS");
-            return FALSE;
-        }
 
     volume = libvk_volume_open (device, error);
     if (!volume)
@@ -746,17 +2751,6 @@ gboolean bd_crypto_escrow_device (const gchar *device, const gchar *passphrase,
         return FALSE;
     }
 
-    cert_data_copy = g_strdup(cert_data);
-    cert = CERT_DecodeCertFromPackage (cert_data_copy, strlen(cert_data_copy));
-    if (!cert) {
-        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_CERT_DECODE,
-                     "Failed to decode the certificate data");
-        libvk_volume_free (volume);
-        libvk_ui_free (ui);
-        g_free(cert_data_copy);
-        return FALSE;
-    }
-
     label = libvk_volume_get_label (volume);
     replace_char (label, '/', '_');
     uuid = libvk_volume_get_uuid (volume);
@@ -776,22 +2770,18 @@ gboolean bd_crypto_escrow_device (const gchar *device, const gchar *passphrase,
     g_free (out_path);
 
     if (!ret) {
-        CERT_DestroyCertificate (cert);
         libvk_volume_free (volume);
         libvk_ui_free (ui);
         g_free (volume_ident);
-        g_free(cert_data_copy);
         return FALSE;
     }
 
     if (backup_passphrase) {
         if (libvk_volume_add_secret (volume, LIBVK_SECRET_PASSPHRASE, backup_passphrase, strlen (backup_passphrase), error) != 0) {
             /* error is already populated */
-            CERT_DestroyCertificate (cert);
             libvk_volume_free (volume);
             libvk_ui_free (ui);
             g_free (volume_ident);
-            g_free(cert_data_copy);
             return FALSE;
         }
 
@@ -800,10 +2790,124 @@ gboolean bd_crypto_escrow_device (const gchar *device, const gchar *passphrase,
         g_free (out_path);
     }
 
-    CERT_DestroyCertificate (cert);
     libvk_volume_free (volume);
     libvk_ui_free (ui);
     g_free (volume_ident);
-    g_free(cert_data_copy);
+    return ret;
+}
+
+/**
+ * bd_crypto_escrow_device:
+ * @device: path of the device to create escrow data for
+ * @passphrase: passphrase used for the device
+ * @cert_data: (array zero-terminated=1) (element-type gchar): certificate data to use for escrow
+ * @directory: directory to put escrow data into
+ * @backup_passphrase: (allow-none): backup passphrase for the device or %NULL
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: whether the escrow data was successfully created for @device or not
+ */
+gboolean bd_crypto_escrow_device (const gchar *device, const gchar *passphrase, const gchar *cert_data, const gchar *directory, const gchar *backup_passphrase, GError **error) {
+    CERTCertificate *cert = NULL;
+    gboolean ret = FALSE;
+
+    if (!init_nss (error))
+        return FALSE;
+
+    cert = decode_cert (cert_data, error);
+    if (!cert)
+        return FALSE;
+
+    ret = escrow_volume (device, passphrase, cert, directory, backup_passphrase, error);
+
+    CERT_DestroyCertificate (cert);
+    return ret;
+}
+
+typedef struct EscrowItem {
+    BDCryptoEscrowResult *result;
+    const gchar *passphrase;
+    const gchar *backup_passphrase;
+    CERTCertificate *cert;
+    const gchar *directory;
+} EscrowItem;
+
+static void escrow_item (gpointer data, gpointer user_data __attribute__((unused))) {
+    EscrowItem *item = (EscrowItem *) data;
+    GError *error = NULL;
+
+    item->result->success = escrow_volume (item->result->device, item->passphrase, item->cert, item->directory,
+                                           item->backup_passphrase, &error);
+    if (!item->result->success) {
+        item->result->error_message = g_strdup (error ? error->message : "Unknown error");
+        g_clear_error (&error);
+    }
+}
+
+/**
+ * bd_crypto_escrow_devices:
+ * @devices: (array zero-terminated=1): paths of the devices to create escrow data for
+ * @passphrases: (array zero-terminated=1): passphrases used for the @devices (one for each of @devices)
+ * @cert_data: (array zero-terminated=1) (element-type gchar): certificate data to use for escrow
+ * @directory: directory to put escrow data into
+ * @backup_passphrases: (allow-none) (array zero-terminated=1): backup passphrases for the
+ *                      @devices (one for each of @devices) or %NULL
+ * @error: (out): place to store error (if any)
+ *
+ * Creates escrow data for all the @devices in parallel (using as many threads
+ * as there are CPUs), initializing NSS and decoding the certificate only once.
+ *
+ * Returns: (array zero-terminated=1): results of creating the escrow data for
+ * the @devices (in the same order as @devices) or %NULL if the arguments are
+ * invalid or the certificate cannot be used
+ *
+ * A failure to create escrow data for some devices is not an error, check the
+ * results for the individual devices.
+ */
+BDCryptoEscrowResult** bd_crypto_escrow_devices (const gchar **devices, const gchar **passphrases, const gchar *cert_data, const gchar *directory, const gchar **backup_passphrases, GError **error) {
+    BDCryptoEscrowResult **ret = NULL;
+    CERTCertificate *cert = NULL;
+    EscrowItem *items = NULL;
+    GPtrArray *item_ptrs = NULL;
+    guint num_items = 0;
+    guint i = 0;
+
+    num_items = devices ? g_strv_length ((gchar **) devices) : 0;
+    if ((num_items != (passphrases ? g_strv_length ((gchar **) passphrases) : 0)) ||
+        (backup_passphrases && (num_items != g_strv_length ((gchar **) backup_passphrases)))) {
+        g_set_error (error, BD_CRYPTO_ERROR, BD_CRYPTO_ERROR_INVALID_SPEC,
+                     "Exactly one passphrase (and backup passphrase) has to be given for every device.");
+        return NULL;
+    }
+
+    if (!init_nss (error))
+        return NULL;
+
+    cert = decode_cert (cert_data, error);
+    if (!cert)
+        return NULL;
+
+    ret = g_new0 (BDCryptoEscrowResult*, num_items + 1);
+    items = g_new0 (EscrowItem, num_items);
+    item_ptrs = g_ptr_array_sized_new (num_items);
+    for (i=0; i < num_items; i++) {
+        ret[i] = g_new0 (BDCryptoEscrowResult, 1);
+        ret[i]->device = g_strdup (devices[i]);
+
+        items[i].result = ret[i];
+        items[i].passphrase = passphrases[i];
+        items[i].backup_passphrase = backup_passphrases ? backup_passphrases[i] : NULL;
+        items[i].cert = cert;
+        items[i].directory = directory;
+        g_ptr_array_add (item_ptrs, &(items[i]));
+    }
+
+    /* getting the volume key runs the PBKDF */
+    run_items_in_pool (item_ptrs, escrow_item);
+
+    g_ptr_array_free (item_ptrs, TRUE);
+    g_free (items);
+    CERT_DestroyCertificate (cert);
+
     return ret;
 }
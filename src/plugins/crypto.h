@@ -32,17 +32,111 @@ typedef enum {
 #define DEFAULT_LUKS_KEYSIZE_BITS 256
 #define DEFAULT_LUKS_CIPHER "aes-xts-plain64"
 
+/* pass as the cipher to use the fastest XTS cipher on the machine (speed is
+   the only criterion, see bd_crypto_luks_format()) */
+#define BD_CRYPTO_LUKS_CIPHER_AUTO "auto"
+
+typedef enum {
+    BD_CRYPTO_LUKS_OPEN_READONLY = 1 << 0,
+    BD_CRYPTO_LUKS_OPEN_ALLOW_DISCARDS = 1 << 1,
+    BD_CRYPTO_LUKS_OPEN_SAME_CPU_CRYPT = 1 << 2,
+    BD_CRYPTO_LUKS_OPEN_SUBMIT_FROM_CRYPT_CPUS = 1 << 3,
+    BD_CRYPTO_LUKS_OPEN_NO_READ_WORKQUEUE = 1 << 4,
+    BD_CRYPTO_LUKS_OPEN_NO_WRITE_WORKQUEUE = 1 << 5,
+} BDCryptoLUKSOpenFlags;
+
+typedef struct BDCryptoLUKSOpenResult {
+    gchar *device;
+    gchar *name;
+    gboolean success;
+    gchar *error_message;
+} BDCryptoLUKSOpenResult;
+
+void bd_crypto_luks_open_result_free (BDCryptoLUKSOpenResult *result);
+BDCryptoLUKSOpenResult* bd_crypto_luks_open_result_copy (BDCryptoLUKSOpenResult *result);
+
+typedef struct BDCryptoCipherBenchmark {
+    gchar *cipher;
+    gchar *mode;
+    guint64 key_size;
+    gdouble encryption_speed;
+    gdouble decryption_speed;
+} BDCryptoCipherBenchmark;
+
+void bd_crypto_cipher_benchmark_free (BDCryptoCipherBenchmark *benchmark);
+BDCryptoCipherBenchmark* bd_crypto_cipher_benchmark_copy (BDCryptoCipherBenchmark *benchmark);
+
+typedef struct BDCryptoActiveDevice {
+    gchar *name;
+    gchar *uuid;
+    gchar *backing_device;
+    gchar *cipher;
+    guint64 key_size;
+    guint64 sector_size;
+    BDCryptoLUKSOpenFlags flags;
+    guint64 offset;
+} BDCryptoActiveDevice;
+
+void bd_crypto_active_device_free (BDCryptoActiveDevice *device);
+BDCryptoActiveDevice* bd_crypto_active_device_copy (BDCryptoActiveDevice *device);
+
+typedef enum {
+    BD_CRYPTO_LUKS_REENCRYPT_STATE_IDLE,
+    BD_CRYPTO_LUKS_REENCRYPT_STATE_RUNNING,
+    BD_CRYPTO_LUKS_REENCRYPT_STATE_INTERRUPTED,
+    BD_CRYPTO_LUKS_REENCRYPT_STATE_FINISHED,
+    BD_CRYPTO_LUKS_REENCRYPT_STATE_FAILED,
+} BDCryptoLUKSReencryptState;
+
+typedef struct BDCryptoLUKSReencryptStatus {
+    BDCryptoLUKSReencryptState state;
+    guint64 size;
+    guint64 processed;
+    gdouble rate;
+    guint64 eta;
+} BDCryptoLUKSReencryptStatus;
+
+void bd_crypto_luks_reencrypt_status_free (BDCryptoLUKSReencryptStatus *status);
+BDCryptoLUKSReencryptStatus* bd_crypto_luks_reencrypt_status_copy (BDCryptoLUKSReencryptStatus *status);
+
+typedef struct BDCryptoEscrowResult {
+    gchar *device;
+    gboolean success;
+    gchar *error_message;
+} BDCryptoEscrowResult;
+
+void bd_crypto_escrow_result_free (BDCryptoEscrowResult *result);
+BDCryptoEscrowResult* bd_crypto_escrow_result_copy (BDCryptoEscrowResult *result);
+
 gchar* bd_crypto_generate_backup_passphrase(GError **error);
 gboolean bd_crypto_device_is_luks (const gchar *device, GError **error);
 gchar* bd_crypto_luks_uuid (const gchar *device, GError **error);
 gchar* bd_crypto_luks_status (const gchar *luks_device, GError **error);
 gboolean bd_crypto_luks_format (const gchar *device, const gchar *cipher, guint64 key_size, const gchar *passphrase, const gchar *key_file, guint64 min_entropy, GError **error);
+gboolean bd_crypto_luks_format_luks2 (const gchar *device, const gchar *cipher, guint64 key_size, const gchar *passphrase, const gchar *key_file, guint64 min_entropy, guint32 sector_size, const gchar *pbkdf, guint32 iter_time, guint32 max_memory_kb, guint32 parallel_threads, GError **error);
 gboolean bd_crypto_luks_open (const gchar *device, const gchar *name, const gchar *passphrase, const gchar *key_file, GError **error);
+gboolean bd_crypto_luks_open_with_flags (const gchar *device, const gchar *name, const gchar *passphrase, const gchar *key_file, BDCryptoLUKSOpenFlags flags, GError **error);
+gboolean bd_crypto_luks_refresh (const gchar *luks_device, const gchar *passphrase, const gchar *key_file, BDCryptoLUKSOpenFlags flags, GError **error);
+BDCryptoLUKSOpenFlags bd_crypto_luks_get_flags (const gchar *luks_device, GError **error);
+BDCryptoActiveDevice** bd_crypto_list_active (GError **error);
+BDCryptoCipherBenchmark** bd_crypto_benchmark (GError **error);
+guint64 bd_crypto_benchmark_pbkdf (const gchar *hash, guint64 key_size, GError **error);
+BDCryptoLUKSOpenResult** bd_crypto_luks_open_many (const gchar **devices, const gchar **names, const gchar **passphrases, gboolean share_volume_key, GError **error);
 gboolean bd_crypto_luks_close (const gchar *luks_device, GError **error);
 gboolean bd_crypto_luks_add_key (const gchar *device, const gchar *pass, const gchar *key_file, const gchar *npass, const gchar *nkey_file, GError **error);
 gboolean bd_crypto_luks_remove_key (const gchar *device, const gchar *pass, const gchar *key_file, GError **error);
 gboolean bd_crypto_luks_change_key (const gchar *device, const gchar *pass, const gchar *npass, GError **error);
+guint64 bd_crypto_luks_key_session_open (const gchar *device, const gchar *passphrase, const gchar *key_file, GError **error);
+gboolean bd_crypto_luks_key_session_close (guint64 session, GError **error);
+gint bd_crypto_luks_key_session_get_keyslot (guint64 session, GError **error);
+gint bd_crypto_luks_key_session_add_key (guint64 session, const gchar *npass, const gchar *nkey_file, GError **error);
+gboolean bd_crypto_luks_key_session_remove_key (guint64 session, gint keyslot, GError **error);
+gboolean bd_crypto_luks_key_session_change_key (guint64 session, const gchar *npass, const gchar *nkey_file, GError **error);
 gboolean bd_crypto_luks_resize (const gchar *device, guint64 size, GError **error);
+gboolean bd_crypto_luks_reencrypt_start (const gchar *device, const gchar *luks_device, const gchar *passphrase, const gchar *cipher, guint64 key_size, guint64 max_rate, gboolean drop_other_keys, GError **error);
+BDCryptoLUKSReencryptStatus* bd_crypto_luks_reencrypt_status (const gchar *device, GError **error);
+gboolean bd_crypto_luks_reencrypt_abort (const gchar *device, GError **error);
 gboolean bd_crypto_escrow_device (const gchar *device, const gchar *passphrase, const gchar *cert_data, const gchar *directory, const gchar *backup_passphrase, GError **error);
+BDCryptoEscrowResult** bd_crypto_escrow_devices (const gchar **devices, const gchar **passphrases, const gchar *cert_data, const gchar *directory, const gchar **backup_passphrases, GError **error);
 
 #endif  /* BD_CRYPTO */
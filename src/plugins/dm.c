@@ -19,6 +19,8 @@
 
 #include <glib.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/sysmacros.h>
 #include <utils.h>
 #include <libdevmapper.h>
 #include <dmraid/dmraid.h>
@@ -31,6 +33,9 @@
 #define for_each_subset(_rs, _n) list_for_each_entry(_n, &(_rs)->sets, list)
 #define for_each_device(_rs, _d) list_for_each_entry(_d, &(_rs)->devs, devs)
 
+/* receive buffer for the block device udev monitor (8 MiB) */
+#define BLOCK_MONITOR_BUFFER_SIZE (8 * 1024 * 1024)
+
 /**
  * SECTION: dm
  * @short_description: plugin for basic operations with device mapper
@@ -48,6 +53,30 @@ GQuark bd_dm_error_quark (void)
     return g_quark_from_static_string ("g-bd-dm-error-quark");
 }
 
+BDDMMapInfo* bd_dm_map_info_copy (BDDMMapInfo *info) {
+    BDDMMapInfo *new_info = g_new0 (BDDMMapInfo, 1);
+
+    new_info->name = g_strdup (info->name);
+    new_info->uuid = g_strdup (info->uuid);
+    new_info->major = info->major;
+    new_info->minor = info->minor;
+    new_info->open_count = info->open_count;
+    new_info->suspended = info->suspended;
+    new_info->live_table = info->live_table;
+    new_info->target_types = g_strdupv (info->target_types);
+    new_info->deps = g_strdupv (info->deps);
+
+    return new_info;
+}
+
+void bd_dm_map_info_free (BDDMMapInfo *info) {
+    g_free (info->name);
+    g_free (info->uuid);
+    g_strfreev (info->target_types);
+    g_strfreev (info->deps);
+    g_free (info);
+}
+
 typedef struct raid_set* (*RSEvalFunc) (struct raid_set *rs, gpointer data);
 
 /**
@@ -199,11 +228,8 @@ gchar* bd_dm_node_from_name (gchar *map_name, GError **error) {
  * @error) indicates whether error appeared (non-%NULL) or not (%NULL).
  */
 gboolean bd_dm_map_exists (gchar *map_name, gboolean live_only, gboolean active_only, GError **error) {
-    struct dm_task *task_list = NULL;
     struct dm_task *task_info = NULL;
-	struct dm_names *names = NULL;
     struct dm_info info;
-	guint64 next = 0;
     gboolean ret = FALSE;
 
     if (geteuid () != 0) {
@@ -212,63 +238,176 @@ gboolean bd_dm_map_exists (gchar *map_name, gboolean live_only, gboolean active_
         return FALSE;
     }
 
-    task_list = dm_task_create(DM_DEVICE_LIST);
-	if (!task_list) {
+    /* query the map directly by its name instead of listing all the maps */
+    task_info = dm_task_create (DM_DEVICE_INFO);
+    if (!task_info) {
         g_warning ("Failed to create DM task");
         g_set_error (error, BD_DM_ERROR, BD_DM_ERROR_TASK,
                      "Failed to create DM task");
         return FALSE;
     }
 
-    dm_task_run(task_list);
-	names = dm_task_get_names(task_list);
+    if (!dm_task_set_name (task_info, map_name) || !dm_task_run (task_info) ||
+        !dm_task_get_info (task_info, &info)) {
+        g_set_error (error, BD_DM_ERROR, BD_DM_ERROR_TASK,
+                     "Failed to get information about the DM map '%s'", map_name);
+        dm_task_destroy (task_info);
+        return FALSE;
+    }
+    dm_task_destroy (task_info);
 
-    if (!names || !names->dev)
+    if (!info.exists)
         return FALSE;
 
-    do {
-        names = (void *)names + next;
-        next = names->next;
-        /* we are searching for the particular map_name map */
-        if (g_strcmp0 (map_name, names->name) != 0)
-            /* not matching, skip */
-            continue;
+    /* found existing map, let's test the restrictions */
+    ret = TRUE;
+    if (live_only)
+        ret = info.live_table;
+    if (active_only)
+        ret = ret && !info.suspended;
 
-        /* get device info */
-        task_info = dm_task_create(DM_DEVICE_INFO);
-        if (!task_info) {
-            g_warning ("Failed to create DM task");
-            g_set_error (error, BD_DM_ERROR, BD_DM_ERROR_TASK,
-                         "Failed to create DM task");
-            break;
+    return ret;
+}
+
+/**
+ * get_map_info: (skip)
+ *
+ * Returns: information about the @map_name map or %NULL if it cannot be
+ *          obtained (e.g. because the map was removed in the meantime)
+ */
+static BDDMMapInfo* get_map_info (const gchar *map_name) {
+    struct dm_task *task = NULL;
+    struct dm_info info;
+    struct dm_deps *deps = NULL;
+    BDDMMapInfo *ret = NULL;
+    GPtrArray *target_types = NULL;
+    void *next = NULL;
+    guint64 start = 0;
+    guint64 length = 0;
+    gchar *target_type = NULL;
+    gchar *params = NULL;
+    guint32 i = 0;
+    gboolean known = FALSE;
+
+    /* DM_DEVICE_DEPS reports the info, UUID and the dependencies at once */
+    task = dm_task_create (DM_DEVICE_DEPS);
+    if (!task)
+        return NULL;
+
+    if (!dm_task_set_name (task, map_name) || !dm_task_run (task) ||
+        !dm_task_get_info (task, &info) || !info.exists) {
+        dm_task_destroy (task);
+        return NULL;
+    }
+
+    ret = g_new0 (BDDMMapInfo, 1);
+    ret->name = g_strdup (map_name);
+    if (dm_task_get_uuid (task) && *dm_task_get_uuid (task))
+        ret->uuid = g_strdup (dm_task_get_uuid (task));
+    ret->major = info.major;
+    ret->minor = info.minor;
+    ret->open_count = info.open_count;
+    ret->suspended = info.suspended != 0;
+    ret->live_table = info.live_table != 0;
+
+    deps = dm_task_get_deps (task);
+    ret->deps = g_new0 (gchar*, (deps ? deps->count : 0) + 1);
+    for (i=0; deps && i < deps->count; i++)
+        ret->deps[i] = g_strdup_printf ("%u:%u", major (deps->device[i]), minor (deps->device[i]));
+    dm_task_destroy (task);
+
+    /* the target types only come with the table */
+    target_types = g_ptr_array_new ();
+    if (info.live_table) {
+        task = dm_task_create (DM_DEVICE_TABLE);
+        if (task && dm_task_set_name (task, map_name) && dm_task_secure_data (task) && dm_task_run (task)) {
+            do {
+                next = dm_get_next_target (task, next, &start, &length, &target_type, &params);
+                if (!target_type)
+                    continue;
+                /* report every target type just once */
+                known = FALSE;
+                for (i=0; !known && i < target_types->len; i++)
+                    known = (g_strcmp0 (g_ptr_array_index (target_types, i), target_type) == 0);
+                if (!known)
+                    g_ptr_array_add (target_types, g_strdup (target_type));
+            } while (next);
         }
+        if (task)
+            dm_task_destroy (task);
+    }
+    g_ptr_array_add (target_types, NULL);
+    ret->target_types = (gchar **) g_ptr_array_free (target_types, FALSE);
 
-        dm_task_set_name(task_info, names->name);
-        dm_task_run(task_info);
-        dm_task_get_info(task_info, &info);
+    return ret;
+}
 
-        if (!info.exists)
-            /* doesn't exist, try next one */
-            continue;
+/**
+ * bd_dm_list_maps:
+ * @error: (out): place to store error (if any)
+ *
+ * Lists all the DM maps in one sweep so that callers can build their own index
+ * instead of querying the maps one by one.
+ *
+ * Returns: (array zero-terminated=1): information about all the DM maps or
+ * %NULL in case of error
+ */
+BDDMMapInfo** bd_dm_list_maps (GError **error) {
+    GPtrArray *maps = NULL;
+    BDDMMapInfo *map = NULL;
+    struct dm_task *task_list = NULL;
+    struct dm_names *names = NULL;
+    guint next = 0;
 
-        /* found existing name match, let's test the restrictions */
-        ret = TRUE;
-        if (live_only)
-            ret = info.live_table;
-        if (active_only)
-            ret = ret && !info.suspended;
+    if (geteuid () != 0) {
+        g_set_error (error, BD_DM_ERROR, BD_DM_ERROR_NOT_ROOT,
+                     "Not running as root, cannot query DM maps");
+        return NULL;
+    }
 
-        dm_task_destroy (task_info);
-        if (ret)
-            /* found match according to restrictions */
-            break;
-    } while (next);
+    task_list = dm_task_create (DM_DEVICE_LIST);
+    if (!task_list) {
+        g_set_error (error, BD_DM_ERROR, BD_DM_ERROR_TASK,
+                     "Failed to create DM task");
+        return NULL;
+    }
+
+    if (!dm_task_run (task_list)) {
+        g_set_error (error, BD_DM_ERROR, BD_DM_ERROR_TASK,
+                     "Failed to list DM maps");
+        dm_task_destroy (task_list);
+        return NULL;
+    }
 
+    maps = g_ptr_array_new ();
+    names = dm_task_get_names (task_list);
+    if (names && names->dev) {
+        do {
+            names = (struct dm_names *) ((gchar *) names + next);
+            next = names->next;
+            map = get_map_info (names->name);
+            if (map)
+                g_ptr_array_add (maps, map);
+        } while (next);
+    }
     dm_task_destroy (task_list);
 
-    return ret;
+    g_ptr_array_add (maps, NULL);
+    return (BDDMMapInfo **) g_ptr_array_free (maps, FALSE);
 }
 
+/* process-wide dmraid library context shared by all the RAID functions, only
+ * to be touched with dmraid_lock held (see acquire_dmraid_stack()) */
+static GMutex dmraid_lock;
+static struct lib_context *dmraid_lc = NULL;
+
+/* plugin-wide udev context (created on first use with dmraid_lock held) and the
+ * monitor used to find out that the set of block devices changed and thus that
+ * the cached dmraid context is stale */
+static struct udev *udev_context = NULL;
+static struct udev_monitor *block_monitor = NULL;
+static gboolean block_monitor_initialized = FALSE;
+
 /**
  * init_dmraid_stack: (skip)
  *
@@ -281,8 +420,6 @@ static struct lib_context* init_dmraid_stack (GError **error) {
     struct lib_context *lc;
 
     /* the code for this function was cherry-picked from the pyblock code */
-    /* XXX: do this all just once, store global lc and provide a reinit
-     *      function? */
 
     /* initialize dmraid library context */
     lc = libdmraid_init (1, (gchar **)argv);
@@ -296,12 +433,9 @@ static struct lib_context* init_dmraid_stack (GError **error) {
     }
     discover_raid_devices (lc, NULL);
 
-    if (!count_devices (lc, RAID)) {
-        g_set_error (error, BD_DM_ERROR, BD_DM_ERROR_RAID_NO_DEVS,
-                     "No RAIDs discovered");
-        libdmraid_exit (lc);
-        return NULL;
-    }
+    if (!count_devices (lc, RAID))
+        /* nothing to group, but still a valid (empty) context worth caching */
+        return lc;
 
     argv[0] = NULL;
     if (!group_set (lc, argv)) {
@@ -314,20 +448,227 @@ static struct lib_context* init_dmraid_stack (GError **error) {
     return lc;
 }
 
+/**
+ * init_block_monitor: (skip)
+ *
+ * Sets up the udev monitor for block devices (if possible). Must be called
+ * with dmraid_lock held.
+ */
+static void init_block_monitor (void) {
+    if (block_monitor_initialized)
+        return;
+    block_monitor_initialized = TRUE;
+
+    if (!udev_context)
+        udev_context = udev_new ();
+    if (!udev_context)
+        return;
+
+    block_monitor = udev_monitor_new_from_netlink (udev_context, "udev");
+    if (!block_monitor)
+        return;
+
+    if ((udev_monitor_filter_add_match_subsystem_devtype (block_monitor, "block", NULL) < 0) ||
+        (udev_monitor_enable_receiving (block_monitor) < 0)) {
+        udev_monitor_unref (block_monitor);
+        block_monitor = NULL;
+        return;
+    }
+
+    /* the events are only drained when the dmraid stack is needed so make
+       sure a burst of them doesn't overflow the socket in the meantime (not
+       fatal if it cannot be changed, an overflow is just a false positive
+       below) */
+    udev_monitor_set_receive_buffer_size (block_monitor, BLOCK_MONITOR_BUFFER_SIZE);
+}
+
+/**
+ * block_devices_changed: (skip)
+ *
+ * Drains all the pending events from the block device monitor without
+ * blocking. Must be called with dmraid_lock held.
+ *
+ * Returns: whether some block device was added or removed since the last call
+ *          (or whether it is unknown because there is no monitor or some
+ *          events may have been lost)
+ */
+static gboolean block_devices_changed (void) {
+    struct pollfd pfd;
+    struct udev_device *device = NULL;
+    const gchar *action = NULL;
+    gboolean changed = FALSE;
+    gint ret = 0;
+
+    if (!block_monitor)
+        /* no way to get notified, assume the worst */
+        return TRUE;
+
+    pfd.fd = udev_monitor_get_fd (block_monitor);
+    pfd.events = POLLIN;
+    while ((ret = poll (&pfd, 1, 0)) > 0) {
+        if ((pfd.revents & (POLLERR|POLLHUP|POLLNVAL)) || !(pfd.revents & POLLIN))
+            /* the monitor is broken, nothing more can be read from it */
+            return TRUE;
+
+        device = udev_monitor_receive_device (block_monitor);
+        if (!device) {
+            /* failed to receive the event (e.g. ENOBUFS when the socket
+               overflowed), some events may have been lost so assume the
+               worst but keep draining the rest */
+            changed = TRUE;
+            continue;
+        }
+        action = udev_device_get_action (device);
+        if ((g_strcmp0 (action, "add") == 0) || (g_strcmp0 (action, "remove") == 0))
+            changed = TRUE;
+        udev_device_unref (device);
+    }
+
+    if (ret < 0)
+        /* failed to check for the events (e.g. EINTR) */
+        changed = TRUE;
+
+    return changed;
+}
+
+/**
+ * drop_dmraid_stack: (skip)
+ *
+ * Invalidates the cached dmraid context. Must be called with dmraid_lock held.
+ */
+static void drop_dmraid_stack (void) {
+    if (dmraid_lc) {
+        libdmraid_exit (dmraid_lc);
+        dmraid_lc = NULL;
+    }
+}
+
+/**
+ * acquire_dmraid_stack: (skip)
+ *
+ * Returns: the cached dmraid context (initialized or reinitialized if needed)
+ *          or %NULL in case of error or if there are no RAIDs
+ *
+ * On success, dmraid_lock is held and release_dmraid_stack() has to be called
+ * once the caller is done with the context.
+ */
+static struct lib_context* acquire_dmraid_stack (GError **error) {
+    g_mutex_lock (&dmraid_lock);
+
+    /* set the monitor up before the discovery so that no change is missed */
+    init_block_monitor ();
+    if (block_devices_changed ())
+        drop_dmraid_stack ();
+
+    if (!dmraid_lc) {
+        dmraid_lc = init_dmraid_stack (error);
+        if (!dmraid_lc) {
+            /* error is already populated */
+            g_mutex_unlock (&dmraid_lock);
+            return NULL;
+        }
+    }
+
+    if (!count_devices (dmraid_lc, RAID)) {
+        g_set_error (error, BD_DM_ERROR, BD_DM_ERROR_RAID_NO_DEVS,
+                     "No RAIDs discovered");
+        g_mutex_unlock (&dmraid_lock);
+        return NULL;
+    }
+
+    return dmraid_lc;
+}
+
+/**
+ * release_dmraid_stack: (skip)
+ */
+static void release_dmraid_stack (void) {
+    g_mutex_unlock (&dmraid_lock);
+}
+
+/**
+ * bd_dm_raid_rescan:
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: whether the devices were successfully (re)scanned for RAID sets or not
+ *
+ * The discovered RAID sets are cached and the cache is dropped automatically
+ * when a block device is added or removed. This function allows to force the
+ * rescan, e.g. after the RAID metadata on an existing device was changed.
+ */
+gboolean bd_dm_raid_rescan (GError **error) {
+    g_mutex_lock (&dmraid_lock);
+
+    init_block_monitor ();
+    /* events up to now are covered by the rescan */
+    block_devices_changed ();
+    drop_dmraid_stack ();
+
+    dmraid_lc = init_dmraid_stack (error);
+    g_mutex_unlock (&dmraid_lock);
+
+    return dmraid_lc != NULL;
+}
+
+/* udev properties of a block device, cached for the time of one sweep over the
+ * RAID sets (see get_dev_props()) */
+typedef struct DevProps {
+    gchar *uuid;
+    gint major;
+    gint minor;
+} DevProps;
+
+static void dev_props_free (DevProps *props) {
+    g_free (props->uuid);
+    g_free (props);
+}
+
+/**
+ * get_dev_props: (skip)
+ *
+ * Returns: (transfer none): udev properties of the @sysname block device, each
+ *          device is looked up at most once per @cache
+ */
+static DevProps* get_dev_props (const gchar *sysname, GHashTable *cache) {
+    DevProps *props = NULL;
+    struct udev_device *device = NULL;
+    const gchar *value = NULL;
+
+    props = g_hash_table_lookup (cache, sysname);
+    if (props)
+        return props;
+
+    props = g_new0 (DevProps, 1);
+    props->major = -1;
+    props->minor = -1;
+
+    /* failures are cached too, there's no point in retrying them in the same sweep */
+    if (udev_context)
+        device = udev_device_new_from_subsystem_sysname (udev_context, "block", sysname);
+    if (device) {
+        props->uuid = g_strdup (udev_device_get_property_value (device, "UUID"));
+        value = udev_device_get_property_value (device, "MAJOR");
+        if (value)
+            props->major = atoi (value);
+        value = udev_device_get_property_value (device, "MINOR");
+        if (value)
+            props->minor = atoi (value);
+        udev_device_unref (device);
+    }
+
+    g_hash_table_insert (cache, g_strdup (sysname), props);
+    return props;
+}
+
 /**
  * raid_dev_matches_spec: (skip)
  *
  * Returns: whether the device specified by @sysname matches the spec given by @name,
  *          @uuid, @major and @minor
  */
-static gboolean raid_dev_matches_spec (struct raid_dev *raid_dev, gchar *name, gchar *uuid, gint major, gint minor) {
+static gboolean raid_dev_matches_spec (struct raid_dev *raid_dev, gchar *name, gchar *uuid, gint major, gint minor, GHashTable *props_cache) {
     gchar const *dev_name = NULL;
-    gchar const *dev_uuid;
-    gchar const *major_str;
-    gchar const *minor_str;
-    struct udev *context;
-    struct udev_device *device;
-    gboolean ret = TRUE;
+    DevProps *props = NULL;
 
     /* find the second '/' to get name (the rest of the string) */
     dev_name = strchr (raid_dev->di->path, '/');
@@ -348,40 +689,37 @@ static gboolean raid_dev_matches_spec (struct raid_dev *raid_dev, gchar *name, g
         return FALSE;
     }
 
-    context = udev_new ();
-    device = udev_device_new_from_subsystem_sysname (context, "block", dev_name);
-    dev_uuid = udev_device_get_property_value (device, "UUID");
-    major_str = udev_device_get_property_value (device, "MAJOR");
-    minor_str = udev_device_get_property_value (device, "MINOR");
+    if ((!uuid || (g_strcmp0 (uuid, "") == 0)) && major < 0 && minor < 0)
+        /* nothing more to check, no need to ask udev */
+        return TRUE;
 
-    if (uuid && (g_strcmp0 (uuid, "") != 0) && (g_strcmp0 (uuid, dev_uuid) != 0))
-        ret = FALSE;
+    props = get_dev_props (dev_name, props_cache);
 
-    if (major >= 0 && (atoi (major_str) != major))
-        ret = FALSE;
+    if (uuid && (g_strcmp0 (uuid, "") != 0) && (g_strcmp0 (uuid, props->uuid) != 0))
+        return FALSE;
 
-    if (minor >= 0 && (atoi (minor_str) != minor))
-        ret = FALSE;
+    if (major >= 0 && (props->major != major))
+        return FALSE;
 
-    udev_device_unref (device);
-    udev_unref (context);
+    if (minor >= 0 && (props->minor != minor))
+        return FALSE;
 
-    return ret;
+    return TRUE;
 }
 
 /**
  * find_raid_sets_for_dev: (skip)
  */
-static void find_raid_sets_for_dev (gchar *name, gchar *uuid, gint major, gint minor, struct lib_context *lc, struct raid_set *rs, GPtrArray *ret_sets) {
+static void find_raid_sets_for_dev (gchar *name, gchar *uuid, gint major, gint minor, struct lib_context *lc, struct raid_set *rs, GPtrArray *ret_sets, GHashTable *props_cache) {
     struct raid_set *subset;
     struct raid_dev *dev;
 
     if (T_GROUP(rs) || !list_empty(&(rs->sets))) {
         for_each_subset (rs, subset)
-            find_raid_sets_for_dev (name, uuid, major, minor, lc, subset, ret_sets);
+            find_raid_sets_for_dev (name, uuid, major, minor, lc, subset, ret_sets, props_cache);
     } else {
         for_each_device (rs, dev) {
-            if (raid_dev_matches_spec (dev, name, uuid, major, minor))
+            if (raid_dev_matches_spec (dev, name, uuid, major, minor, props_cache))
                 g_ptr_array_add (ret_sets, g_strdup (rs->name));
         }
     }
@@ -404,17 +742,21 @@ gchar** bd_dm_get_member_raid_sets (gchar *name, gchar *uuid, gint major, gint m
     guint64 i = 0;
     struct lib_context *lc = NULL;
     struct raid_set *rs = NULL;
-    GPtrArray *ret_sets = g_ptr_array_new ();
+    GPtrArray *ret_sets = NULL;
+    GHashTable *props_cache = NULL;
     gchar **ret = NULL;
 
-    lc = init_dmraid_stack (error);
+    lc = acquire_dmraid_stack (error);
     if (!lc)
         /* error is already populated */
         return NULL;
 
+    ret_sets = g_ptr_array_new ();
+    props_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) dev_props_free);
     for_each_raidset (lc, rs) {
-        find_raid_sets_for_dev (name, uuid, major, minor, lc, rs, ret_sets);
+        find_raid_sets_for_dev (name, uuid, major, minor, lc, rs, ret_sets, props_cache);
     }
+    g_hash_table_destroy (props_cache);
 
     /* now create the return value -- NULL-terminated array of strings */
     ret = g_new0 (gchar*, ret_sets->len + 1);
@@ -424,7 +766,7 @@ gchar** bd_dm_get_member_raid_sets (gchar *name, gchar *uuid, gint major, gint m
 
     g_ptr_array_free (ret_sets, FALSE);
 
-    libdmraid_exit (lc);
+    release_dmraid_stack ();
     return ret;
 }
 
@@ -469,7 +811,7 @@ static gboolean change_set_by_name (gchar *name, enum activate_type action, GErr
     struct raid_set *iter_rs;
     struct raid_set *match_rs = NULL;
 
-    lc = init_dmraid_stack (error);
+    lc = acquire_dmraid_stack (error);
     if (!lc)
         /* error is already populated */
         return FALSE;
@@ -483,19 +825,22 @@ static gboolean change_set_by_name (gchar *name, enum activate_type action, GErr
     if (!match_rs) {
         g_set_error (error, BD_DM_ERROR, BD_DM_ERROR_RAID_NO_EXIST,
                      "RAID set %s doesn't exist", name);
-        libdmraid_exit (lc);
+        release_dmraid_stack ();
         return FALSE;
     }
 
     rc = change_set (lc, action, match_rs);
+
+    /* the state of the sets changed, do not reuse the context */
+    drop_dmraid_stack ();
+    release_dmraid_stack ();
+
     if (!rc) {
         g_set_error (error, BD_DM_ERROR, BD_DM_ERROR_RAID_FAIL,
                      "Failed to activate the RAID set '%s'", name);
-        libdmraid_exit (lc);
         return FALSE;
     }
 
-    libdmraid_exit (lc);
     return TRUE;
 }
 
@@ -533,8 +878,9 @@ gchar* bd_dm_get_raid_set_type (gchar *name, GError **error) {
     struct raid_set *iter_rs;
     struct raid_set *match_rs = NULL;
     const gchar *type = NULL;
+    gchar *ret = NULL;
 
-    lc = init_dmraid_stack (error);
+    lc = acquire_dmraid_stack (error);
     if (!lc)
         /* error is already populated */
         return NULL;
@@ -548,7 +894,7 @@ gchar* bd_dm_get_raid_set_type (gchar *name, GError **error) {
     if (!match_rs) {
         g_set_error (error, BD_DM_ERROR, BD_DM_ERROR_RAID_NO_EXIST,
                      "RAID set %s doesn't exist", name);
-        libdmraid_exit (lc);
+        release_dmraid_stack ();
         return NULL;
     }
 
@@ -556,10 +902,12 @@ gchar* bd_dm_get_raid_set_type (gchar *name, GError **error) {
     if (!type) {
         g_set_error (error, BD_DM_ERROR, BD_DM_ERROR_RAID_FAIL,
                      "Failed to get RAID set's type");
-        libdmraid_exit (lc);
+        release_dmraid_stack ();
         return NULL;
     }
 
-    libdmraid_exit (lc);
-    return g_strdup (type);
+    ret = g_strdup (type);
+    release_dmraid_stack ();
+
+    return ret;
 }
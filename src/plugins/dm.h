@@ -17,14 +17,31 @@ typedef enum {
     BD_DM_ERROR_RAID_NO_EXIST,
 } BDDMError;
 
+typedef struct BDDMMapInfo {
+    gchar *name;
+    gchar *uuid;
+    guint32 major;
+    guint32 minor;
+    gint32 open_count;
+    gboolean suspended;
+    gboolean live_table;
+    gchar **target_types;
+    gchar **deps;
+} BDDMMapInfo;
+
+void bd_dm_map_info_free (BDDMMapInfo *info);
+BDDMMapInfo* bd_dm_map_info_copy (BDDMMapInfo *info);
+
 gboolean bd_dm_create_linear (gchar *map_name, gchar *device, guint64 length, gchar *uuid, GError **error);
 gboolean bd_dm_remove (gchar *map_name, GError **error);
 gchar* bd_dm_name_from_node (gchar *dm_node, GError **error);
 gchar* bd_dm_node_from_name (gchar *map_name, GError **error);
 gboolean bd_dm_map_exists (gchar *map_name, gboolean live_only, gboolean active_only, GError **error);
+BDDMMapInfo** bd_dm_list_maps (GError **error);
 gchar** bd_dm_get_member_raid_sets (gchar *name, gchar *uuid, gint major, gint minor, GError **error);
 gboolean bd_dm_activate_raid_set (gchar *name, GError **error);
 gboolean bd_dm_deactivate_raid_set (gchar *name, GError **error);
 gchar* bd_dm_get_raid_set_type (gchar *name, GError **error);
+gboolean bd_dm_raid_rescan (GError **error);
 
 #endif  /* BD_DM */
@@ -19,6 +19,7 @@
 
 #include <glib.h>
 #include <math.h>
+#include <stdio.h>
 #include <string.h>
 #include <libdevmapper.h>
 #include <unistd.h>
@@ -104,6 +105,15 @@ BDLVMLVdata* bd_lvm_lvdata_copy (BDLVMLVdata *data) {
     new_data->size = data->size;
     new_data->attr = g_strdup (data->attr);
     new_data->segtype = g_strdup (data->segtype);
+    new_data->origin = g_strdup (data->origin);
+    new_data->pool_lv = g_strdup (data->pool_lv);
+    new_data->data_lv = g_strdup (data->data_lv);
+    new_data->metadata_lv = g_strdup (data->metadata_lv);
+    new_data->data_percent = data->data_percent;
+    new_data->metadata_percent = data->metadata_percent;
+    new_data->devices = g_strdup (data->devices);
+    new_data->stripes = data->stripes;
+    new_data->stripe_size = data->stripe_size;
     return new_data;
 }
 
@@ -113,6 +123,139 @@ void bd_lvm_lvdata_free (BDLVMLVdata *data) {
     g_free (data->uuid);
     g_free (data->attr);
     g_free (data->segtype);
+    g_free (data->origin);
+    g_free (data->pool_lv);
+    g_free (data->data_lv);
+    g_free (data->metadata_lv);
+    g_free (data->devices);
+    g_free (data);
+}
+
+void bd_lvm_pvdata_array_free (BDLVMPVdataArray *data) {
+    if (data->strings)
+        g_string_chunk_free (data->strings);
+    /* the items live in the same block as the array itself */
+    g_free (data);
+}
+
+BDLVMPVdataArray* bd_lvm_pvdata_array_copy (BDLVMPVdataArray *data) {
+    BDLVMPVdataArray *new_data = g_malloc0 (sizeof (BDLVMPVdataArray) + data->n_items * sizeof (BDLVMPVdata));
+    BDLVMPVdata *item = NULL;
+    guint64 i = 0;
+
+    if (data->n_items == 0)
+        return new_data;
+
+    new_data->items = (BDLVMPVdata *) (new_data + 1);
+    new_data->n_items = data->n_items;
+    new_data->strings = g_string_chunk_new (1024);
+    for (i=0; i < data->n_items; i++) {
+        item = new_data->items + i;
+        *item = data->items[i];
+        /* the strings have to point into the new arena */
+        item->pv_name = item->pv_name ? g_string_chunk_insert_const (new_data->strings, item->pv_name) : NULL;
+        item->pv_uuid = item->pv_uuid ? g_string_chunk_insert_const (new_data->strings, item->pv_uuid) : NULL;
+        item->vg_name = item->vg_name ? g_string_chunk_insert_const (new_data->strings, item->vg_name) : NULL;
+        item->vg_uuid = item->vg_uuid ? g_string_chunk_insert_const (new_data->strings, item->vg_uuid) : NULL;
+    }
+
+    return new_data;
+}
+
+BDLVMPVdata* bd_lvm_pvdata_array_get_item (BDLVMPVdataArray *data, guint64 index) {
+    if (index >= data->n_items)
+        return NULL;
+    return data->items + index;
+}
+
+void bd_lvm_vgdata_array_free (BDLVMVGdataArray *data) {
+    if (data->strings)
+        g_string_chunk_free (data->strings);
+    g_free (data);
+}
+
+BDLVMVGdataArray* bd_lvm_vgdata_array_copy (BDLVMVGdataArray *data) {
+    BDLVMVGdataArray *new_data = g_malloc0 (sizeof (BDLVMVGdataArray) + data->n_items * sizeof (BDLVMVGdata));
+    BDLVMVGdata *item = NULL;
+    guint64 i = 0;
+
+    if (data->n_items == 0)
+        return new_data;
+
+    new_data->items = (BDLVMVGdata *) (new_data + 1);
+    new_data->n_items = data->n_items;
+    new_data->strings = g_string_chunk_new (1024);
+    for (i=0; i < data->n_items; i++) {
+        item = new_data->items + i;
+        *item = data->items[i];
+        /* the strings have to point into the new arena */
+        item->name = item->name ? g_string_chunk_insert_const (new_data->strings, item->name) : NULL;
+        item->uuid = item->uuid ? g_string_chunk_insert_const (new_data->strings, item->uuid) : NULL;
+    }
+
+    return new_data;
+}
+
+BDLVMVGdata* bd_lvm_vgdata_array_get_item (BDLVMVGdataArray *data, guint64 index) {
+    if (index >= data->n_items)
+        return NULL;
+    return data->items + index;
+}
+
+void bd_lvm_lvdata_array_free (BDLVMLVdataArray *data) {
+    if (data->strings)
+        g_string_chunk_free (data->strings);
+    g_free (data);
+}
+
+BDLVMLVdataArray* bd_lvm_lvdata_array_copy (BDLVMLVdataArray *data) {
+    BDLVMLVdataArray *new_data = g_malloc0 (sizeof (BDLVMLVdataArray) + data->n_items * sizeof (BDLVMLVdata));
+    BDLVMLVdata *item = NULL;
+    guint64 i = 0;
+
+    if (data->n_items == 0)
+        return new_data;
+
+    new_data->items = (BDLVMLVdata *) (new_data + 1);
+    new_data->n_items = data->n_items;
+    new_data->strings = g_string_chunk_new (1024);
+    for (i=0; i < data->n_items; i++) {
+        item = new_data->items + i;
+        *item = data->items[i];
+        /* the strings have to point into the new arena */
+        item->lv_name = item->lv_name ? g_string_chunk_insert_const (new_data->strings, item->lv_name) : NULL;
+        item->vg_name = item->vg_name ? g_string_chunk_insert_const (new_data->strings, item->vg_name) : NULL;
+        item->uuid = item->uuid ? g_string_chunk_insert_const (new_data->strings, item->uuid) : NULL;
+        item->attr = item->attr ? g_string_chunk_insert_const (new_data->strings, item->attr) : NULL;
+        item->segtype = item->segtype ? g_string_chunk_insert_const (new_data->strings, item->segtype) : NULL;
+        item->origin = item->origin ? g_string_chunk_insert_const (new_data->strings, item->origin) : NULL;
+        item->pool_lv = item->pool_lv ? g_string_chunk_insert_const (new_data->strings, item->pool_lv) : NULL;
+        item->data_lv = item->data_lv ? g_string_chunk_insert_const (new_data->strings, item->data_lv) : NULL;
+        item->metadata_lv = item->metadata_lv ? g_string_chunk_insert_const (new_data->strings, item->metadata_lv) : NULL;
+        item->devices = item->devices ? g_string_chunk_insert_const (new_data->strings, item->devices) : NULL;
+    }
+
+    return new_data;
+}
+
+BDLVMLVdata* bd_lvm_lvdata_array_get_item (BDLVMLVdataArray *data, guint64 index) {
+    if (index >= data->n_items)
+        return NULL;
+    return data->items + index;
+}
+
+BDLVMActivationResult* bd_lvm_activation_result_copy (BDLVMActivationResult *data) {
+    BDLVMActivationResult *new_data = g_new0 (BDLVMActivationResult, 1);
+
+    new_data->name = g_strdup (data->name);
+    new_data->success = data->success;
+    new_data->error_message = g_strdup (data->error_message);
+    return new_data;
+}
+
+void bd_lvm_activation_result_free (BDLVMActivationResult *data) {
+    g_free (data->name);
+    g_free (data->error_message);
     g_free (data);
 }
 
@@ -138,6 +281,22 @@ void bd_lvm_cache_stats_free (BDLVMCacheStats *data) {
     g_free (data);
 }
 
+BDLVMWritecacheStats* bd_lvm_writecache_stats_copy (BDLVMWritecacheStats *data) {
+    BDLVMWritecacheStats *new = g_new0 (BDLVMWritecacheStats, 1);
+
+    new->block_size = data->block_size;
+    new->total_blocks = data->total_blocks;
+    new->free_blocks = data->free_blocks;
+    new->writeback_blocks = data->writeback_blocks;
+    new->error = data->error;
+
+    return new;
+}
+
+void bd_lvm_writecache_stats_free (BDLVMWritecacheStats *data) {
+    g_free (data);
+}
+
 static gchar const * const supported_functions[] = {
     "bd_lvm_is_supported_pe_size",
     "bd_lvm_get_max_lv_size",
@@ -169,9 +328,6 @@ static gboolean call_lvm_and_report_error (gchar **args, GError **error) {
     guint i = 0;
     guint args_length = g_strv_length (args);
 
-    /* don't allow global config string changes during the run */
-    g_mutex_lock (&global_config_lock);
-
     /* allocate enough space for the args plus "lvm", "--config" and NULL */
     gchar **argv = g_new0 (gchar*, args_length + 3);
 
@@ -179,11 +335,15 @@ static gboolean call_lvm_and_report_error (gchar **args, GError **error) {
     argv[0] = "lvm";
     for (i=0; i < args_length; i++)
         argv[i+1] = args[i];
+
+    /* don't allow global config string changes while it's being copied, the
+       run itself can happen in parallel with other runs */
+    g_mutex_lock (&global_config_lock);
     argv[args_length + 1] = global_config_str ? g_strdup_printf("--config=%s", global_config_str) : NULL;
+    g_mutex_unlock (&global_config_lock);
     argv[args_length + 2] = NULL;
 
     success = bd_utils_exec_and_report_error (argv, error);
-    g_mutex_unlock (&global_config_lock);
     g_free (argv[args_length + 1]);
     g_free (argv);
 
@@ -195,9 +355,6 @@ static gboolean call_lvm_and_capture_output (gchar **args, gchar **output, GErro
     guint i = 0;
     guint args_length = g_strv_length (args);
 
-    /* don't allow global config string changes during the run */
-    g_mutex_lock (&global_config_lock);
-
     /* allocate enough space for the args plus "lvm", "--config" and NULL */
     gchar **argv = g_new0 (gchar*, args_length + 3);
 
@@ -205,11 +362,15 @@ static gboolean call_lvm_and_capture_output (gchar **args, gchar **output, GErro
     argv[0] = "lvm";
     for (i=0; i < args_length; i++)
         argv[i+1] = args[i];
+
+    /* don't allow global config string changes while it's being copied, the
+       run itself can happen in parallel with other runs */
+    g_mutex_lock (&global_config_lock);
     argv[args_length + 1] = global_config_str ? g_strdup_printf("--config=%s", global_config_str) : NULL;
+    g_mutex_unlock (&global_config_lock);
     argv[args_length + 2] = NULL;
 
     success = bd_utils_exec_and_capture_output (argv, output, error);
-    g_mutex_unlock (&global_config_lock);
     g_free (argv[args_length + 1]);
     g_free (argv);
 
@@ -384,6 +545,182 @@ static BDLVMLVdata* get_lv_data_from_table (GHashTable *table, gboolean free_tab
     return data;
 }
 
+/**
+ * next_lvm_var: (skip)
+ * @line: (inout): pointer to the (rest of the) line to parse
+ * @key: (out): place to store the key of the parsed item
+ * @value: (out): place to store the value of the parsed item
+ *
+ * Allocation-free counterpart of parse_lvm_vars() that parses the next
+ * KEY=VALUE item from @line. The strings are terminated in place (i.e. @line is
+ * modified) and items without the '=' character are skipped.
+ *
+ * Returns: whether an item was found or not
+ */
+static gboolean next_lvm_var (gchar **line, gchar **key, gchar **value) {
+    gchar *item = *line;
+    gchar *end = NULL;
+    gchar *eq = NULL;
+
+    while (TRUE) {
+        item += strspn (item, " \t");
+        if (*item == '\0')
+            return FALSE;
+
+        end = item + strcspn (item, " \t");
+        if (*end != '\0') {
+            *end = '\0';
+            *line = end + 1;
+        } else
+            *line = end;
+
+        eq = strchr (item, '=');
+        if (eq) {
+            *eq = '\0';
+            *key = item;
+            *value = eq + 1;
+            return TRUE;
+        }
+        item = *line;
+    }
+}
+
+typedef gboolean (*LVMFieldSetter) (gpointer item, const gchar *key, const gchar *value, GStringChunk *strings);
+
+/**
+ * parse_lvm_report_compact: (skip)
+ * @output: output of an LVM reporting command (modified in place)
+ * @header_size: size of the array header preceding the items
+ * @item_size: size of a single item
+ * @num_fields: number of fields a line has to have to be valid
+ * @set_field: function setting a field of an item from a KEY=VALUE pair
+ * @strings: arena to intern the string values in
+ * @num_items: (out): number of valid items parsed from @output
+ *
+ * Returns: (transfer full): a single block of memory holding the header
+ * (zeroed) followed by the @num_items parsed items
+ */
+static gpointer parse_lvm_report_compact (gchar *output, gsize header_size, gsize item_size, guint num_fields,
+                                          LVMFieldSetter set_field, GStringChunk *strings, guint64 *num_items) {
+    guint64 max_items = 1;
+    gchar *line = NULL;
+    gchar *next_line = NULL;
+    gchar *key = NULL;
+    gchar *value = NULL;
+    guint8 *block = NULL;
+    guint8 *item = NULL;
+    guint num_set = 0;
+
+    /* one item per line at most */
+    for (line=output; *line; line++)
+        if (*line == '\n')
+            max_items++;
+
+    block = g_malloc0 (header_size + max_items * item_size);
+    item = block + header_size;
+    *num_items = 0;
+
+    for (line=output; line; line=next_line) {
+        next_line = strchr (line, '\n');
+        if (next_line)
+            *(next_line++) = '\0';
+
+        num_set = 0;
+        while (next_lvm_var (&line, &key, &value))
+            if (set_field (item, key, value, strings))
+                num_set++;
+
+        if (num_set == num_fields) {
+            /* valid line, keep the item */
+            item += item_size;
+            (*num_items)++;
+        } else
+            /* invalid line, reuse the item for the next one */
+            memset (item, 0, item_size);
+    }
+
+    return block;
+}
+
+static gboolean set_pv_field (gpointer item, const gchar *key, const gchar *value, GStringChunk *strings) {
+    BDLVMPVdata *data = (BDLVMPVdata *) item;
+
+    if (g_strcmp0 (key, "LVM2_PV_NAME") == 0)
+        data->pv_name = g_string_chunk_insert_const (strings, value);
+    else if (g_strcmp0 (key, "LVM2_PV_UUID") == 0)
+        data->pv_uuid = g_string_chunk_insert_const (strings, value);
+    else if (g_strcmp0 (key, "LVM2_PV_FREE") == 0)
+        data->pv_free = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_PE_START") == 0)
+        data->pe_start = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_VG_NAME") == 0)
+        data->vg_name = g_string_chunk_insert_const (strings, value);
+    else if (g_strcmp0 (key, "LVM2_VG_UUID") == 0)
+        data->vg_uuid = g_string_chunk_insert_const (strings, value);
+    else if (g_strcmp0 (key, "LVM2_VG_SIZE") == 0)
+        data->vg_size = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_VG_FREE") == 0)
+        data->vg_free = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_VG_EXTENT_SIZE") == 0)
+        data->vg_extent_size = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_VG_EXTENT_COUNT") == 0)
+        data->vg_extent_count = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_VG_FREE_COUNT") == 0)
+        data->vg_free_count = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_PV_COUNT") == 0)
+        data->vg_pv_count = g_ascii_strtoull (value, NULL, 0);
+    else
+        return FALSE;
+
+    return TRUE;
+}
+
+static gboolean set_vg_field (gpointer item, const gchar *key, const gchar *value, GStringChunk *strings) {
+    BDLVMVGdata *data = (BDLVMVGdata *) item;
+
+    if (g_strcmp0 (key, "LVM2_VG_NAME") == 0)
+        data->name = g_string_chunk_insert_const (strings, value);
+    else if (g_strcmp0 (key, "LVM2_VG_UUID") == 0)
+        data->uuid = g_string_chunk_insert_const (strings, value);
+    else if (g_strcmp0 (key, "LVM2_VG_SIZE") == 0)
+        data->size = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_VG_FREE") == 0)
+        data->free = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_VG_EXTENT_SIZE") == 0)
+        data->extent_size = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_VG_EXTENT_COUNT") == 0)
+        data->extent_count = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_VG_FREE_COUNT") == 0)
+        data->free_count = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_PV_COUNT") == 0)
+        data->pv_count = g_ascii_strtoull (value, NULL, 0);
+    else
+        return FALSE;
+
+    return TRUE;
+}
+
+static gboolean set_lv_field (gpointer item, const gchar *key, const gchar *value, GStringChunk *strings) {
+    BDLVMLVdata *data = (BDLVMLVdata *) item;
+
+    if (g_strcmp0 (key, "LVM2_LV_NAME") == 0)
+        data->lv_name = g_string_chunk_insert_const (strings, value);
+    else if (g_strcmp0 (key, "LVM2_VG_NAME") == 0)
+        data->vg_name = g_string_chunk_insert_const (strings, value);
+    else if (g_strcmp0 (key, "LVM2_LV_UUID") == 0)
+        data->uuid = g_string_chunk_insert_const (strings, value);
+    else if (g_strcmp0 (key, "LVM2_LV_SIZE") == 0)
+        data->size = g_ascii_strtoull (value, NULL, 0);
+    else if (g_strcmp0 (key, "LVM2_LV_ATTR") == 0)
+        data->attr = g_string_chunk_insert_const (strings, value);
+    else if (g_strcmp0 (key, "LVM2_SEGTYPE") == 0)
+        data->segtype = g_string_chunk_insert_const (strings, value);
+    else
+        return FALSE;
+
+    return TRUE;
+}
+
 /**
  * bd_lvm_is_supported_pe_size:
  * @size: size (in bytes) to test
@@ -772,6 +1109,63 @@ BDLVMPVdata** bd_lvm_pvs (GError **error) {
     return ret;
 }
 
+/**
+ * bd_lvm_pvs_compact:
+ * @error: (out): place to store error (if any)
+ *
+ * Compact variant of bd_lvm_pvs() that stores all the results in one
+ * contiguous array and interns all the strings in a single arena which makes
+ * the result cheap to allocate, iterate over and free. The items (and their
+ * strings) are owned by the returned array and must not be freed separately.
+ *
+ * Returns: (transfer full): information about PVs found in the system (to be
+ * freed with bd_lvm_pvdata_array_free()) or %NULL in case of error
+ */
+BDLVMPVdataArray* bd_lvm_pvs_compact (GError **error) {
+    gchar *args[9] = {"pvs", "--unit=b", "--nosuffix", "--nameprefixes",
+                       "--unquoted", "--noheadings",
+                       "-o", "pv_name,pv_uuid,pv_free,pe_start,vg_name,vg_uuid,vg_size," \
+                       "vg_free,vg_extent_size,vg_extent_count,vg_free_count,pv_count",
+                       NULL};
+    gboolean success = FALSE;
+    gchar *output = NULL;
+    GStringChunk *strings = NULL;
+    BDLVMPVdataArray *ret = NULL;
+    guint64 num_items = 0;
+
+    success = call_lvm_and_capture_output (args, &output, error);
+    if (!success) {
+        if (g_error_matches (*error, BD_UTILS_EXEC_ERROR, BD_UTILS_EXEC_ERROR_NOOUT)) {
+            /* no output => no PVs, not an error */
+            g_clear_error (error);
+            return g_new0 (BDLVMPVdataArray, 1);
+        }
+        else
+            /* the error is already populated from the call */
+            return NULL;
+    }
+
+    /* the interned strings can never take more space than the output itself */
+    strings = g_string_chunk_new (strlen (output) + 1);
+    ret = parse_lvm_report_compact (output, sizeof (BDLVMPVdataArray), sizeof (BDLVMPVdata), 12,
+                                    set_pv_field, strings, &num_items);
+    g_free (output);
+
+    if (num_items == 0) {
+        g_string_chunk_free (strings);
+        g_free (ret);
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_PARSE,
+                     "Failed to parse information about PVs");
+        return NULL;
+    }
+
+    ret->items = (BDLVMPVdata *) (ret + 1);
+    ret->n_items = num_items;
+    ret->strings = strings;
+
+    return ret;
+}
+
 /**
  * bd_lvm_vgcreate:
  * @name: name of the newly created VG
@@ -999,6 +1393,62 @@ BDLVMVGdata** bd_lvm_vgs (GError **error) {
     return ret;
 }
 
+/**
+ * bd_lvm_vgs_compact:
+ * @error: (out): place to store error (if any)
+ *
+ * Compact variant of bd_lvm_vgs() that stores all the results in one
+ * contiguous array and interns all the strings in a single arena which makes
+ * the result cheap to allocate, iterate over and free. The items (and their
+ * strings) are owned by the returned array and must not be freed separately.
+ *
+ * Returns: (transfer full): information about VGs found in the system (to be
+ * freed with bd_lvm_vgdata_array_free()) or %NULL in case of error
+ */
+BDLVMVGdataArray* bd_lvm_vgs_compact (GError **error) {
+    gchar *args[9] = {"vgs", "--noheadings", "--nosuffix", "--nameprefixes",
+                      "--unquoted", "--units=b",
+                      "-o", "name,uuid,size,free,extent_size,extent_count,free_count,pv_count",
+                      NULL};
+    gboolean success = FALSE;
+    gchar *output = NULL;
+    GStringChunk *strings = NULL;
+    BDLVMVGdataArray *ret = NULL;
+    guint64 num_items = 0;
+
+    success = call_lvm_and_capture_output (args, &output, error);
+    if (!success) {
+        if (g_error_matches (*error, BD_UTILS_EXEC_ERROR, BD_UTILS_EXEC_ERROR_NOOUT)) {
+            /* no output => no VGs, not an error */
+            g_clear_error (error);
+            return g_new0 (BDLVMVGdataArray, 1);
+        }
+        else
+            /* the error is already populated from the call */
+            return NULL;
+    }
+
+    /* the interned strings can never take more space than the output itself */
+    strings = g_string_chunk_new (strlen (output) + 1);
+    ret = parse_lvm_report_compact (output, sizeof (BDLVMVGdataArray), sizeof (BDLVMVGdata), 8,
+                                    set_vg_field, strings, &num_items);
+    g_free (output);
+
+    if (num_items == 0) {
+        g_string_chunk_free (strings);
+        g_free (ret);
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_PARSE,
+                     "Failed to parse information about VGs");
+        return NULL;
+    }
+
+    ret->items = (BDLVMVGdata *) (ret + 1);
+    ret->n_items = num_items;
+    ret->strings = strings;
+
+    return ret;
+}
+
 /**
  * bd_lvm_lvorigin:
  * @vg_name: name of the VG containing the queried LV
@@ -1174,74 +1624,475 @@ gboolean bd_lvm_lvdeactivate (gchar *vg_name, gchar *lv_name, GError **error) {
     return success;
 }
 
+/* extended LV fields and their names in the lvs command line */
+static const struct {
+    BDLVMLVFields field;
+    const gchar *name;
+} lv_ex_fields[] = {
+    {BD_LVM_LV_FIELD_ORIGIN, "origin"},
+    {BD_LVM_LV_FIELD_POOL_LV, "pool_lv"},
+    {BD_LVM_LV_FIELD_DATA_LV, "data_lv"},
+    {BD_LVM_LV_FIELD_METADATA_LV, "metadata_lv"},
+    {BD_LVM_LV_FIELD_DATA_PERCENT, "data_percent"},
+    {BD_LVM_LV_FIELD_METADATA_PERCENT, "metadata_percent"},
+    {BD_LVM_LV_FIELD_DEVICES, "devices"},
+    {BD_LVM_LV_FIELD_STRIPES, "stripes"},
+    {BD_LVM_LV_FIELD_STRIPE_SIZE, "stripe_size"},
+};
+
 /**
- * bd_lvm_lvsnapshotcreate:
- * @vg_name: name of the VG containing the LV a new snapshot should be created of
- * @origin_name: name of the LV a new snapshot should be created of
- * @snapshot_name: name fo the to-be-created snapshot
- * @size: requested size for the snapshot
- * @error: (out): place to store error (if any)
+ * get_lv_name_from_table: (skip)
  *
- * Returns: whether the @snapshot_name snapshot of the @vg_name/@origin_name LV
- * was successfully created or not.
+ * Returns: (transfer full): LV name stored under @key in @table with the '['
+ *                           and ']' (marking the LV as internal) removed
  */
-gboolean bd_lvm_lvsnapshotcreate (gchar *vg_name, gchar *origin_name, gchar *snapshot_name, guint64 size, GError **error) {
-    gchar *args[8] = {"lvcreate", "-s", "-L", NULL, "-n", snapshot_name, NULL, NULL};
-    gboolean success = FALSE;
+static gchar* get_lv_name_from_table (GHashTable *table, const gchar *key) {
+    gchar *value = g_strdup ((gchar*) g_hash_table_lookup (table, key));
 
-    args[3] = g_strdup_printf ("%"G_GUINT64_FORMAT"b", size);
-    args[6] = g_strdup_printf ("%s/%s", vg_name, origin_name);
-
-    success = call_lvm_and_report_error (args, error);
-    g_free (args[3]);
-    g_free (args[6]);
+    if (!value)
+        return NULL;
 
-    return success;
+    return g_strstrip (g_strdelimit (value, "[]", ' '));
 }
 
-/**
- * bd_lvm_lvsnapshotmerge:
- * @vg_name: name of the VG containing the to-be-merged LV snapshot
- * @snapshot_name: name of the to-be-merged LV snapshot
- * @error: (out): place to store error (if any)
- *
- * Returns: whether the @vg_name/@snapshot_name LV snapshot was successfully merged or not
- */
-gboolean bd_lvm_lvsnapshotmerge (gchar *vg_name, gchar *snapshot_name, GError **error) {
-    gchar *args[4] = {"lvconvert", "--merge", NULL, NULL};
-    gboolean success = FALSE;
+static BDLVMLVdata* get_lv_ex_data_from_table (GHashTable *table, BDLVMLVFields fields) {
+    BDLVMLVdata *data = get_lv_data_from_table (table, FALSE);
+    gchar *value = NULL;
 
-    args[2] = g_strdup_printf ("%s/%s", vg_name, snapshot_name);
+    if (fields & BD_LVM_LV_FIELD_ORIGIN)
+        data->origin = get_lv_name_from_table (table, "LVM2_ORIGIN");
+    if (fields & BD_LVM_LV_FIELD_POOL_LV)
+        data->pool_lv = get_lv_name_from_table (table, "LVM2_POOL_LV");
+    if (fields & BD_LVM_LV_FIELD_DATA_LV)
+        data->data_lv = get_lv_name_from_table (table, "LVM2_DATA_LV");
+    if (fields & BD_LVM_LV_FIELD_METADATA_LV)
+        data->metadata_lv = get_lv_name_from_table (table, "LVM2_METADATA_LV");
 
-    success = call_lvm_and_report_error (args, error);
-    g_free (args[2]);
+    value = (gchar*) g_hash_table_lookup (table, "LVM2_DATA_PERCENT");
+    if (value && (fields & BD_LVM_LV_FIELD_DATA_PERCENT))
+        data->data_percent = g_ascii_strtod (value, NULL);
 
-    return success;
+    value = (gchar*) g_hash_table_lookup (table, "LVM2_METADATA_PERCENT");
+    if (value && (fields & BD_LVM_LV_FIELD_METADATA_PERCENT))
+        data->metadata_percent = g_ascii_strtod (value, NULL);
+
+    if (fields & BD_LVM_LV_FIELD_DEVICES)
+        data->devices = g_strdup ((gchar*) g_hash_table_lookup (table, "LVM2_DEVICES"));
+
+    value = (gchar*) g_hash_table_lookup (table, "LVM2_STRIPES");
+    if (value && (fields & BD_LVM_LV_FIELD_STRIPES))
+        data->stripes = g_ascii_strtoull (value, NULL, 0);
+
+    value = (gchar*) g_hash_table_lookup (table, "LVM2_STRIPE_SIZE");
+    if (value && (fields & BD_LVM_LV_FIELD_STRIPE_SIZE))
+        data->stripe_size = g_ascii_strtoull (value, NULL, 0);
+
+    g_hash_table_destroy (table);
+
+    return data;
 }
 
 /**
- * bd_lvm_lvinfo:
- * @vg_name: name of the VG that contains the LV to get information about
- * @lv_name: name of the LV to get information about
+ * bd_lvm_lvs_ex:
+ * @vg_name: (allow-none): name of the VG to get information about LVs from
+ * @fields: a combination of (ORed) #BDLVMLVFields to get on top of the basic
+ *          information about the LVs
  * @error: (out): place to store error (if any)
  *
- * Returns: (transfer full): information about the @vg_name/@lv_name LV or %NULL in case
- * of error (the @error) gets populated in those cases)
+ * Returns: (array zero-terminated=1): information about LVs found in the given
+ * @vg_name VG or in system if @vg_name is %NULL including the extended fields
+ * requested by @fields
+ *
+ * All the information is gathered by a single lvs run. Extended fields not
+ * requested by @fields are left unset (%NULL or 0). For LVs with multiple
+ * segments, the devices of all segments are reported (comma-separated) and the
+ * stripes and stripe size of the first segment.
  */
-BDLVMLVdata* bd_lvm_lvinfo (gchar *vg_name, gchar *lv_name, GError **error) {
+BDLVMLVdata** bd_lvm_lvs_ex (gchar *vg_name, BDLVMLVFields fields, GError **error) {
     gchar *args[11] = {"lvs", "--noheadings", "--nosuffix", "--nameprefixes",
                        "--unquoted", "--units=b", "-a",
-                       "-o", "vg_name,lv_name,lv_uuid,lv_size,lv_attr,segtype",
-                       NULL, NULL};
-
+                       "-o", NULL, NULL, NULL};
+    GString *fields_str = g_string_new ("vg_name,lv_name,lv_uuid,lv_size,lv_attr,segtype");
+    guint num_fields = 6;
     GHashTable *table = NULL;
     gboolean success = FALSE;
     gchar *output = NULL;
     gchar **lines = NULL;
     gchar **lines_p = NULL;
     guint num_items;
-
-    args[9] = g_strdup_printf ("%s/%s", vg_name, lv_name);
+    GPtrArray *lvs = g_ptr_array_new ();
+    BDLVMLVdata *lvdata = NULL;
+    BDLVMLVdata *prev_lvdata = NULL;
+    BDLVMLVdata **ret = NULL;
+    gchar *devices = NULL;
+    guint64 i = 0;
+
+    /* only ask lvs for the requested fields */
+    for (i=0; i < G_N_ELEMENTS (lv_ex_fields); i++)
+        if (fields & lv_ex_fields[i].field) {
+            g_string_append_printf (fields_str, ",%s", lv_ex_fields[i].name);
+            num_fields++;
+        }
+    args[8] = fields_str->str;
+
+    if (vg_name)
+        args[9] = vg_name;
+
+    success = call_lvm_and_capture_output (args, &output, error);
+    g_string_free (fields_str, TRUE);
+
+    if (!success) {
+        if (g_error_matches (*error, BD_UTILS_EXEC_ERROR, BD_UTILS_EXEC_ERROR_NOOUT)) {
+            /* no output => no LVs, not an error */
+            g_clear_error (error);
+            ret = g_new0 (BDLVMLVdata*, 1);
+            ret[0] = NULL;
+            return ret;
+        }
+        else
+            /* the error is already populated from the call */
+            return NULL;
+    }
+
+    lines = g_strsplit (output, "\n", 0);
+    g_free (output);
+
+    for (lines_p = lines; *lines_p; lines_p++) {
+        table = parse_lvm_vars ((*lines_p), &num_items);
+        if (table && (num_items == num_fields)) {
+            /* valid line, try to parse and record it */
+            lvdata = get_lv_ex_data_from_table (table, fields);
+            if (prev_lvdata && (g_strcmp0 (prev_lvdata->uuid, lvdata->uuid) == 0)) {
+                /* another segment of the same LV (segment fields like segtype
+                   or devices make lvs report one line per segment) */
+                if (lvdata->devices && (g_strcmp0 (lvdata->devices, "") != 0)) {
+                    if (prev_lvdata->devices && (g_strcmp0 (prev_lvdata->devices, "") != 0))
+                        devices = g_strjoin (",", prev_lvdata->devices, lvdata->devices, NULL);
+                    else
+                        devices = g_strdup (lvdata->devices);
+                    g_free (prev_lvdata->devices);
+                    prev_lvdata->devices = devices;
+                }
+                bd_lvm_lvdata_free (lvdata);
+            } else {
+                g_ptr_array_add (lvs, lvdata);
+                prev_lvdata = lvdata;
+            }
+        } else
+            if (table)
+                g_hash_table_destroy (table);
+    }
+
+    g_strfreev (lines);
+
+    if (lvs->len == 0) {
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_PARSE,
+                     "Failed to parse information about LVs");
+        g_ptr_array_free (lvs, TRUE);
+        return NULL;
+    }
+
+    /* now create the return value -- NULL-terminated array of BDLVMLVdata */
+    ret = g_new0 (BDLVMLVdata*, lvs->len + 1);
+    for (i=0; i < lvs->len; i++)
+        ret[i] = (BDLVMLVdata*) g_ptr_array_index (lvs, i);
+    ret[i] = NULL;
+
+    g_ptr_array_free (lvs, FALSE);
+
+    return ret;
+}
+
+/**
+ * bd_lvm_lvs_compact:
+ * @vg_name: (allow-none): name of the VG to get information about LVs from
+ * @error: (out): place to store error (if any)
+ *
+ * Compact variant of bd_lvm_lvs() that stores all the results in one
+ * contiguous array and interns all the strings in a single arena which makes
+ * the result cheap to allocate, iterate over and free. The items (and their
+ * strings) are owned by the returned array and must not be freed separately.
+ *
+ * Returns: (transfer full): information about LVs found in the given
+ * @vg_name VG or in system if @vg_name is %NULL (to be freed with
+ * bd_lvm_lvdata_array_free()) or %NULL in case of error
+ */
+BDLVMLVdataArray* bd_lvm_lvs_compact (gchar *vg_name, GError **error) {
+    gchar *args[11] = {"lvs", "--noheadings", "--nosuffix", "--nameprefixes",
+                       "--unquoted", "--units=b", "-a",
+                       "-o", "vg_name,lv_name,lv_uuid,lv_size,lv_attr,segtype",
+                       NULL, NULL};
+    gboolean success = FALSE;
+    gchar *output = NULL;
+    GStringChunk *strings = NULL;
+    BDLVMLVdataArray *ret = NULL;
+    guint64 num_items = 0;
+
+    if (vg_name)
+        args[9] = vg_name;
+
+    success = call_lvm_and_capture_output (args, &output, error);
+    if (!success) {
+        if (g_error_matches (*error, BD_UTILS_EXEC_ERROR, BD_UTILS_EXEC_ERROR_NOOUT)) {
+            /* no output => no LVs, not an error */
+            g_clear_error (error);
+            return g_new0 (BDLVMLVdataArray, 1);
+        }
+        else
+            /* the error is already populated from the call */
+            return NULL;
+    }
+
+    /* the interned strings can never take more space than the output itself */
+    strings = g_string_chunk_new (strlen (output) + 1);
+    ret = parse_lvm_report_compact (output, sizeof (BDLVMLVdataArray), sizeof (BDLVMLVdata), 6,
+                                    set_lv_field, strings, &num_items);
+    g_free (output);
+
+    if (num_items == 0) {
+        g_string_chunk_free (strings);
+        g_free (ret);
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_PARSE,
+                     "Failed to parse information about LVs");
+        return NULL;
+    }
+
+    ret->items = (BDLVMLVdata *) (ret + 1);
+    ret->n_items = num_items;
+    ret->strings = strings;
+
+    return ret;
+}
+
+/* one lvm run activating (LVs from) a single VG */
+typedef struct ActivationGroup {
+    gchar *vg_name;
+    gboolean whole_vg;
+    /* BDLVMActivationResult items belonging to this group (not owned) */
+    GPtrArray *items;
+} ActivationGroup;
+
+static void activation_group_free (ActivationGroup *group) {
+    g_free (group->vg_name);
+    g_ptr_array_free (group->items, TRUE);
+    g_free (group);
+}
+
+static void set_activation_result (BDLVMActivationResult *item, gboolean success, GError *error) {
+    item->success = success;
+    g_free (item->error_message);
+    item->error_message = (!success && error) ? g_strdup (error->message) : NULL;
+}
+
+static void activate_group (gpointer data, gpointer user_data) {
+    ActivationGroup *group = (ActivationGroup *) data;
+    gboolean ignore_skip = *((gboolean *) user_data);
+    BDLVMActivationResult *item = NULL;
+    gchar **args = NULL;
+    gchar **lv_spec = NULL;
+    guint next_arg = 0;
+    guint i = 0;
+    gboolean success = FALSE;
+    GError *error = NULL;
+
+    /* "lvchange", "-ay", "-K", the LVs (or the VG for "vgchange") and NULL */
+    args = g_new0 (gchar*, group->items->len + 4);
+    args[next_arg++] = group->whole_vg ? "vgchange" : "lvchange";
+    args[next_arg++] = "-ay";
+    if (ignore_skip)
+        args[next_arg++] = "-K";
+    if (group->whole_vg)
+        /* activating the whole VG covers all the LVs from it too */
+        args[next_arg++] = group->vg_name;
+    else
+        for (i=0; i < group->items->len; i++) {
+            item = (BDLVMActivationResult *) g_ptr_array_index (group->items, i);
+            args[next_arg++] = item->name;
+        }
+    args[next_arg] = NULL;
+
+    success = call_lvm_and_report_error (args, &error);
+    g_free (args);
+
+    if (success || group->items->len == 1) {
+        for (i=0; i < group->items->len; i++)
+            set_activation_result ((BDLVMActivationResult *) g_ptr_array_index (group->items, i), success, error);
+        g_clear_error (&error);
+        return;
+    }
+
+    /* the batch failed, activate the LVs one by one to find out which of them
+       are the problematic ones (and to activate the rest) */
+    for (i=0; i < group->items->len; i++) {
+        item = (BDLVMActivationResult *) g_ptr_array_index (group->items, i);
+        lv_spec = g_strsplit (item->name, "/", 2);
+        if (!lv_spec[1]) {
+            /* the whole VG */
+            set_activation_result (item, FALSE, error);
+        } else {
+            GError *lv_error = NULL;
+            success = bd_lvm_lvactivate (lv_spec[0], lv_spec[1], ignore_skip, &lv_error);
+            set_activation_result (item, success, lv_error);
+            g_clear_error (&lv_error);
+        }
+        g_strfreev (lv_spec);
+    }
+    g_clear_error (&error);
+}
+
+/**
+ * bd_lvm_activate_many:
+ * @names: (array zero-terminated=1): list of VGs ("VG") and LVs ("VG/LV") to activate
+ * @ignore_skip: whether to ignore the skip flag or not
+ * @max_jobs: maximum number of VGs to process in parallel or 0 to use the
+ *            number of CPUs
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (array zero-terminated=1) (transfer full): results of the activation
+ *          of the items from @names (in the same order) or %NULL in case of
+ *          error (invalid @names)
+ *
+ * All LVs from a single VG are activated by one lvm run and independent VGs
+ * are processed in parallel. Failure to activate some of the @names is not
+ * reported via @error, but in the respective items of the result.
+ */
+BDLVMActivationResult** bd_lvm_activate_many (gchar **names, gboolean ignore_skip, guint max_jobs, GError **error) {
+    guint n_names = names ? g_strv_length (names) : 0;
+    BDLVMActivationResult **ret = NULL;
+    GHashTable *groups_table = NULL;
+    GPtrArray *groups = NULL;
+    ActivationGroup *group = NULL;
+    GThreadPool *pool = NULL;
+    gchar **spec = NULL;
+    guint i = 0;
+
+    /* validate the names first so that nothing is activated if they are not valid */
+    for (i=0; i < n_names; i++) {
+        spec = g_strsplit (names[i], "/", 2);
+        if (!spec[0] || (g_strcmp0 (spec[0], "") == 0) || (spec[1] && ((g_strcmp0 (spec[1], "") == 0) || strchr (spec[1], '/')))) {
+            g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_PARSE,
+                         "Invalid VG or LV specification: '%s'", names[i]);
+            g_strfreev (spec);
+            return NULL;
+        }
+        g_strfreev (spec);
+    }
+
+    ret = g_new0 (BDLVMActivationResult*, n_names + 1);
+    groups_table = g_hash_table_new (g_str_hash, g_str_equal);
+    groups = g_ptr_array_new_with_free_func ((GDestroyNotify) activation_group_free);
+
+    for (i=0; i < n_names; i++) {
+        ret[i] = g_new0 (BDLVMActivationResult, 1);
+        ret[i]->name = g_strdup (names[i]);
+
+        spec = g_strsplit (names[i], "/", 2);
+        group = g_hash_table_lookup (groups_table, spec[0]);
+        if (!group) {
+            group = g_new0 (ActivationGroup, 1);
+            group->vg_name = g_strdup (spec[0]);
+            group->items = g_ptr_array_new ();
+            g_hash_table_insert (groups_table, group->vg_name, group);
+            g_ptr_array_add (groups, group);
+        }
+        if (!spec[1])
+            group->whole_vg = TRUE;
+        g_ptr_array_add (group->items, ret[i]);
+        g_strfreev (spec);
+    }
+    ret[n_names] = NULL;
+
+    if (max_jobs == 0)
+        max_jobs = g_get_num_processors ();
+
+    if (groups->len > 1 && max_jobs > 1) {
+        pool = g_thread_pool_new (activate_group, &ignore_skip, MIN (max_jobs, groups->len), TRUE, NULL);
+        if (pool) {
+            for (i=0; i < groups->len; i++)
+                g_thread_pool_push (pool, g_ptr_array_index (groups, i), NULL);
+            /* wait for all the jobs to finish */
+            g_thread_pool_free (pool, FALSE, TRUE);
+        }
+    }
+    if (!pool)
+        /* sequential processing (not needed or failed to create the threads) */
+        for (i=0; i < groups->len; i++)
+            activate_group (g_ptr_array_index (groups, i), &ignore_skip);
+
+    g_hash_table_destroy (groups_table);
+    g_ptr_array_free (groups, TRUE);
+
+    return ret;
+}
+
+/**
+ * bd_lvm_lvsnapshotcreate:
+ * @vg_name: name of the VG containing the LV a new snapshot should be created of
+ * @origin_name: name of the LV a new snapshot should be created of
+ * @snapshot_name: name fo the to-be-created snapshot
+ * @size: requested size for the snapshot
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: whether the @snapshot_name snapshot of the @vg_name/@origin_name LV
+ * was successfully created or not.
+ */
+gboolean bd_lvm_lvsnapshotcreate (gchar *vg_name, gchar *origin_name, gchar *snapshot_name, guint64 size, GError **error) {
+    gchar *args[8] = {"lvcreate", "-s", "-L", NULL, "-n", snapshot_name, NULL, NULL};
+    gboolean success = FALSE;
+
+    args[3] = g_strdup_printf ("%"G_GUINT64_FORMAT"b", size);
+    args[6] = g_strdup_printf ("%s/%s", vg_name, origin_name);
+
+    success = call_lvm_and_report_error (args, error);
+    g_free (args[3]);
+    g_free (args[6]);
+
+    return success;
+}
+
+/**
+ * bd_lvm_lvsnapshotmerge:
+ * @vg_name: name of the VG containing the to-be-merged LV snapshot
+ * @snapshot_name: name of the to-be-merged LV snapshot
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: whether the @vg_name/@snapshot_name LV snapshot was successfully merged or not
+ */
+gboolean bd_lvm_lvsnapshotmerge (gchar *vg_name, gchar *snapshot_name, GError **error) {
+    gchar *args[4] = {"lvconvert", "--merge", NULL, NULL};
+    gboolean success = FALSE;
+
+    args[2] = g_strdup_printf ("%s/%s", vg_name, snapshot_name);
+
+    success = call_lvm_and_report_error (args, error);
+    g_free (args[2]);
+
+    return success;
+}
+
+/**
+ * bd_lvm_lvinfo:
+ * @vg_name: name of the VG that contains the LV to get information about
+ * @lv_name: name of the LV to get information about
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: (transfer full): information about the @vg_name/@lv_name LV or %NULL in case
+ * of error (the @error) gets populated in those cases)
+ */
+BDLVMLVdata* bd_lvm_lvinfo (gchar *vg_name, gchar *lv_name, GError **error) {
+    gchar *args[11] = {"lvs", "--noheadings", "--nosuffix", "--nameprefixes",
+                       "--unquoted", "--units=b", "-a",
+                       "-o", "vg_name,lv_name,lv_uuid,lv_size,lv_attr,segtype",
+                       NULL, NULL};
+
+    GHashTable *table = NULL;
+    gboolean success = FALSE;
+    gchar *output = NULL;
+    gchar **lines = NULL;
+    gchar **lines_p = NULL;
+    guint num_items;
+
+    args[9] = g_strdup_printf ("%s/%s", vg_name, lv_name);
 
     success = call_lvm_and_capture_output (args, &output, error);
     g_free (args[9]);
@@ -1605,6 +2456,64 @@ BDLVMCacheMode bd_lvm_cache_get_mode_from_str (gchar *mode_str, GError **error)
     }
 }
 
+/**
+ * create_cache_pool_single_run: (skip)
+ *
+ * Creates a cache pool (including its metadata LV) by a single lvcreate run.
+ */
+static gboolean create_cache_pool_single_run (gchar *vg_name, gchar *pool_name, guint64 pool_size, guint64 md_size, BDLVMCacheMode mode, gchar **fast_pvs, GError **error) {
+    guint pv_list_len = fast_pvs ? g_strv_length (fast_pvs) : 0;
+    gchar **args = g_new0 (gchar*, pv_list_len + 14);
+    gchar *size_str = NULL;
+    gchar *md_size_str = NULL;
+    gboolean success = FALSE;
+    GError *l_error = NULL;
+    guint i = 0;
+    guint j = 0;
+
+    if (md_size == 0) {
+        md_size = bd_lvm_cache_get_default_md_size (pool_size, &l_error);
+        if (l_error) {
+            g_propagate_error (error, l_error);
+            g_prefix_error (error, "Failed to determine size for the pool metadata LV: ");
+            g_free (args);
+            return FALSE;
+        }
+    }
+
+    args[i++] = "lvcreate";
+    args[i++] = "-y";
+    args[i++] = "--type";
+    args[i++] = "cache-pool";
+    args[i++] = "-L";
+    size_str = g_strdup_printf ("%"G_GUINT64_FORMAT"K", pool_size/1024);
+    args[i++] = size_str;
+    args[i++] = "--poolmetadatasize";
+    md_size_str = g_strdup_printf ("%"G_GUINT64_FORMAT"K", md_size/1024);
+    args[i++] = md_size_str;
+    args[i++] = "--cachemode";
+    args[i++] = (gchar *) bd_lvm_cache_get_mode_str (mode, error);
+    if (!args[i-1]) {
+        g_free (size_str);
+        g_free (md_size_str);
+        g_free (args);
+        return FALSE;
+    }
+    args[i++] = "-n";
+    args[i++] = pool_name;
+    args[i++] = vg_name;
+    for (j=0; j < pv_list_len; j++)
+        args[i++] = fast_pvs[j];
+    args[i] = NULL;
+
+    success = call_lvm_and_report_error (args, error);
+    g_free (size_str);
+    g_free (md_size_str);
+    g_free (args);
+
+    return success;
+}
+
 /**
  * bd_lvm_cache_create_pool:
  * @vg_name: name of the VG to create @pool_name in
@@ -1619,12 +2528,30 @@ BDLVMCacheMode bd_lvm_cache_get_mode_from_str (gchar *mode_str, GError **error)
  * @error: (out): place to store error (if any)
  *
  * Returns: whether the cache pool @vg_name/@pool_name was successfully created or not
+ *
+ * If no @flags are given, the pool is first tried to be created by a single
+ * lvcreate run. If that fails, the pool is silently created step by step
+ * (the same way as with @flags given) and the error from the single run is
+ * only logged (at the debug level).
  */
 gboolean bd_lvm_cache_create_pool (gchar *vg_name, gchar *pool_name, guint64 pool_size, guint64 md_size, BDLVMCacheMode mode, BDLVMCachePoolFlags flags, gchar **fast_pvs, GError **error) {
     gboolean success = FALSE;
     gchar *type = NULL;
     gchar *name = NULL;
     gchar *args[10] = {"lvconvert", "-y", "--type", "cache-pool", "--poolmetadata", NULL, "--cachemode", NULL, NULL, NULL};
+    GError *l_error = NULL;
+
+    /* without any special requirements for the data and metadata LVs, the
+       whole pool can be created by a single lvcreate run */
+    if (flags == 0) {
+        if (create_cache_pool_single_run (vg_name, pool_name, pool_size, md_size, mode, fast_pvs, &l_error))
+            return TRUE;
+        else {
+            /* fall back to creating the pool step by step below */
+            g_debug ("Failed to create the cache pool by a single lvcreate run: %s", l_error->message);
+            g_clear_error (&l_error);
+        }
+    }
 
     /* create an LV for the pool */
     type = get_lv_type_from_flags (flags, FALSE, error);
@@ -1716,6 +2643,45 @@ gboolean bd_lvm_cache_detach (gchar *vg_name, gchar *cached_lv, gboolean destroy
     return success;
 }
 
+/**
+ * create_cached_lv_single_run: (skip)
+ *
+ * Creates a new data LV with the existing @pool_name cache pool attached to it
+ * by a single lvcreate run.
+ */
+static gboolean create_cached_lv_single_run (gchar *vg_name, gchar *lv_name, guint64 data_size, gchar *pool_name, gchar **slow_pvs, GError **error) {
+    guint pv_list_len = slow_pvs ? g_strv_length (slow_pvs) : 0;
+    gchar **args = g_new0 (gchar*, pv_list_len + 10);
+    gchar *size_str = NULL;
+    gchar *pool_str = NULL;
+    gboolean success = FALSE;
+    guint i = 0;
+    guint j = 0;
+
+    args[i++] = "lvcreate";
+    args[i++] = "-y";
+    args[i++] = "--type";
+    args[i++] = "cache";
+    args[i++] = "-n";
+    args[i++] = lv_name;
+    args[i++] = "-L";
+    size_str = g_strdup_printf ("%"G_GUINT64_FORMAT"K", data_size/1024);
+    args[i++] = size_str;
+    /* the pool given as "VG/POOL" means the data (origin) LV is created as part of the run */
+    pool_str = g_strdup_printf ("%s/%s", vg_name, pool_name);
+    args[i++] = pool_str;
+    for (j=0; j < pv_list_len; j++)
+        args[i++] = slow_pvs[j];
+    args[i] = NULL;
+
+    success = call_lvm_and_report_error (args, error);
+    g_free (size_str);
+    g_free (pool_str);
+    g_free (args);
+
+    return success;
+}
+
 /**
  * bd_lvm_cache_create_cached_lv:
  * @vg_name: name of the VG to create a cached LV in
@@ -1730,11 +2696,19 @@ gboolean bd_lvm_cache_detach (gchar *vg_name, gchar *cached_lv, gboolean destroy
  * @error: (out): place to store error (if any)
  *
  * Returns: whether the cached LV @lv_name was successfully created or not
+ *
+ * The data LV is created with the cache pool attached to it by a single
+ * lvcreate run. If no @flags are given, the cache pool is also created by a
+ * single lvcreate run (see bd_lvm_cache_create_pool()), so the whole cached LV
+ * takes just two lvm runs. If the single run for the data LV fails, the data
+ * LV is silently created and the cache pool attached to it in two steps and
+ * the error from the failed lvm run is only logged (at the debug level).
  */
 gboolean bd_lvm_cache_create_cached_lv (gchar *vg_name, gchar *lv_name, guint64 data_size, guint64 cache_size, guint64 md_size, BDLVMCacheMode mode, BDLVMCachePoolFlags flags,
                                         gchar **slow_pvs, gchar **fast_pvs, GError **error) {
     gboolean success = FALSE;
     gchar *name = NULL;
+    GError *l_error = NULL;
 
     name = g_strdup_printf ("%s_cache", lv_name);
     success = bd_lvm_cache_create_pool (vg_name, name, cache_size, md_size, mode, flags, fast_pvs, error);
@@ -1744,9 +2718,20 @@ gboolean bd_lvm_cache_create_cached_lv (gchar *vg_name, gchar *lv_name, guint64
         return FALSE;
     }
 
+    /* try to create the data LV and attach the cache pool to it in one step */
+    if (create_cached_lv_single_run (vg_name, lv_name, data_size, name, slow_pvs, &l_error)) {
+        g_free (name);
+        return TRUE;
+    } else {
+        /* fall back to doing it in two steps below */
+        g_debug ("Failed to create the cached LV by a single lvcreate run: %s", l_error->message);
+        g_clear_error (&l_error);
+    }
+
     success = bd_lvm_lvcreate (vg_name, lv_name, data_size, NULL, slow_pvs, error);
     if (!success) {
         g_prefix_error (error, "Failed to create the data LV: ");
+        g_free (name);
         return FALSE;
     }
 
@@ -1804,55 +2789,54 @@ gchar* bd_lvm_cache_pool_name (gchar *vg_name, gchar *cached_lv, GError **error)
 }
 
 /**
- * bd_lvm_cache_stats:
- * @vg_name: name of the VG containing the @cached_lv
- * @cached_lv: cached LV to get stats for
- * @error: (out): place to store error (if any)
+ * get_lv_target_params: (skip)
+ * @task_type: type of the DM task to run (%DM_DEVICE_STATUS or %DM_DEVICE_TABLE)
+ * @target_type: (out): place to store the type of the (first) target of the map
  *
- * Returns: stats for the @cached_lv or %NULL in case of error
+ * Returns: (transfer full): status or table parameters of the (first) target
+ *                           of the DM map backing the @vg_name/@lv_name LV or
+ *                           %NULL in case of error
  */
-BDLVMCacheStats* bd_lvm_cache_stats (gchar *vg_name, gchar *cached_lv, GError **error) {
+static gchar* get_lv_target_params (gchar *vg_name, gchar *lv_name, int task_type, gchar **target_type, GError **error) {
     struct dm_pool *pool = NULL;
     struct dm_task *task = NULL;
     struct dm_info info;
-    struct dm_status_cache *status = NULL;
     gchar *map_name = NULL;
     guint64 start = 0;
     guint64 length = 0;
     gchar *type = NULL;
     gchar *params = NULL;
-    BDLVMCacheStats *ret = NULL;
+    gchar *ret = NULL;
 
-    if (geteuid () != 0) {
-        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_NOT_ROOT,
-                     "Not running as root, cannot query DM maps");
+    pool = dm_pool_create("bd-pool", 20);
+    if (!pool) {
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_DM_ERROR,
+                     "Failed to create DM memory pool");
         return NULL;
     }
 
-    pool = dm_pool_create("bd-pool", 20);
-
     /* translate the VG+LV name into the DM map name */
-    map_name = dm_build_dm_name (pool, vg_name, cached_lv, NULL);
+    map_name = dm_build_dm_name (pool, vg_name, lv_name, NULL);
 
-    task = dm_task_create (DM_DEVICE_STATUS);
+    task = dm_task_create (task_type);
     if (!task) {
         g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_DM_ERROR,
-                     "Failed to create DM task for the cache map '%s': ", map_name);
+                     "Failed to create DM task for the map '%s'", map_name);
         dm_pool_destroy (pool);
         return NULL;
     }
 
     if (dm_task_set_name (task, map_name) == 0) {
         g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_DM_ERROR,
-                     "Failed to create DM task for the cache map '%s': ", map_name);
+                     "Failed to create DM task for the map '%s'", map_name);
         dm_task_destroy (task);
         dm_pool_destroy (pool);
         return NULL;
     }
 
-    if (dm_task_run(task) == 0) {
+    if (dm_task_run (task) == 0) {
         g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_DM_ERROR,
-                     "Failed to run the DM task for the cache map '%s': ", map_name);
+                     "Failed to run the DM task for the map '%s'", map_name);
         dm_task_destroy (task);
         dm_pool_destroy (pool);
         return NULL;
@@ -1860,7 +2844,7 @@ BDLVMCacheStats* bd_lvm_cache_stats (gchar *vg_name, gchar *cached_lv, GError **
 
     if (dm_task_get_info (task, &info) == 0) {
         g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_DM_ERROR,
-                     "Failed to get task info for the cache map '%s': ", map_name);
+                     "Failed to get task info for the map '%s'", map_name);
         dm_task_destroy (task);
         dm_pool_destroy (pool);
         return NULL;
@@ -1868,21 +2852,81 @@ BDLVMCacheStats* bd_lvm_cache_stats (gchar *vg_name, gchar *cached_lv, GError **
 
     if (!info.exists) {
         g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_CACHE_NOCACHE,
-                     "The cache map '%s' doesn't exist: ", map_name);
+                     "The map '%s' doesn't exist", map_name);
+        dm_task_destroy (task);
+        dm_pool_destroy (pool);
+        return NULL;
+    }
+
+    dm_get_next_target (task, NULL, &start, &length, &type, &params);
+    if (!type || !params) {
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_DM_ERROR,
+                     "The map '%s' has no targets", map_name);
         dm_task_destroy (task);
         dm_pool_destroy (pool);
         return NULL;
     }
 
-    dm_get_next_target(task, NULL, &start, &length, &type, &params);
+    *target_type = g_strdup (type);
+    ret = g_strdup (params);
+
+    dm_task_destroy (task);
+    dm_pool_destroy (pool);
+
+    return ret;
+}
+
+/**
+ * bd_lvm_cache_stats:
+ * @vg_name: name of the VG containing the @cached_lv
+ * @cached_lv: cached LV to get stats for
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: stats for the @cached_lv or %NULL in case of error
+ */
+BDLVMCacheStats* bd_lvm_cache_stats (gchar *vg_name, gchar *cached_lv, GError **error) {
+    struct dm_pool *pool = NULL;
+    struct dm_status_cache *status = NULL;
+    gchar *type = NULL;
+    gchar *params = NULL;
+    BDLVMCacheStats *ret = NULL;
+
+    if (geteuid () != 0) {
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_NOT_ROOT,
+                     "Not running as root, cannot query DM maps");
+        return NULL;
+    }
+
+    params = get_lv_target_params (vg_name, cached_lv, DM_DEVICE_STATUS, &type, error);
+    if (!params)
+        /* error is already populated */
+        return NULL;
+
+    if (g_strcmp0 (type, "cache") != 0) {
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_CACHE_NOCACHE,
+                     "The LV '%s/%s' is not a cached LV", vg_name, cached_lv);
+        g_free (type);
+        g_free (params);
+        return NULL;
+    }
+    g_free (type);
+
+    pool = dm_pool_create("bd-pool", 20);
+    if (!pool) {
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_DM_ERROR,
+                     "Failed to create DM memory pool");
+        g_free (params);
+        return NULL;
+    }
 
     if (dm_get_status_cache (pool, params, &status) == 0) {
         g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_CACHE_INVAL,
-                     "Failed to get status of the cache map '%s': ", map_name);
-        dm_task_destroy (task);
+                     "Failed to get status of the cache LV '%s/%s'", vg_name, cached_lv);
+        g_free (params);
         dm_pool_destroy (pool);
         return NULL;
     }
+    g_free (params);
 
     ret = g_new0 (BDLVMCacheStats, 1);
     ret->block_size = status->block_size * SECTOR_SIZE;
@@ -1906,17 +2950,204 @@ BDLVMCacheStats* bd_lvm_cache_stats (gchar *vg_name, gchar *cached_lv, GError **
         g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_CACHE_INVAL,
                       "Failed to determine status of the cache from '%"G_GUINT64_FORMAT"': ",
                       status->feature_flags);
-        dm_task_destroy (task);
+        g_free (ret);
         dm_pool_destroy (pool);
         return NULL;
     }
 
-    dm_task_destroy (task);
     dm_pool_destroy (pool);
 
     return ret;
 }
 
+/**
+ * bd_lvm_writecache_attach:
+ * @vg_name: name of the VG containing the @data_lv and the @cache_lv LVs
+ * @data_lv: data LV to attach the @cache_lv to
+ * @cache_lv: cache (fast) LV to attach to the @data_lv
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: whether the @cache_lv was successfully attached to the @data_lv or not
+ *
+ * Note: both LVs are deactivated for the conversion, the resulting cached LV is
+ *       activated again afterwards. Requires LVM with writecache support
+ *       (2.03.06 or newer).
+ */
+gboolean bd_lvm_writecache_attach (gchar *vg_name, gchar *data_lv, gchar *cache_lv, GError **error) {
+    gchar *args[8] = {"lvconvert", "-y", "--type", "writecache", "--cachevol", NULL, NULL, NULL};
+    gboolean success = FALSE;
+
+    /* both LVs need to be inactive for the writecache conversion */
+    success = bd_lvm_lvdeactivate (vg_name, data_lv, error);
+    if (!success) {
+        g_prefix_error (error, "Failed to deactivate the data LV: ");
+        return FALSE;
+    }
+
+    success = bd_lvm_lvdeactivate (vg_name, cache_lv, error);
+    if (!success) {
+        g_prefix_error (error, "Failed to deactivate the cache LV: ");
+        return FALSE;
+    }
+
+    args[5] = g_strdup_printf ("%s/%s", vg_name, cache_lv);
+    args[6] = g_strdup_printf ("%s/%s", vg_name, data_lv);
+    success = call_lvm_and_report_error (args, error);
+
+    g_free (args[5]);
+    g_free (args[6]);
+    if (!success)
+        return FALSE;
+
+    success = bd_lvm_lvactivate (vg_name, data_lv, FALSE, error);
+    if (!success)
+        g_prefix_error (error, "Failed to activate the cached LV: ");
+
+    return success;
+}
+
+/**
+ * bd_lvm_writecache_detach:
+ * @vg_name: name of the VG containing the @cached_lv
+ * @cached_lv: name of the cached LV to detach its cache from
+ * @destroy: whether to destroy the cache after detach or not
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: whether the cache was successfully detached from the @cached_lv or not
+ *
+ * Note: flushes the cache first
+ */
+gboolean bd_lvm_writecache_detach (gchar *vg_name, gchar *cached_lv, gboolean destroy, GError **error) {
+    /* same as for a dm-cache cached LV, lvconvert flushes the cache itself */
+    return bd_lvm_cache_detach (vg_name, cached_lv, destroy, error);
+}
+
+/**
+ * bd_lvm_writecache_create_cached_lv:
+ * @vg_name: name of the VG to create a cached LV in
+ * @lv_name: name of the cached LV to create
+ * @data_size: size of the data LV
+ * @cache_size: size of the cache (or cached LV more precisely)
+ * @slow_pvs: (array zero-terminated=1): list of slow PVs (used for the data LV)
+ * @fast_pvs: (array zero-terminated=1): list of fast PVs (used for the cache LV)
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: whether the cached LV @lv_name was successfully created or not
+ */
+gboolean bd_lvm_writecache_create_cached_lv (gchar *vg_name, gchar *lv_name, guint64 data_size, guint64 cache_size,
+                                             gchar **slow_pvs, gchar **fast_pvs, GError **error) {
+    gboolean success = FALSE;
+    gchar *name = NULL;
+
+    name = g_strdup_printf ("%s_writecache", lv_name);
+    success = bd_lvm_lvcreate (vg_name, name, cache_size, NULL, fast_pvs, error);
+    if (!success) {
+        g_prefix_error (error, "Failed to create the cache LV '%s': ", name);
+        g_free (name);
+        return FALSE;
+    }
+
+    success = bd_lvm_lvcreate (vg_name, lv_name, data_size, NULL, slow_pvs, error);
+    if (!success) {
+        g_prefix_error (error, "Failed to create the data LV: ");
+        g_free (name);
+        return FALSE;
+    }
+
+    success = bd_lvm_writecache_attach (vg_name, lv_name, name, error);
+    if (!success) {
+        g_prefix_error (error, "Failed to attach the cache LV '%s' to the data LV: ", name);
+        g_free (name);
+        return FALSE;
+    }
+
+    g_free (name);
+    return TRUE;
+}
+
+/**
+ * bd_lvm_writecache_stats:
+ * @vg_name: name of the VG containing the @cached_lv
+ * @cached_lv: writecache-cached LV to get stats for
+ * @error: (out): place to store error (if any)
+ *
+ * Returns: stats for the @cached_lv or %NULL in case of error
+ */
+BDLVMWritecacheStats* bd_lvm_writecache_stats (gchar *vg_name, gchar *cached_lv, GError **error) {
+    gchar *type = NULL;
+    gchar *params = NULL;
+    guint64 block_size = 0;
+    BDLVMWritecacheStats *ret = NULL;
+
+    if (geteuid () != 0) {
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_NOT_ROOT,
+                     "Not running as root, cannot query DM maps");
+        return NULL;
+    }
+
+    params = get_lv_target_params (vg_name, cached_lv, DM_DEVICE_STATUS, &type, error);
+    if (!params)
+        /* error is already populated */
+        return NULL;
+
+    if (g_strcmp0 (type, "writecache") != 0) {
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_CACHE_NOCACHE,
+                     "The LV '%s/%s' is not a writecache-cached LV", vg_name, cached_lv);
+        g_free (type);
+        g_free (params);
+        return NULL;
+    }
+
+    /* status is "<error> <total blocks> <free blocks> <writeback blocks> [...]"
+       (see Documentation/device-mapper/writecache.txt in the kernel sources) */
+    ret = g_new0 (BDLVMWritecacheStats, 1);
+    if (sscanf (params, "%"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT,
+                &(ret->error), &(ret->total_blocks), &(ret->free_blocks), &(ret->writeback_blocks)) != 4) {
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_CACHE_INVAL,
+                     "Failed to parse status of the writecache map: '%s'", params);
+        g_free (type);
+        g_free (params);
+        g_free (ret);
+        return NULL;
+    }
+    g_free (type);
+    g_free (params);
+
+    /* the block size (in bytes) is only part of the table, not the status */
+    params = get_lv_target_params (vg_name, cached_lv, DM_DEVICE_TABLE, &type, error);
+    if (!params) {
+        g_prefix_error (error, "Failed to get the block size of the writecache: ");
+        g_free (ret);
+        return NULL;
+    }
+
+    if (g_strcmp0 (type, "writecache") != 0) {
+        /* the map changed in the meantime */
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_CACHE_NOCACHE,
+                     "The LV '%s/%s' is not a writecache-cached LV", vg_name, cached_lv);
+        g_free (type);
+        g_free (params);
+        g_free (ret);
+        return NULL;
+    }
+
+    /* table is "<p|s> <origin dev> <cache dev> <block size> [...]" */
+    if (sscanf (params, "%*s %*s %*s %"G_GUINT64_FORMAT, &block_size) != 1) {
+        g_set_error (error, BD_LVM_ERROR, BD_LVM_ERROR_CACHE_INVAL,
+                     "Failed to parse table of the writecache map: '%s'", params);
+        g_free (type);
+        g_free (params);
+        g_free (ret);
+        return NULL;
+    }
+    ret->block_size = block_size;
+
+    g_free (type);
+    g_free (params);
+
+    return ret;
+}
+
 /**
  * bd_lvm_data_lv_name:
  * @vg_name: name of the VG containing the queried LV
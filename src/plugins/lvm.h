@@ -61,6 +61,18 @@ typedef enum {
     BD_LVM_CACHE_MODE_UNKNOWN,
 } BDLVMCacheMode;
 
+typedef enum {
+    BD_LVM_LV_FIELD_ORIGIN =           1 << 0,
+    BD_LVM_LV_FIELD_POOL_LV =          1 << 1,
+    BD_LVM_LV_FIELD_DATA_LV =          1 << 2,
+    BD_LVM_LV_FIELD_METADATA_LV =      1 << 3,
+    BD_LVM_LV_FIELD_DATA_PERCENT =     1 << 4,
+    BD_LVM_LV_FIELD_METADATA_PERCENT = 1 << 5,
+    BD_LVM_LV_FIELD_DEVICES =          1 << 6,
+    BD_LVM_LV_FIELD_STRIPES =          1 << 7,
+    BD_LVM_LV_FIELD_STRIPE_SIZE =      1 << 8,
+} BDLVMLVFields;
+
 typedef struct BDLVMPVdata {
     gchar *pv_name;
     gchar *pv_uuid;
@@ -100,11 +112,63 @@ typedef struct BDLVMLVdata {
     guint64 size;
     gchar *attr;
     gchar *segtype;
+    /* extended fields, only filled in by bd_lvm_lvs_ex() (if requested) */
+    gchar *origin;
+    gchar *pool_lv;
+    gchar *data_lv;
+    gchar *metadata_lv;
+    gdouble data_percent;
+    gdouble metadata_percent;
+    gchar *devices;
+    guint64 stripes;
+    guint64 stripe_size;
 } BDLVMLVdata;
 
 void bd_lvm_lvdata_free (BDLVMLVdata *data);
 BDLVMLVdata* bd_lvm_lvdata_copy (BDLVMLVdata *data);
 
+typedef struct BDLVMPVdataArray {
+    BDLVMPVdata *items;
+    guint64 n_items;
+    /* private: string arena the items' strings point into */
+    GStringChunk *strings;
+} BDLVMPVdataArray;
+
+void bd_lvm_pvdata_array_free (BDLVMPVdataArray *data);
+BDLVMPVdataArray* bd_lvm_pvdata_array_copy (BDLVMPVdataArray *data);
+BDLVMPVdata* bd_lvm_pvdata_array_get_item (BDLVMPVdataArray *data, guint64 index);
+
+typedef struct BDLVMVGdataArray {
+    BDLVMVGdata *items;
+    guint64 n_items;
+    /* private: string arena the items' strings point into */
+    GStringChunk *strings;
+} BDLVMVGdataArray;
+
+void bd_lvm_vgdata_array_free (BDLVMVGdataArray *data);
+BDLVMVGdataArray* bd_lvm_vgdata_array_copy (BDLVMVGdataArray *data);
+BDLVMVGdata* bd_lvm_vgdata_array_get_item (BDLVMVGdataArray *data, guint64 index);
+
+typedef struct BDLVMLVdataArray {
+    BDLVMLVdata *items;
+    guint64 n_items;
+    /* private: string arena the items' strings point into */
+    GStringChunk *strings;
+} BDLVMLVdataArray;
+
+void bd_lvm_lvdata_array_free (BDLVMLVdataArray *data);
+BDLVMLVdataArray* bd_lvm_lvdata_array_copy (BDLVMLVdataArray *data);
+BDLVMLVdata* bd_lvm_lvdata_array_get_item (BDLVMLVdataArray *data, guint64 index);
+
+typedef struct BDLVMActivationResult {
+    gchar *name;
+    gboolean success;
+    gchar *error_message;
+} BDLVMActivationResult;
+
+void bd_lvm_activation_result_free (BDLVMActivationResult *data);
+BDLVMActivationResult* bd_lvm_activation_result_copy (BDLVMActivationResult *data);
+
 typedef struct BDLVMCacheStats {
     guint64 block_size;
     guint64 cache_size;
@@ -122,6 +186,17 @@ typedef struct BDLVMCacheStats {
 void bd_lvm_cache_stats_free (BDLVMCacheStats *data);
 BDLVMCacheStats* bd_lvm_cache_stats_copy (BDLVMCacheStats *data);
 
+typedef struct BDLVMWritecacheStats {
+    guint64 block_size;
+    guint64 total_blocks;
+    guint64 free_blocks;
+    guint64 writeback_blocks;
+    guint64 error;
+} BDLVMWritecacheStats;
+
+void bd_lvm_writecache_stats_free (BDLVMWritecacheStats *data);
+BDLVMWritecacheStats* bd_lvm_writecache_stats_copy (BDLVMWritecacheStats *data);
+
 gboolean bd_lvm_is_supported_pe_size (guint64 size, GError **error);
 guint64 *bd_lvm_get_supported_pe_sizes (GError **error);
 guint64 bd_lvm_get_max_lv_size (GError **error);
@@ -138,6 +213,7 @@ gboolean bd_lvm_pvmove (gchar *src, gchar *dest, GError **error);
 gboolean bd_lvm_pvscan (gchar *device, gboolean update_cache, GError **error);
 BDLVMPVdata* bd_lvm_pvinfo (gchar *device, GError **error);
 BDLVMPVdata** bd_lvm_pvs (GError **error);
+BDLVMPVdataArray* bd_lvm_pvs_compact (GError **error);
 
 gboolean bd_lvm_vgcreate (gchar *name, gchar **pv_list, guint64 pe_size, GError **error);
 gboolean bd_lvm_vgremove (gchar *vg_name, GError **error);
@@ -147,6 +223,7 @@ gboolean bd_lvm_vgextend (gchar *vg_name, gchar *device, GError **error);
 gboolean bd_lvm_vgreduce (gchar *vg_name, gchar *device, GError **error);
 BDLVMVGdata* bd_lvm_vginfo (gchar *vg_name, GError **error);
 BDLVMVGdata** bd_lvm_vgs (GError **error);
+BDLVMVGdataArray* bd_lvm_vgs_compact (GError **error);
 
 gchar* bd_lvm_lvorigin (gchar *vg_name, gchar *lv_name, GError **error);
 gboolean bd_lvm_lvcreate (gchar *vg_name, gchar *lv_name, guint64 size, gchar *type, gchar **pv_list, GError **error);
@@ -158,6 +235,9 @@ gboolean bd_lvm_lvsnapshotcreate (gchar *vg_name, gchar *origin_name, gchar *sna
 gboolean bd_lvm_lvsnapshotmerge (gchar *vg_name, gchar *snapshot_name, GError **error);
 BDLVMLVdata* bd_lvm_lvinfo (gchar *vg_name, gchar *lv_name, GError **error);
 BDLVMLVdata** bd_lvm_lvs (gchar *vg_name, GError **error);
+BDLVMLVdata** bd_lvm_lvs_ex (gchar *vg_name, BDLVMLVFields fields, GError **error);
+BDLVMLVdataArray* bd_lvm_lvs_compact (gchar *vg_name, GError **error);
+BDLVMActivationResult** bd_lvm_activate_many (gchar **names, gboolean ignore_skip, guint max_jobs, GError **error);
 
 gboolean bd_lvm_thpoolcreate (gchar *vg_name, gchar *lv_name, guint64 size, guint64 md_size, guint64 chunk_size, gchar *profile, GError **error);
 gboolean bd_lvm_thlvcreate (gchar *vg_name, gchar *pool_name, gchar *lv_name, guint64 size, GError **error);
@@ -177,6 +257,12 @@ gboolean bd_lvm_cache_create_cached_lv (gchar *vg_name, gchar *lv_name, guint64
 gchar* bd_lvm_cache_pool_name (gchar *vg_name, gchar *cached_lv, GError **error);
 BDLVMCacheStats* bd_lvm_cache_stats (gchar *vg_name, gchar *cached_lv, GError **error);
 
+gboolean bd_lvm_writecache_attach (gchar *vg_name, gchar *data_lv, gchar *cache_lv, GError **error);
+gboolean bd_lvm_writecache_detach (gchar *vg_name, gchar *cached_lv, gboolean destroy, GError **error);
+gboolean bd_lvm_writecache_create_cached_lv (gchar *vg_name, gchar *lv_name, guint64 data_size, guint64 cache_size,
+                                             gchar **slow_pvs, gchar **fast_pvs, GError **error);
+BDLVMWritecacheStats* bd_lvm_writecache_stats (gchar *vg_name, gchar *cached_lv, GError **error);
+
 gchar* bd_lvm_data_lv_name (gchar *vg_name, gchar *lv_name, GError **error);
 gchar* bd_lvm_metadata_lv_name (gchar *vg_name, gchar *lv_name, GError **error);
 
@@ -103,6 +103,30 @@ def btrfs_create_snapshot(source, dest, ro=False):
     return _btrfs_create_snapshot(source, dest, ro)
 __all__.append("btrfs_create_snapshot")
 
+_btrfs_create_snapshots = BlockDev.btrfs_create_snapshots
+@override(BlockDev.btrfs_create_snapshots)
+def btrfs_create_snapshots(sources, dests, ro=False, max_threads=0):
+    return _btrfs_create_snapshots(sources, dests, ro, max_threads)
+__all__.append("btrfs_create_snapshots")
+
+_btrfs_balance_start = BlockDev.btrfs_balance_start
+@override(BlockDev.btrfs_balance_start)
+def btrfs_balance_start(mountpoint, data_usage=0, metadata_usage=0):
+    return _btrfs_balance_start(mountpoint, data_usage, metadata_usage)
+__all__.append("btrfs_balance_start")
+
+_btrfs_scrub_start = BlockDev.btrfs_scrub_start
+@override(BlockDev.btrfs_scrub_start)
+def btrfs_scrub_start(mountpoint, ioprio_class=BlockDev.BtrfsIOPrioClass.IDLE, ioprio_classdata=0, bandwidth_limit=0):
+    return _btrfs_scrub_start(mountpoint, ioprio_class, ioprio_classdata, bandwidth_limit)
+__all__.append("btrfs_scrub_start")
+
+_btrfs_send = BlockDev.btrfs_send
+@override(BlockDev.btrfs_send)
+def btrfs_send(subvolume, fd, parent=None):
+    return _btrfs_send(subvolume, fd, parent)
+__all__.append("btrfs_send")
+
 
 _crypto_luks_format = BlockDev.crypto_luks_format
 @override(BlockDev.crypto_luks_format)
@@ -110,18 +134,74 @@ def crypto_luks_format(device, cipher=None, key_size=0, passphrase=None, key_fil
     return _crypto_luks_format(device, cipher, key_size, passphrase, key_file, min_entropy)
 __all__.append("crypto_luks_format")
 
+_crypto_luks_format_luks2 = BlockDev.crypto_luks_format_luks2
+@override(BlockDev.crypto_luks_format_luks2)
+def crypto_luks_format_luks2(device, cipher=None, key_size=0, passphrase=None, key_file=None, min_entropy=0,
+                             sector_size=0, pbkdf=None, iter_time=0, max_memory_kb=0, parallel_threads=0):
+    return _crypto_luks_format_luks2(device, cipher, key_size, passphrase, key_file, min_entropy,
+                                     sector_size, pbkdf, iter_time, max_memory_kb, parallel_threads)
+__all__.append("crypto_luks_format_luks2")
+
 _crypto_luks_open = BlockDev.crypto_luks_open
 @override(BlockDev.crypto_luks_open)
 def crypto_luks_open(device, name, passphrase=None, key_file=None):
     return _crypto_luks_open(device, name, passphrase, key_file)
 __all__.append("crypto_luks_open")
 
+_crypto_luks_open_with_flags = BlockDev.crypto_luks_open_with_flags
+@override(BlockDev.crypto_luks_open_with_flags)
+def crypto_luks_open_with_flags(device, name, passphrase=None, key_file=None, flags=0):
+    return _crypto_luks_open_with_flags(device, name, passphrase, key_file, flags)
+__all__.append("crypto_luks_open_with_flags")
+
+_crypto_luks_refresh = BlockDev.crypto_luks_refresh
+@override(BlockDev.crypto_luks_refresh)
+def crypto_luks_refresh(luks_device, passphrase=None, key_file=None, flags=0):
+    return _crypto_luks_refresh(luks_device, passphrase, key_file, flags)
+__all__.append("crypto_luks_refresh")
+
+_crypto_benchmark_pbkdf = BlockDev.crypto_benchmark_pbkdf
+@override(BlockDev.crypto_benchmark_pbkdf)
+def crypto_benchmark_pbkdf(hash=None, key_size=0):
+    return _crypto_benchmark_pbkdf(hash, key_size)
+__all__.append("crypto_benchmark_pbkdf")
+
+_crypto_luks_open_many = BlockDev.crypto_luks_open_many
+@override(BlockDev.crypto_luks_open_many)
+def crypto_luks_open_many(devices, names, passphrases, share_volume_key=False):
+    return _crypto_luks_open_many(devices, names, passphrases, share_volume_key)
+__all__.append("crypto_luks_open_many")
+
+_crypto_luks_key_session_open = BlockDev.crypto_luks_key_session_open
+@override(BlockDev.crypto_luks_key_session_open)
+def crypto_luks_key_session_open(device, passphrase=None, key_file=None):
+    return _crypto_luks_key_session_open(device, passphrase, key_file)
+__all__.append("crypto_luks_key_session_open")
+
+_crypto_luks_key_session_add_key = BlockDev.crypto_luks_key_session_add_key
+@override(BlockDev.crypto_luks_key_session_add_key)
+def crypto_luks_key_session_add_key(session, npass=None, nkey_file=None):
+    return _crypto_luks_key_session_add_key(session, npass, nkey_file)
+__all__.append("crypto_luks_key_session_add_key")
+
+_crypto_luks_key_session_change_key = BlockDev.crypto_luks_key_session_change_key
+@override(BlockDev.crypto_luks_key_session_change_key)
+def crypto_luks_key_session_change_key(session, npass=None, nkey_file=None):
+    return _crypto_luks_key_session_change_key(session, npass, nkey_file)
+__all__.append("crypto_luks_key_session_change_key")
+
 _crypto_luks_resize = BlockDev.crypto_luks_resize
 @override(BlockDev.crypto_luks_resize)
 def crypto_luks_resize(luks_device, size=0):
     return _crypto_luks_resize(luks_device, size)
 __all__.append("crypto_luks_resize")
 
+_crypto_luks_reencrypt_start = BlockDev.crypto_luks_reencrypt_start
+@override(BlockDev.crypto_luks_reencrypt_start)
+def crypto_luks_reencrypt_start(device, luks_device, passphrase, cipher=None, key_size=0, max_rate=0, drop_other_keys=False):
+    return _crypto_luks_reencrypt_start(device, luks_device, passphrase, cipher, key_size, max_rate, drop_other_keys)
+__all__.append("crypto_luks_reencrypt_start")
+
 _crypto_luks_add_key = BlockDev.crypto_luks_add_key
 @override(BlockDev.crypto_luks_add_key)
 def crypto_luks_add_key(device, pass_=None, key_file=None, npass=None, nkey_file=None):
@@ -140,6 +220,12 @@ def crypto_escrow_device(device, passphrase, cert_data, directory, backup_passph
     return _crypto_escrow_device(device, passphrase, cert_data, directory, backup_passphrase)
 __all__.append("crypto_escrow_device")
 
+_crypto_escrow_devices = BlockDev.crypto_escrow_devices
+@override(BlockDev.crypto_escrow_devices)
+def crypto_escrow_devices(devices, passphrases, cert_data, directory, backup_passphrases=None):
+    return _crypto_escrow_devices(devices, passphrases, cert_data, directory, backup_passphrases)
+__all__.append("crypto_escrow_devices")
+
 
 _dm_create_linear = BlockDev.dm_create_linear
 @override(BlockDev.dm_create_linear)
@@ -220,6 +306,18 @@ def lvm_lvs(vg_name=None):
     return _lvm_lvs(vg_name)
 __all__.append("lvm_lvs")
 
+_lvm_lvs_ex = BlockDev.lvm_lvs_ex
+@override(BlockDev.lvm_lvs_ex)
+def lvm_lvs_ex(vg_name=None, fields=0):
+    return _lvm_lvs_ex(vg_name, fields)
+__all__.append("lvm_lvs_ex")
+
+_lvm_activate_many = BlockDev.lvm_activate_many
+@override(BlockDev.lvm_activate_many)
+def lvm_activate_many(names, ignore_skip=False, max_jobs=0):
+    return _lvm_activate_many(names, ignore_skip, max_jobs)
+__all__.append("lvm_activate_many")
+
 _lvm_thpoolcreate = BlockDev.lvm_thpoolcreate
 @override(BlockDev.lvm_thpoolcreate)
 def lvm_thpoolcreate(vg_name, lv_name, size, md_size=0, chunk_size=0, profile=None):
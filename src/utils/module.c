@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2026  Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <glib.h>
+
+#include "module.h"
+
+/**
+ * bd_utils_pin_module:
+ * @symbol: address of any symbol from the module (shared library) to pin
+ *
+ * Makes sure the module containing @symbol is never unloaded (even by
+ * dlclose() done by bd_reinit()). To be used by plugins running their code in
+ * threads that may outlive the plugin's use by the library.
+ *
+ * Returns: whether the module was successfully pinned or not
+ */
+gboolean bd_utils_pin_module (gpointer symbol) {
+    Dl_info info;
+    void *handle = NULL;
+
+    if (!dladdr (symbol, &info) || !info.dli_fname) {
+        g_warning ("Failed to find the module to pin");
+        return FALSE;
+    }
+
+    /* only promotes the flags of the already loaded module (the extra
+       reference is never dropped) */
+    handle = dlopen (info.dli_fname, RTLD_LAZY | RTLD_NOLOAD | RTLD_NODELETE);
+    if (!handle) {
+        g_warning ("Failed to pin module '%s': %s", info.dli_fname, dlerror ());
+        return FALSE;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,8 @@
+#include <glib.h>
+
+#ifndef BD_UTILS_MODULE
+#define BD_UTILS_MODULE
+
+gboolean bd_utils_pin_module (gpointer symbol);
+
+#endif /* BD_UTILS_MODULE */
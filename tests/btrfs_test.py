@@ -2,6 +2,11 @@ from __future__ import division
 
 import unittest
 import os
+import random
+import shutil
+import subprocess
+import tempfile
+import time
 import six
 
 import overrides_hack
@@ -238,6 +243,42 @@ class BtrfsTestCreateSnapshot(BtrfsTestCase):
         subvols = BlockDev.btrfs_list_subvolumes(TEST_MNT, True)
         self.assertEqual(len(subvols), 2)
 
+    def test_create_snapshots(self):
+        """Verify that it is possible to create many snapshots at once"""
+
+        succ = BlockDev.btrfs_create_volume([self.loop_dev], "myShinyBtrfs", None, None)
+        self.assertTrue(succ)
+
+        mount(self.loop_dev, TEST_MNT)
+
+        for i in range(10):
+            succ = BlockDev.btrfs_create_subvolume(TEST_MNT, "subvol%d" % i)
+            self.assertTrue(succ)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.btrfs_create_snapshots([TEST_MNT + "/subvol0"], [])
+
+        os.mkdir(TEST_MNT + "/snaps")
+        sources = [TEST_MNT + "/subvol%d" % i for i in range(10)] + [TEST_MNT + "/nonexisting"]
+        dests = [TEST_MNT + "/snaps/snap%d" % i for i in range(10)] + [TEST_MNT + "/snaps/snap10"]
+        results = BlockDev.btrfs_create_snapshots(sources, dests, True, 4)
+        self.assertEqual(len(results), 11)
+        for result, source, dest in zip(results[:10], sources, dests):
+            self.assertEqual(result.source, source)
+            self.assertEqual(result.dest, dest)
+            self.assertTrue(result.success)
+            self.assertIsNone(result.error_message)
+        self.assertFalse(results[10].success)
+        self.assertIn("nonexisting", results[10].error_message)
+
+        subvols = BlockDev.btrfs_list_subvolumes(TEST_MNT, True)
+        self.assertEqual(len(subvols), 10)
+
+        # an existing directory as the destination, one by one
+        results = BlockDev.btrfs_create_snapshots([TEST_MNT + "/subvol0"], [TEST_MNT + "/snaps"])
+        self.assertTrue(results[0].success)
+        self.assertTrue(os.path.isdir(TEST_MNT + "/snaps/subvol0"))
+
 class BtrfsTestGetDefaultSubvolumeID(BtrfsTestCase):
     def test_get_default_subvolume_id(self):
         """Verify that getting default subvolume ID works as expected"""
@@ -302,6 +343,43 @@ class BtrfsTestListDevices(BtrfsTestCase):
         self.assertTrue(devs[0].used >= 0)
         self.assertTrue(devs[1].used >= 0)
 
+class BtrfsTestListDevicesExact(BtrfsTestCase):
+    def test_list_devices_exact(self):
+        """Verify that info about devices has exact sizes both for mounted and unmounted volumes"""
+
+        succ = BlockDev.btrfs_create_volume([self.loop_dev], "myShinyBtrfs", None, None)
+        self.assertTrue(succ)
+
+        # not mounted -- read from the superblock
+        devs = BlockDev.btrfs_list_devices(self.loop_dev)
+        self.assertEqual(len(devs), 1)
+        self.assertEqual(devs[0].id, 1)
+        self.assertEqual(devs[0].path, self.loop_dev)
+        self.assertEqual(devs[0].size, 1024**3)
+        self.assertTrue(0 < devs[0].used < 1024**3)
+
+        info = BlockDev.btrfs_filesystem_info(self.loop_dev)
+        self.assertEqual(info.label, "myShinyBtrfs")
+        self.assertEqual(info.num_devices, 1)
+        uuid = info.uuid
+
+        mount(self.loop_dev, TEST_MNT)
+
+        # mounted -- both the device and the mountpoint work
+        for spec in (self.loop_dev, TEST_MNT):
+            devs = BlockDev.btrfs_list_devices(spec)
+            self.assertEqual(len(devs), 1)
+            self.assertEqual(devs[0].id, 1)
+            self.assertEqual(devs[0].path, self.loop_dev)
+            self.assertEqual(devs[0].size, 1024**3)
+            self.assertTrue(0 < devs[0].used < 1024**3)
+
+            info = BlockDev.btrfs_filesystem_info(spec)
+            self.assertEqual(info.label, "myShinyBtrfs")
+            self.assertEqual(info.uuid, uuid)
+            self.assertEqual(info.num_devices, 1)
+            self.assertTrue(info.used > 0)
+
 class BtrfsTestListSubvolumes(BtrfsTestCase):
     def test_list_subvolumes(self):
         """Verify that it is possible to get info about subvolumes"""
@@ -322,6 +400,118 @@ class BtrfsTestListSubvolumes(BtrfsTestCase):
         self.assertEqual(subvols[0].parent_id, 5)
         self.assertEqual(subvols[0].path, "subvol1")
 
+class BtrfsTestListSubvolumesNested(BtrfsTestCase):
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_list_subvolumes_nested(self):
+        """Verify that listing many subvolumes in nested directories gives the same results as 'btrfs subvol list'"""
+
+        succ = BlockDev.btrfs_create_volume([self.loop_dev], "myShinyBtrfs", None, None)
+        self.assertTrue(succ)
+
+        mount(self.loop_dev, TEST_MNT)
+
+        # nested directories like the ones Docker uses
+        subvols_dir = os.path.join(TEST_MNT, "docker/btrfs/subvolumes")
+        os.makedirs(subvols_dir)
+
+        for i in range(100):
+            ret = os.system("btrfs subvol create %s >/dev/null" % os.path.join(subvols_dir, "subvol%d" % i))
+            self.assertEqual(ret, 0)
+
+        subvols = BlockDev.btrfs_list_subvolumes(TEST_MNT, False)
+        out = subprocess.check_output(["btrfs", "subvol", "list", "-p", TEST_MNT]).decode()
+
+        self.assertEqual(len(subvols), 100)
+        self.assertEqual(set(subvol.path for subvol in subvols),
+                         set(line.split()[-1] for line in out.splitlines() if line.strip()))
+        self.assertTrue(all(subvol.parent_id == BlockDev.BTRFS_MAIN_VOLUME_ID for subvol in subvols))
+
+class BtrfsTestQgroups(BtrfsTestCase):
+    def _sync_quotas(self):
+        os.system("sync")
+        ret = os.system("btrfs quota rescan -w %s >/dev/null" % TEST_MNT)
+        self.assertEqual(ret, 0)
+
+    def _qgroup_show(self):
+        """Get {qgroup_id: (rfer, excl)} from 'btrfs qgroup show'"""
+
+        out = subprocess.check_output(["btrfs", "qgroup", "show", "--raw", TEST_MNT]).decode()
+        ret = dict()
+        for line in out.splitlines():
+            fields = line.split()
+            if len(fields) < 3 or "/" not in fields[0] or not fields[1].isdigit():
+                # header, separator,...
+                continue
+            level, qid = fields[0].split("/")
+            ret[(int(level) << 48) | int(qid)] = (int(fields[1]), int(fields[2]))
+        return ret
+
+    def _get_qgroups(self, qgroups):
+        return dict((q.id, q) for q in (qgroups.get_item(i) for i in range(qgroups.n_items)))
+
+    def _check_qgroups(self, qgroups):
+        expected = self._qgroup_show()
+        self.assertEqual(set(qgroups.keys()), set(expected.keys()))
+        for (qid, (rfer, excl)) in expected.items():
+            self.assertEqual(qgroups[qid].referenced, rfer)
+            self.assertEqual(qgroups[qid].exclusive, excl)
+
+    def test_qgroup_list(self):
+        """Verify that listing and refreshing qgroups works as expected"""
+
+        succ = BlockDev.btrfs_create_volume([self.loop_dev], "myShinyBtrfs", None, None)
+        self.assertTrue(succ)
+
+        mount(self.loop_dev, TEST_MNT)
+
+        # quotas not enabled
+        with self.assertRaises(GLib.GError):
+            BlockDev.btrfs_qgroup_list(TEST_MNT)
+
+        ret = os.system("btrfs quota enable %s" % TEST_MNT)
+        self.assertEqual(ret, 0)
+
+        for name in ("subvol1", "subvol2"):
+            succ = BlockDev.btrfs_create_subvolume(TEST_MNT, name)
+            self.assertTrue(succ)
+        with open(os.path.join(TEST_MNT, "subvol1", "data"), "wb") as f:
+            f.write(os.urandom(1024**2))
+        ret = os.system("btrfs qgroup limit 10M %s" % os.path.join(TEST_MNT, "subvol2"))
+        self.assertEqual(ret, 0)
+        self._sync_quotas()
+
+        subvol_ids = dict((subvol.path, subvol.id) for subvol in BlockDev.btrfs_list_subvolumes(TEST_MNT, False))
+
+        qgroups = BlockDev.btrfs_qgroup_list(TEST_MNT)
+        items = self._get_qgroups(qgroups)
+        self.assertIsNone(qgroups.get_item(qgroups.n_items))
+        self._check_qgroups(items)
+
+        # sorted by the IDs
+        ids = [qgroups.get_item(i).id for i in range(qgroups.n_items)]
+        self.assertEqual(ids, sorted(ids))
+
+        self.assertGreaterEqual(items[subvol_ids["subvol1"]].referenced, 1024**2)
+        self.assertGreaterEqual(items[subvol_ids["subvol1"]].exclusive, 1024**2)
+        self.assertEqual(items[subvol_ids["subvol1"]].max_referenced, 0)
+        self.assertEqual(items[subvol_ids["subvol2"]].max_referenced, 10 * 1024**2)
+
+        # a new subvolume and more data, refresh should pick up both
+        succ = BlockDev.btrfs_create_subvolume(TEST_MNT, "subvol3")
+        self.assertTrue(succ)
+        with open(os.path.join(TEST_MNT, "subvol2", "data"), "wb") as f:
+            f.write(os.urandom(2 * 1024**2))
+        self._sync_quotas()
+
+        subvol_ids = dict((subvol.path, subvol.id) for subvol in BlockDev.btrfs_list_subvolumes(TEST_MNT, False))
+
+        succ = BlockDev.btrfs_qgroup_list_refresh(TEST_MNT, qgroups)
+        self.assertTrue(succ)
+        items = self._get_qgroups(qgroups)
+        self.assertIn(subvol_ids["subvol3"], items)
+        self.assertGreaterEqual(items[subvol_ids["subvol2"]].referenced, 2 * 1024**2)
+        self._check_qgroups(items)
+
 class BtrfsTestFilesystemInfo(BtrfsTestCase):
     def test_filesystem_info(self):
         """Verify that it is possible to get filesystem info"""
@@ -354,6 +544,220 @@ class BtrfsTestFilesystemInfoNoLabel(BtrfsTestCase):
         self.assertEqual(info.num_devices, 1)
         self.assertTrue(info.used >= 0)
 
+class BtrfsTestSpaceInfo(BtrfsTestCase):
+    def test_space_info(self):
+        """Verify that it is possible to get info about allocated and unallocated space"""
+
+        succ = BlockDev.btrfs_create_volume([self.loop_dev, self.loop_dev2], None, "raid1", "raid1")
+        self.assertTrue(succ)
+
+        mount(self.loop_dev, TEST_MNT)
+
+        spaces = BlockDev.btrfs_space_info(TEST_MNT)
+        allocated = [space for space in spaces if space.type != BlockDev.BtrfsSpaceType.UNALLOCATED]
+        unallocated = [space for space in spaces if space.type == BlockDev.BtrfsSpaceType.UNALLOCATED]
+
+        types = set(space.type for space in allocated)
+        self.assertIn(BlockDev.BtrfsSpaceType.DATA, types)
+        self.assertIn(BlockDev.BtrfsSpaceType.METADATA, types)
+        self.assertIn(BlockDev.BtrfsSpaceType.SYSTEM, types)
+        for space in allocated:
+            self.assertTrue(space.profile)
+            self.assertIsNone(space.device)
+            self.assertLessEqual(space.used, space.total)
+        data = next(space for space in allocated if space.type == BlockDev.BtrfsSpaceType.DATA)
+        self.assertEqual(data.profile, "RAID1")
+
+        # unallocated space is reported for each device
+        devs = BlockDev.btrfs_list_devices(TEST_MNT)
+        self.assertEqual(sorted(space.device for space in unallocated), sorted(dev.path for dev in devs))
+        for dev in devs:
+            space = next(space for space in unallocated if space.device == dev.path)
+            self.assertIsNone(space.profile)
+            self.assertEqual(space.total, dev.size - dev.used)
+
+class BtrfsTestBalanceScrub(BtrfsTestCase):
+    def _wait_for(self, get_status):
+        for _ in range(600):
+            status = get_status(TEST_MNT)
+            if status.state != BlockDev.BtrfsOpState.RUNNING:
+                return status
+            time.sleep(0.1)
+        self.fail("Operation did not finish in time")
+
+    def test_balance(self):
+        """Verify that it is possible to run balance in the background and monitor it"""
+
+        succ = BlockDev.btrfs_create_volume([self.loop_dev, self.loop_dev2], None, "raid1", "raid1")
+        self.assertTrue(succ)
+
+        mount(self.loop_dev, TEST_MNT)
+
+        # nothing running, nothing to cancel
+        status = BlockDev.btrfs_balance_status(TEST_MNT)
+        self.assertEqual(status.state, BlockDev.BtrfsOpState.IDLE)
+        with self.assertRaises(GLib.GError):
+            BlockDev.btrfs_balance_cancel(TEST_MNT)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.btrfs_balance_start(TEST_MNT, 101, 0)
+
+        succ = BlockDev.btrfs_balance_start(TEST_MNT)
+        self.assertTrue(succ)
+
+        status = self._wait_for(BlockDev.btrfs_balance_status)
+        self.assertEqual(status.state, BlockDev.BtrfsOpState.FINISHED)
+        self.assertEqual(status.eta, 0)
+        self.assertGreater(status.completed, 0)
+
+    def test_scrub(self):
+        """Verify that it is possible to run scrub in the background and monitor it"""
+
+        succ = BlockDev.btrfs_create_volume([self.loop_dev, self.loop_dev2], None, "raid1", "raid1")
+        self.assertTrue(succ)
+
+        mount(self.loop_dev, TEST_MNT)
+        os.system("dd if=/dev/urandom of=%s/file bs=1M count=10 >/dev/null 2>&1" % TEST_MNT)
+        os.system("sync")
+
+        status = BlockDev.btrfs_scrub_status(TEST_MNT)
+        self.assertEqual(status.state, BlockDev.BtrfsOpState.IDLE)
+        with self.assertRaises(GLib.GError):
+            BlockDev.btrfs_scrub_cancel(TEST_MNT)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.btrfs_scrub_start(TEST_MNT, BlockDev.BtrfsIOPrioClass.BE, 8)
+
+        succ = BlockDev.btrfs_scrub_start(TEST_MNT)
+        self.assertTrue(succ)
+
+        status = self._wait_for(BlockDev.btrfs_scrub_status)
+        self.assertEqual(status.state, BlockDev.BtrfsOpState.FINISHED)
+        # both copies of the file were read
+        self.assertGreaterEqual(status.bytes_scrubbed, 2 * 10 * 1024**2)
+        self.assertEqual(status.csum_errors, 0)
+        self.assertEqual(status.uncorrectable_errors, 0)
+        self.assertEqual(status.eta, 0)
+
+    def test_scrub_limit_and_running(self):
+        """Verify that scrub restores the bandwidth limits and refuses to start twice"""
+
+        succ = BlockDev.btrfs_create_volume([self.loop_dev, self.loop_dev2], None, "raid1", "raid1")
+        self.assertTrue(succ)
+
+        mount(self.loop_dev, TEST_MNT)
+        os.system("dd if=/dev/urandom of=%s/file bs=1M count=50 >/dev/null 2>&1" % TEST_MNT)
+        os.system("sync")
+
+        uuid = BlockDev.btrfs_filesystem_info(TEST_MNT).uuid
+        limit_files = ["/sys/fs/btrfs/%s/devinfo/%d/scrub_speed_max" % (uuid, dev.id)
+                       for dev in BlockDev.btrfs_list_devices(TEST_MNT)]
+        if not all(os.path.exists(f) for f in limit_files):
+            self.skipTest("scrub bandwidth limit not supported by the kernel")
+
+        # some limit set by the admin
+        for f in limit_files:
+            with open(f, "w") as limit_file:
+                limit_file.write("%d" % (100 * 1024**2))
+
+        # slow enough to be still running when started again
+        succ = BlockDev.btrfs_scrub_start(TEST_MNT, BlockDev.BtrfsIOPrioClass.NONE, 0, 1024**2)
+        self.assertTrue(succ)
+        for f in limit_files:
+            with open(f, "r") as limit_file:
+                self.assertEqual(int(limit_file.read()), 1024**2)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.btrfs_scrub_start(TEST_MNT)
+
+        succ = BlockDev.btrfs_scrub_cancel(TEST_MNT)
+        self.assertTrue(succ)
+        status = self._wait_for(BlockDev.btrfs_scrub_status)
+        self.assertEqual(status.state, BlockDev.BtrfsOpState.CANCELED)
+
+        # the admin's limit is back
+        for f in limit_files:
+            with open(f, "r") as limit_file:
+                self.assertEqual(int(limit_file.read()), 100 * 1024**2)
+
+        # no limit given, the admin's limit is kept
+        succ = BlockDev.btrfs_scrub_start(TEST_MNT)
+        self.assertTrue(succ)
+        for f in limit_files:
+            with open(f, "r") as limit_file:
+                self.assertEqual(int(limit_file.read()), 100 * 1024**2)
+        self._wait_for(BlockDev.btrfs_scrub_status)
+
+        for f in limit_files:
+            with open(f, "w") as limit_file:
+                limit_file.write("0")
+
+class BtrfsTestSendReceive(BtrfsTestCase):
+    def test_send_receive(self):
+        """Verify that it is possible to send and receive (incremental) streams"""
+
+        succ = BlockDev.btrfs_create_volume([self.loop_dev], None, None, None)
+        self.assertTrue(succ)
+
+        mount(self.loop_dev, TEST_MNT)
+
+        succ = BlockDev.btrfs_create_subvolume(TEST_MNT, "data")
+        self.assertTrue(succ)
+        os.system("dd if=/dev/urandom of=%s/data/file1 bs=1M count=4 >/dev/null 2>&1" % TEST_MNT)
+        succ = BlockDev.btrfs_create_snapshot(TEST_MNT + "/data", TEST_MNT + "/snap1", True)
+        self.assertTrue(succ)
+        os.mkdir(TEST_MNT + "/received")
+
+        stream_dir = tempfile.mkdtemp(prefix="btrfs_stream")
+        self.addCleanup(shutil.rmtree, stream_dir)
+
+        # snapshots have to be read-only to be sent
+        with open(os.path.join(stream_dir, "rw"), "wb") as stream:
+            with self.assertRaises(GLib.GError):
+                BlockDev.btrfs_send(TEST_MNT + "/data", stream.fileno())
+
+        # full stream through a file
+        with open(os.path.join(stream_dir, "full"), "wb") as stream:
+            stats = BlockDev.btrfs_send(TEST_MNT + "/snap1", stream.fileno())
+        self.assertEqual(stats.bytes, os.path.getsize(os.path.join(stream_dir, "full")))
+        self.assertGreater(stats.bytes, 4 * 1024**2)
+        self.assertGreater(stats.rate, 0)
+
+        with open(os.path.join(stream_dir, "full"), "rb") as stream:
+            stats = BlockDev.btrfs_receive(TEST_MNT + "/received", stream.fileno())
+        self.assertEqual(stats.bytes, os.path.getsize(os.path.join(stream_dir, "full")))
+        self.assertEqual(os.path.getsize(TEST_MNT + "/received/snap1/file1"), 4 * 1024**2)
+
+        # incremental stream
+        os.system("dd if=/dev/urandom of=%s/data/file2 bs=1M count=1 >/dev/null 2>&1" % TEST_MNT)
+        succ = BlockDev.btrfs_create_snapshot(TEST_MNT + "/data", TEST_MNT + "/snap2", True)
+        self.assertTrue(succ)
+
+        with open(os.path.join(stream_dir, "incremental"), "wb") as stream:
+            stats = BlockDev.btrfs_send(TEST_MNT + "/snap2", stream.fileno(), TEST_MNT + "/snap1")
+        # only the new file is in the stream
+        self.assertLess(stats.bytes, 2 * 1024**2)
+
+        with open(os.path.join(stream_dir, "incremental"), "rb") as stream:
+            BlockDev.btrfs_receive(TEST_MNT + "/received", stream.fileno())
+        self.assertTrue(os.path.exists(TEST_MNT + "/received/snap2/file1"))
+        self.assertEqual(os.path.getsize(TEST_MNT + "/received/snap2/file2"), 1024**2)
+
+        # garbage is not a valid stream
+        with open(os.path.join(stream_dir, "rw"), "wb") as stream:
+            stream.write(b"garbage")
+        with open(os.path.join(stream_dir, "rw"), "rb") as stream:
+            with self.assertRaises(GLib.GError):
+                BlockDev.btrfs_receive(TEST_MNT + "/received", stream.fileno())
+
+        # 'btrfs receive' exits early on a big invalid stream, its exit status
+        # has to be reported (even if feeding the rest of the stream fails)
+        with open(os.path.join(stream_dir, "rw"), "wb") as stream:
+            stream.write(os.urandom(8 * 1024**2))
+        with open(os.path.join(stream_dir, "rw"), "rb") as stream:
+            with six.assertRaisesRegex(self, GLib.GError, r"exited with code"):
+                BlockDev.btrfs_receive(TEST_MNT + "/received", stream.fileno())
+
 class BtrfsTestMkfs(BtrfsTestCase):
     def test_mkfs(self):
         """Verify that it is possible to create a btrfs filesystem"""
@@ -526,6 +930,64 @@ class FakeBtrfsUtilsTestCase(unittest.TestCase):
         # check that one of the weird subvols is in the list of subvolumes
         self.assertTrue(any(subvol for subvol in subvols if subvol.path == "docker/btrfs/subvolumes/f2062b736fbabbe4da752632ac4deae87fcb916add6d7d8f5cecee4cbdc41fd9"))
 
+    def _gen_subvol_forest(self, rng, num_subvols):
+        """Generate a random forest of subvolumes as (id, parent_id, path) tuples in random order"""
+
+        ids = rng.sample(range(256, 256 + 10 * num_subvols), num_subvols)
+        subvols = []
+        paths = {}
+        for i, subvol_id in enumerate(ids):
+            roll = rng.random()
+            if i == 0 or roll < 0.2:
+                # top-level subvolume
+                parent_id = BlockDev.BTRFS_MAIN_VOLUME_ID
+                paths[subvol_id] = "subvol%d" % subvol_id
+            elif roll < 0.3:
+                # parent not listed (e.g. only snapshots listed)
+                parent_id = 100000 + subvol_id
+                paths[subvol_id] = "orphan/subvol%d" % subvol_id
+            else:
+                # child of some of the already generated subvolumes
+                parent_id = rng.choice(ids[:i])
+                paths[subvol_id] = "%s/subvol%d" % (paths[parent_id], subvol_id)
+            subvols.append((subvol_id, parent_id, paths[subvol_id]))
+
+        rng.shuffle(subvols)
+        return subvols
+
+    def test_list_subvols_random_forests(self):
+        """Verify that list_subvolumes never lists a child before its parent"""
+
+        rng = random.Random(42)
+        fake_dir = tempfile.mkdtemp(prefix="libblockdev.", suffix="-btrfs_test")
+        data_file = os.path.join(fake_dir, "subvols")
+        with open(os.path.join(fake_dir, "btrfs"), "w") as f:
+            f.write("#!/bin/bash\n\ncat %s\n" % data_file)
+        os.chmod(os.path.join(fake_dir, "btrfs"), 0o755)
+
+        try:
+            for num_subvols in (1, 2, 5, 10, 50, 100, 1000, 5000):
+                subvols = self._gen_subvol_forest(rng, num_subvols)
+                with open(data_file, "w") as f:
+                    for (subvol_id, parent_id, path) in subvols:
+                        f.write("ID %d gen 1 parent %d top level %d path %s\n" % (subvol_id, parent_id, parent_id, path))
+
+                with fake_utils(fake_dir):
+                    listed = BlockDev.btrfs_list_subvolumes("fake_dev", False)
+
+                # nothing lost, nothing duplicated
+                self.assertEqual(sorted(subvol.id for subvol in listed), sorted(subvol[0] for subvol in subvols))
+
+                # no child before its parent
+                all_ids = set(subvol[0] for subvol in subvols)
+                seen = set()
+                for subvol in listed:
+                    if subvol.parent_id in all_ids:
+                        self.assertIn(subvol.parent_id, seen)
+                    seen.add(subvol.id)
+        finally:
+            shutil.rmtree(fake_dir)
+
 class BTRFSUnloadTest(unittest.TestCase):
     def tearDown(self):
         # make sure the library is initialized with all plugins loaded for other
@@ -5,6 +5,7 @@ import overrides_hack
 import shutil
 import subprocess
 import six
+import time
 
 from utils import create_sparse_tempfile
 from gi.repository import BlockDev, GLib
@@ -24,6 +25,31 @@ class CryptoTestGenerateBackupPassphrase(unittest.TestCase):
             bp = BlockDev.crypto_generate_backup_passphrase()
             six.assertRegex(self, bp, exp)
 
+class CryptoTestBenchmark(unittest.TestCase):
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_benchmark(self):
+        """Verify that cipher and PBKDF benchmarking works"""
+
+        results = BlockDev.crypto_benchmark()
+        self.assertTrue(results)
+        for res in results:
+            self.assertIn(res.mode, ("cbc", "xts"))
+            self.assertIn(res.key_size, (128, 256, 512))
+            self.assertGreater(res.encryption_speed, 0)
+            self.assertGreater(res.decryption_speed, 0)
+
+        # AES is available everywhere
+        self.assertTrue(any(res.cipher == "aes" and res.mode == "xts" for res in results))
+
+        iterations = BlockDev.crypto_benchmark_pbkdf()
+        self.assertGreater(iterations, 1000)
+
+        iterations = BlockDev.crypto_benchmark_pbkdf("sha512", 512)
+        self.assertGreater(iterations, 1000)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_benchmark_pbkdf("non-existing-hash")
+
 class CryptoTestCase(unittest.TestCase):
     def setUp(self):
         self.dev_file = create_sparse_tempfile("crypto_test", 1024**3)
@@ -81,6 +107,65 @@ class CryptoTestFormat(CryptoTestCase):
         succ = BlockDev.crypto_luks_format(self.loop_dev, "aes-cbc-essiv:sha256", 0, None, self.keyfile, 0)
         self.assertTrue(succ)
 
+class CryptoTestFormatAuto(CryptoTestCase):
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_format_auto(self):
+        """Verify that formatting device as LUKS with the automatically chosen cipher works"""
+
+        succ = BlockDev.crypto_luks_format(self.loop_dev, BlockDev.CRYPTO_LUKS_CIPHER_AUTO, 0, PASSWD, None, 0)
+        self.assertTrue(succ)
+
+        # benchmark results are noisy, just check one of the candidates was used
+        out = subprocess.check_output(["cryptsetup", "luksDump", self.loop_dev]).decode()
+        six.assertRegex(self, out, r"Cipher name:\s+(aes|serpent|twofish)")
+        six.assertRegex(self, out, r"Cipher mode:\s+xts-plain64")
+
+        # no XTS cipher can use a 128 bits long key
+        with six.assertRaisesRegex(self, GLib.GError, r"Invalid key size"):
+            BlockDev.crypto_luks_format(self.loop_dev, BlockDev.CRYPTO_LUKS_CIPHER_AUTO, 128, PASSWD, None, 0)
+
+class CryptoTestFormatLUKS2(CryptoTestCase):
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_format_luks2(self):
+        """Verify that formatting device as LUKS2 works"""
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_format_luks2(self.loop_dev, None, 0, PASSWD, None, 0, sector_size=1000)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_format_luks2(self.loop_dev, None, 0, PASSWD, None, 0, pbkdf="scrypt")
+
+        succ = BlockDev.crypto_luks_format_luks2(self.loop_dev, None, 0, PASSWD, self.keyfile, 0, sector_size=4096,
+                                                 pbkdf="argon2id", iter_time=100, max_memory_kb=32*1024, parallel_threads=1)
+        self.assertTrue(succ)
+
+        dump = subprocess.check_output(["cryptsetup", "luksDump", self.loop_dev]).decode()
+        six.assertRegex(self, dump, r"Version:\s+2")
+        six.assertRegex(self, dump, r"sector:\s+4096")
+        six.assertRegex(self, dump, r"PBKDF:\s+argon2id")
+        six.assertRegex(self, dump, r"Memory:\s+32768")
+        six.assertRegex(self, dump, r"Threads:\s+1")
+
+        # the other functions work with LUKS2 too
+        self.assertTrue(BlockDev.crypto_device_is_luks(self.loop_dev))
+        self.assertTrue(BlockDev.crypto_luks_uuid(self.loop_dev))
+
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD, None)
+        self.assertTrue(succ)
+        self.assertEqual(BlockDev.crypto_luks_status("libblockdevTestLUKS"), "active")
+        succ = BlockDev.crypto_luks_close("libblockdevTestLUKS")
+        self.assertTrue(succ)
+
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", None, self.keyfile)
+        self.assertTrue(succ)
+
+        # PBKDF2 ignores the Argon2-specific parameters
+        succ = BlockDev.crypto_luks_format_luks2(self.loop_dev2, None, 0, PASSWD, None, 0, pbkdf="pbkdf2",
+                                                 max_memory_kb=32*1024, parallel_threads=1)
+        self.assertTrue(succ)
+        dump = subprocess.check_output(["cryptsetup", "luksDump", self.loop_dev2]).decode()
+        six.assertRegex(self, dump, r"PBKDF:\s+pbkdf2")
+
 class CryptoTestResize(CryptoTestCase):
     @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
     def test_resize(self):
@@ -138,6 +223,243 @@ class CryptoTestOpenClose(CryptoTestCase):
         succ = BlockDev.crypto_luks_close("libblockdevTestLUKS")
         self.assertTrue(succ)
 
+class CryptoTestOpenFlags(CryptoTestCase):
+    def _get_table(self):
+        return subprocess.check_output(["dmsetup", "table", "libblockdevTestLUKS"]).decode()
+
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_luks_open_flags(self):
+        """Verify that opening LUKS device with flags and refreshing them works"""
+
+        succ = BlockDev.crypto_luks_format(self.loop_dev, None, 0, PASSWD, None, 0)
+        self.assertTrue(succ)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_open_with_flags(self.loop_dev, "libblockdevTestLUKS", None, None,
+                                                 BlockDev.CryptoLUKSOpenFlags.ALLOW_DISCARDS)
+
+        succ = BlockDev.crypto_luks_open_with_flags(self.loop_dev, "libblockdevTestLUKS", PASSWD, None,
+                                                    BlockDev.CryptoLUKSOpenFlags.ALLOW_DISCARDS)
+        self.assertTrue(succ)
+        self.assertIn("allow_discards", self._get_table())
+
+        flags = BlockDev.crypto_luks_get_flags("libblockdevTestLUKS")
+        self.assertTrue(flags & BlockDev.CryptoLUKSOpenFlags.ALLOW_DISCARDS)
+        self.assertFalse(flags & BlockDev.CryptoLUKSOpenFlags.SAME_CPU_CRYPT)
+
+        # replace the flags of the active mapping without closing it
+        succ = BlockDev.crypto_luks_refresh("libblockdevTestLUKS", PASSWD, None,
+                                            BlockDev.CryptoLUKSOpenFlags.SAME_CPU_CRYPT)
+        self.assertTrue(succ)
+
+        table = self._get_table()
+        self.assertNotIn("allow_discards", table)
+        self.assertIn("same_cpu_crypt", table)
+
+        flags = BlockDev.crypto_luks_get_flags("libblockdevTestLUKS")
+        self.assertFalse(flags & BlockDev.CryptoLUKSOpenFlags.ALLOW_DISCARDS)
+        self.assertTrue(flags & BlockDev.CryptoLUKSOpenFlags.SAME_CPU_CRYPT)
+
+        succ = BlockDev.crypto_luks_close("libblockdevTestLUKS")
+        self.assertTrue(succ)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_get_flags("libblockdevTestLUKS")
+
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_luks_open_performance_flags(self):
+        """Verify that the performance related open flags are applied to the mapping"""
+
+        succ = BlockDev.crypto_luks_format_luks2(self.loop_dev, None, 0, PASSWD, None, 0,
+                                                 4096, "pbkdf2", 1, 0, 0)
+        self.assertTrue(succ)
+
+        Flags = BlockDev.CryptoLUKSOpenFlags
+        variants = ((Flags.SAME_CPU_CRYPT, ["same_cpu_crypt"]),
+                    (Flags.SUBMIT_FROM_CRYPT_CPUS, ["submit_from_crypt_cpus"]),
+                    (Flags.NO_READ_WORKQUEUE | Flags.NO_WRITE_WORKQUEUE, ["no_read_workqueue", "no_write_workqueue"]))
+
+        data = os.urandom(1024**2)
+        for (flags, options) in variants:
+            try:
+                succ = BlockDev.crypto_luks_open_with_flags(self.loop_dev, "libblockdevTestLUKS", PASSWD, None, flags)
+            except GLib.GError as e:
+                if flags & Flags.NO_READ_WORKQUEUE:
+                    # requires kernel 5.9 or newer
+                    self.skipTest("dm-crypt doesn't support disabling the workqueues: %s" % e)
+                raise
+            self.assertTrue(succ)
+
+            table = self._get_table()
+            for option in options:
+                self.assertIn(option, table)
+            self.assertEqual(BlockDev.crypto_luks_get_flags("libblockdevTestLUKS") & flags, flags)
+
+            # data written through the mapping has to be read back unchanged
+            with open("/dev/mapper/libblockdevTestLUKS", "r+b") as f:
+                f.write(data)
+                f.flush()
+                os.fsync(f.fileno())
+                f.seek(0)
+                self.assertEqual(f.read(len(data)), data)
+
+            succ = BlockDev.crypto_luks_close("libblockdevTestLUKS")
+            self.assertTrue(succ)
+
+class CryptoTestOpenMany(CryptoTestCase):
+    def _close_all(self):
+        for name in ("libblockdevTestLUKS", "libblockdevTestLUKS2"):
+            try:
+                BlockDev.crypto_luks_close(name)
+            except GLib.GError:
+                pass
+
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_luks_open_many(self):
+        """Verify that opening multiple LUKS devices at once works"""
+
+        self.addCleanup(self._close_all)
+        devices = [self.loop_dev, self.loop_dev2]
+        names = ["libblockdevTestLUKS", "libblockdevTestLUKS2"]
+
+        succ = BlockDev.crypto_luks_format(self.loop_dev, None, 0, PASSWD, None, 0)
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_format(self.loop_dev2, None, 0, PASSWD, None, 0)
+        self.assertTrue(succ)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_open_many(devices, names, [PASSWD])
+
+        # one wrong passphrase doesn't prevent the other device from being opened
+        results = BlockDev.crypto_luks_open_many(devices, names, [PASSWD, "wrong-passphrase"])
+        self.assertEqual([r.device for r in results], devices)
+        self.assertEqual([r.name for r in results], names)
+        self.assertTrue(results[0].success)
+        self.assertIsNone(results[0].error_message)
+        self.assertFalse(results[1].success)
+        self.assertTrue(results[1].error_message)
+        self.assertTrue(os.path.exists("/dev/mapper/libblockdevTestLUKS"))
+        self.assertFalse(os.path.exists("/dev/mapper/libblockdevTestLUKS2"))
+        self._close_all()
+
+        # different volume keys, same passphrase
+        results = BlockDev.crypto_luks_open_many(devices, names, [PASSWD, PASSWD], True)
+        self.assertTrue(all(r.success for r in results))
+        self._close_all()
+
+        # shared volume key (cloned header)
+        os.system("dd if=%s of=%s bs=1M count=2 >/dev/null 2>&1" % (self.loop_dev, self.loop_dev2))
+        results = BlockDev.crypto_luks_open_many(devices, names, [PASSWD, PASSWD], True)
+        self.assertTrue(all(r.success for r in results))
+
+class CryptoTestReencrypt(CryptoTestCase):
+    def _wait_for_reencryption(self, timeout=120):
+        for _i in range(timeout * 10):
+            status = BlockDev.crypto_luks_reencrypt_status(self.loop_dev)
+            if status.state != BlockDev.CryptoLUKSReencryptState.RUNNING:
+                return status
+            time.sleep(0.1)
+        self.fail("Reencryption didn't finish in time")
+
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_reencrypt(self):
+        """Verify that online reencryption of LUKS2 device works"""
+
+        succ = BlockDev.crypto_luks_format_luks2(self.loop_dev, "aes-cbc-essiv:sha256", 256, PASSWD, None, 0,
+                                                 0, "pbkdf2", 1, 0, 0)
+        self.assertTrue(succ)
+
+        status = BlockDev.crypto_luks_reencrypt_status(self.loop_dev)
+        self.assertEqual(status.state, BlockDev.CryptoLUKSReencryptState.IDLE)
+
+        # LUKS1 devices cannot be reencrypted
+        succ = BlockDev.crypto_luks_format(self.loop_dev2, None, 0, PASSWD, None, 0)
+        self.assertTrue(succ)
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_reencrypt_start(self.loop_dev2, None, PASSWD)
+
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD, None)
+        self.assertTrue(succ)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_reencrypt_start(self.loop_dev, "libblockdevTestLUKS", "wrong-passphrase")
+
+        # slow enough to be still running when aborted
+        succ = BlockDev.crypto_luks_reencrypt_start(self.loop_dev, "libblockdevTestLUKS", PASSWD,
+                                                    "aes-xts-plain64", 512, 8 * 1024**2)
+        self.assertTrue(succ)
+
+        time.sleep(2)
+        status = BlockDev.crypto_luks_reencrypt_status(self.loop_dev)
+        self.assertEqual(status.state, BlockDev.CryptoLUKSReencryptState.RUNNING)
+        # the data segment without the LUKS2 header
+        self.assertGreater(status.size, 0)
+        self.assertLess(status.size, 1024**3)
+        self.assertLess(status.rate, 2 * 8 * 1024**2)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_reencrypt_start(self.loop_dev, "libblockdevTestLUKS", PASSWD)
+
+        succ = BlockDev.crypto_luks_reencrypt_abort(self.loop_dev)
+        self.assertTrue(succ)
+        status = BlockDev.crypto_luks_reencrypt_status(self.loop_dev)
+        self.assertEqual(status.state, BlockDev.CryptoLUKSReencryptState.INTERRUPTED)
+        self.assertGreater(status.processed, 0)
+        self.assertLess(status.processed, status.size)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_reencrypt_abort(self.loop_dev)
+
+        # resume it without the limit
+        succ = BlockDev.crypto_luks_reencrypt_start(self.loop_dev, "libblockdevTestLUKS", PASSWD)
+        self.assertTrue(succ)
+        status = self._wait_for_reencryption()
+        self.assertEqual(status.state, BlockDev.CryptoLUKSReencryptState.FINISHED)
+        self.assertEqual(status.processed, status.size)
+
+        out = subprocess.check_output(["cryptsetup", "luksDump", self.loop_dev]).decode()
+        self.assertIn("aes-xts-plain64", out)
+        self.assertNotIn("aes-cbc-essiv", out)
+
+        # the device stayed open and the passphrase still works
+        self.assertTrue(os.path.exists("/dev/mapper/libblockdevTestLUKS"))
+        succ = BlockDev.crypto_luks_close("libblockdevTestLUKS")
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD, None)
+        self.assertTrue(succ)
+
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_reencrypt_other_keys(self):
+        """Verify that reencryption doesn't drop other key slots unless asked to"""
+
+        succ = BlockDev.crypto_luks_format_luks2(self.loop_dev, "aes-cbc-essiv:sha256", 256, PASSWD, None, 0,
+                                                 0, "pbkdf2", 1, 0, 0)
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_add_key(self.loop_dev, PASSWD, None, PASSWD2, None)
+        self.assertTrue(succ)
+
+        # the second key slot would become unusable
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_reencrypt_start(self.loop_dev, None, PASSWD)
+        status = BlockDev.crypto_luks_reencrypt_status(self.loop_dev)
+        self.assertEqual(status.state, BlockDev.CryptoLUKSReencryptState.IDLE)
+
+        # nothing changed, both passphrases work
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD2, None)
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_close("libblockdevTestLUKS")
+        self.assertTrue(succ)
+
+        succ = BlockDev.crypto_luks_reencrypt_start(self.loop_dev, None, PASSWD, drop_other_keys=True)
+        self.assertTrue(succ)
+        status = self._wait_for_reencryption()
+        self.assertEqual(status.state, BlockDev.CryptoLUKSReencryptState.FINISHED)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD2, None)
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD, None)
+        self.assertTrue(succ)
+
 class CryptoTestAddKey(CryptoTestCase):
     @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
     def test_add_key(self):
@@ -180,6 +502,103 @@ class CryptoTestChangeKey(CryptoTestCase):
         succ = BlockDev.crypto_luks_change_key(self.loop_dev, PASSWD, PASSWD2)
         self.assertTrue(succ)
 
+class CryptoTestKeySession(CryptoTestCase):
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_key_session(self):
+        """Verify that key slot operations using a key session work"""
+
+        succ = BlockDev.crypto_luks_format(self.loop_dev, None, 0, PASSWD, None, 0)
+        self.assertTrue(succ)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_key_session_open(self.loop_dev, None, None)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_key_session_open(self.loop_dev, "wrong-passphrase", None)
+
+        session = BlockDev.crypto_luks_key_session_open(self.loop_dev, PASSWD, None)
+        self.assertTrue(session)
+        self.assertEqual(BlockDev.crypto_luks_key_session_get_keyslot(session), 0)
+
+        slot2 = BlockDev.crypto_luks_key_session_add_key(session, PASSWD2, None)
+        self.assertGreater(slot2, 0)
+        slot3 = BlockDev.crypto_luks_key_session_add_key(session, None, self.keyfile)
+        self.assertGreater(slot3, slot2)
+
+        # the new keys have to work
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD2, None)
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_close("libblockdevTestLUKS")
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", None, self.keyfile)
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_close("libblockdevTestLUKS")
+        self.assertTrue(succ)
+
+        succ = BlockDev.crypto_luks_key_session_remove_key(session, slot2)
+        self.assertTrue(succ)
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD2, None)
+
+        # replace the key the session was unlocked with
+        succ = BlockDev.crypto_luks_key_session_change_key(session, PASSWD3, None)
+        self.assertTrue(succ)
+        self.assertNotEqual(BlockDev.crypto_luks_key_session_get_keyslot(session), 0)
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD, None)
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD3, None)
+        self.assertTrue(succ)
+
+        succ = BlockDev.crypto_luks_key_session_close(session)
+        self.assertTrue(succ)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_key_session_close(session)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_key_session_add_key(session, PASSWD2, None)
+
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_key_session_external_change(self):
+        """Verify that a key session doesn't overwrite header changes done outside of it"""
+
+        succ = BlockDev.crypto_luks_format(self.loop_dev, None, 0, PASSWD, None, 0)
+        self.assertTrue(succ)
+
+        session = BlockDev.crypto_luks_key_session_open(self.loop_dev, PASSWD, None)
+        self.assertTrue(session)
+
+        # add a key outside of the session, the session must not drop it
+        succ = BlockDev.crypto_luks_add_key(self.loop_dev, PASSWD, None, PASSWD2, None)
+        self.assertTrue(succ)
+
+        slot = BlockDev.crypto_luks_key_session_add_key(session, None, self.keyfile)
+        self.assertGreater(slot, 1)
+
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD2, None)
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_close("libblockdevTestLUKS")
+        self.assertTrue(succ)
+
+        # remove a key outside of the session, the session must not bring it back
+        succ = BlockDev.crypto_luks_remove_key(self.loop_dev, PASSWD2, None)
+        self.assertTrue(succ)
+
+        succ = BlockDev.crypto_luks_key_session_change_key(session, PASSWD3, None)
+        self.assertTrue(succ)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD2, None)
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", None, self.keyfile)
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_close("libblockdevTestLUKS")
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD3, None)
+        self.assertTrue(succ)
+
+        succ = BlockDev.crypto_luks_key_session_close(session)
+        self.assertTrue(succ)
+
 class CryptoTestIsLuks(CryptoTestCase):
     @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
     def test_is_luks(self):
@@ -225,6 +644,55 @@ class CryptoTestLuksStatus(CryptoTestCase):
         with self.assertRaises(GLib.GError):
             BlockDev.crypto_luks_status("libblockdevTestLUKS")
 
+class CryptoTestListActive(CryptoTestCase):
+    def tearDown(self):
+        try:
+            BlockDev.crypto_luks_close("libblockdevTestLUKS2")
+        except:
+            pass
+
+        super(CryptoTestListActive, self).tearDown()
+
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_list_active(self):
+        """Verify that listing active dm-crypt mappings works"""
+
+        succ = BlockDev.crypto_luks_format(self.loop_dev, None, 0, PASSWD, None, 0)
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_format_luks2(self.loop_dev2, "aes-xts-plain64", 512, PASSWD, None, 0,
+                                                 4096, "pbkdf2", 1, 0, 0)
+        self.assertTrue(succ)
+
+        names = [dev.name for dev in BlockDev.crypto_list_active()]
+        self.assertNotIn("libblockdevTestLUKS", names)
+
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD, None)
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_open_with_flags(self.loop_dev2, "libblockdevTestLUKS2", PASSWD, None,
+                                                    BlockDev.CryptoLUKSOpenFlags.ALLOW_DISCARDS |
+                                                    BlockDev.CryptoLUKSOpenFlags.READONLY)
+        self.assertTrue(succ)
+
+        active = dict((dev.name, dev) for dev in BlockDev.crypto_list_active())
+        self.assertIn("libblockdevTestLUKS", active)
+        self.assertIn("libblockdevTestLUKS2", active)
+
+        dev = active["libblockdevTestLUKS"]
+        self.assertEqual(dev.backing_device, self.loop_dev)
+        self.assertEqual(dev.cipher, "aes-xts-plain64")
+        self.assertEqual(dev.key_size, 256)
+        self.assertEqual(dev.sector_size, 512)
+        self.assertEqual(dev.flags, 0)
+        self.assertGreater(dev.offset, 0)
+        self.assertTrue(dev.uuid.startswith("CRYPT-LUKS1-"))
+
+        dev = active["libblockdevTestLUKS2"]
+        self.assertEqual(dev.backing_device, self.loop_dev2)
+        self.assertEqual(dev.key_size, 512)
+        self.assertEqual(dev.sector_size, 4096)
+        self.assertEqual(dev.flags, BlockDev.CryptoLUKSOpenFlags.ALLOW_DISCARDS | BlockDev.CryptoLUKSOpenFlags.READONLY)
+        self.assertTrue(dev.uuid.startswith("CRYPT-LUKS2-"))
+
 class CryptoTestGetUUID(CryptoTestCase):
     @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
     def test_get_uuid(self):
@@ -239,6 +707,37 @@ class CryptoTestGetUUID(CryptoTestCase):
         with self.assertRaises(GLib.GError):
             uuid = BlockDev.crypto_luks_uuid(self.loop_dev2)
 
+class CryptoTestHeaderChanges(CryptoTestCase):
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_header_changes(self):
+        """Verify that changes of the LUKS header are always picked up"""
+
+        succ = BlockDev.crypto_luks_format(self.loop_dev, None, 0, PASSWD, None, 0)
+        self.assertTrue(succ)
+
+        self.assertTrue(BlockDev.crypto_device_is_luks(self.loop_dev))
+        uuid = BlockDev.crypto_luks_uuid(self.loop_dev)
+        self.assertTrue(uuid)
+
+        # changed by us
+        succ = BlockDev.crypto_luks_add_key(self.loop_dev, PASSWD, None, PASSWD2, None)
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_open(self.loop_dev, "libblockdevTestLUKS", PASSWD2, None)
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_close("libblockdevTestLUKS")
+        self.assertTrue(succ)
+
+        # changed behind our back
+        new_uuid = "d8be9d2c-6d38-4bd1-b7c4-5e4b4ba1e0b5"
+        os.system("cryptsetup luksUUID --batch-mode --uuid %s %s >/dev/null 2>&1" % (new_uuid, self.loop_dev))
+        self.assertEqual(BlockDev.crypto_luks_uuid(self.loop_dev), new_uuid)
+
+        succ = BlockDev.crypto_luks_format(self.loop_dev2, None, 0, PASSWD, None, 0)
+        self.assertTrue(succ)
+        self.assertTrue(BlockDev.crypto_device_is_luks(self.loop_dev2))
+        os.system("wipefs -a %s >/dev/null 2>&1" % self.loop_dev2)
+        self.assertFalse(BlockDev.crypto_device_is_luks(self.loop_dev2))
+
 class CryptoTestLuksOpenRW(CryptoTestCase):
     @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
     def test_luks_open_rw(self):
@@ -360,3 +859,44 @@ class CryptoTestEscrow(CryptoTestCase):
         # Check that the backup passphrase works
         succ = BlockDev.crypto_luks_open(self.loop_dev, 'libblockdevTestLUKS', backup_passphrase, None)
         self.assertTrue(succ)
+
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_escrow_devices(self):
+        """Verify that escrow data can be created for multiple devices at once"""
+
+        succ = BlockDev.crypto_luks_format(self.loop_dev, None, 0, PASSWD, None, 0)
+        self.assertTrue(succ)
+        succ = BlockDev.crypto_luks_format(self.loop_dev2, None, 0, PASSWD2, None, 0)
+        self.assertTrue(succ)
+
+        escrow_dir = tempfile.mkdtemp(prefix='libblockdev_test_escrow')
+        self.addCleanup(shutil.rmtree, escrow_dir)
+        with open(self.public_cert, 'rb') as cert_file:
+            cert_data = cert_file.read()
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_escrow_devices([self.loop_dev, self.loop_dev2], [PASSWD], cert_data, escrow_dir)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.crypto_escrow_devices([self.loop_dev], [PASSWD], b"not a certificate", escrow_dir)
+
+        backup_passphrases = [BlockDev.crypto_generate_backup_passphrase() for _i in range(3)]
+        results = BlockDev.crypto_escrow_devices([self.loop_dev, self.loop_dev2, self.loop_dev2],
+                                                 [PASSWD, PASSWD2, "wrong-passphrase"],
+                                                 cert_data, escrow_dir, backup_passphrases)
+        self.assertEqual(len(results), 3)
+        self.assertEqual([res.device for res in results], [self.loop_dev, self.loop_dev2, self.loop_dev2])
+        self.assertTrue(results[0].success)
+        self.assertTrue(results[1].success)
+        self.assertFalse(results[2].success)
+        self.assertTrue(results[2].error_message)
+
+        for (dev, backup_passphrase) in ((self.loop_dev, backup_passphrases[0]), (self.loop_dev2, backup_passphrases[1])):
+            uuid = BlockDev.crypto_luks_uuid(dev)
+            self.assertTrue(os.path.isfile("%s/%s-escrow" % (escrow_dir, uuid)))
+            self.assertTrue(os.path.isfile("%s/%s-escrow-backup-passphrase" % (escrow_dir, uuid)))
+
+            succ = BlockDev.crypto_luks_open(dev, 'libblockdevTestLUKS', backup_passphrase, None)
+            self.assertTrue(succ)
+            succ = BlockDev.crypto_luks_close('libblockdevTestLUKS')
+            self.assertTrue(succ)
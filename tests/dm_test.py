@@ -66,6 +66,41 @@ class DevMapperMapExists(DevMapperTestCase):
         succ = BlockDev.dm_map_exists("testMap", False, False)
         self.assertFalse(succ)
 
+class DevMapperListMaps(DevMapperTestCase):
+    def test_list_maps(self):
+        """Verify that listing DM maps works as expected"""
+
+        names = [m.name for m in BlockDev.dm_list_maps()]
+        self.assertNotIn("testMap", names)
+
+        succ = BlockDev.dm_create_linear("testMap", self.loop_dev, 100, "LIBBLOCKDEV-TEST-MAP")
+        self.assertTrue(succ)
+
+        maps = dict((m.name, m) for m in BlockDev.dm_list_maps())
+        self.assertIn("testMap", maps)
+
+        test_map = maps["testMap"]
+        self.assertEqual(test_map.uuid, "LIBBLOCKDEV-TEST-MAP")
+        self.assertEqual(test_map.target_types, ["linear"])
+        self.assertEqual(test_map.open_count, 0)
+        self.assertFalse(test_map.suspended)
+        self.assertTrue(test_map.live_table)
+        self.assertEqual("dm-%d" % test_map.minor, BlockDev.dm_node_from_name("testMap"))
+
+        with open("/sys/block/%s/dev" % self.loop_dev.split("/")[-1], "r") as f:
+            loop_dev_t = f.read().strip()
+        self.assertEqual(test_map.deps, [loop_dev_t])
+
+        os.system("dmsetup suspend testMap")
+        maps = dict((m.name, m) for m in BlockDev.dm_list_maps())
+        self.assertTrue(maps["testMap"].suspended)
+
+        succ = BlockDev.dm_remove("testMap")
+        self.assertTrue(succ)
+
+        names = [m.name for m in BlockDev.dm_list_maps()]
+        self.assertNotIn("testMap", names)
+
 class DevMapperNameNodeBijection(DevMapperTestCase):
     def test_name_node_bijection(self):
         """Verify that the map's node and map name points to each other"""
@@ -78,6 +113,135 @@ class DevMapperNameNodeBijection(DevMapperTestCase):
 
         self.assertTrue(succ)
 
+class DevMapperRaidRescan(DevMapperTestCase):
+    def test_raid_rescan(self):
+        """Verify that RAID sets can be rescanned and the cache survives device changes"""
+
+        succ = BlockDev.dm_raid_rescan()
+        self.assertTrue(succ)
+
+        # no firmware RAID on the loop device, both with the fresh scan and
+        # after a new block device (invalidating the cached scan) appears
+        with self.assertRaises(GLib.GError):
+            BlockDev.dm_get_member_raid_sets(self.loop_dev.split("/")[-1], None, -1, -1)
+
+        succ = BlockDev.dm_create_linear("testMap", self.loop_dev, 100, None)
+        self.assertTrue(succ)
+        os.system("udevadm settle")
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.dm_get_member_raid_sets(self.loop_dev.split("/")[-1], None, -1, -1)
+
+        succ = BlockDev.dm_remove("testMap")
+        self.assertTrue(succ)
+
+class DevMapperRaidCache(unittest.TestCase):
+    # IMSM metadata lives at the end of the devices
+    METADATA_SIZE = 1024**2
+
+    def setUp(self):
+        self.dev_files = []
+        self.loop_devs = []
+        for i in range(2):
+            self.dev_files.append(create_sparse_tempfile("dm_raid_test%d" % i, 1024**3))
+            succ, loop = BlockDev.loop_setup(self.dev_files[-1])
+            if not succ:
+                raise RuntimeError("Failed to setup loop device for testing")
+            self.loop_devs.append("/dev/%s" % loop)
+
+        # create a firmware RAID (IMSM) set on the loop devices and stop it so
+        # that only the metadata is left
+        ret = os.system("IMSM_NO_PLATFORM=1 mdadm --create /dev/md/bd_test_imsm --run --metadata=imsm "
+                        "--raid-devices=2 %s >/dev/null 2>&1" % " ".join(self.loop_devs))
+        if ret != 0:
+            self._clean_up()
+            self.skipTest("cannot create IMSM metadata")
+        os.system("IMSM_NO_PLATFORM=1 mdadm --create /dev/md/bd_test_vol --run --level=1 --raid-devices=2 "
+                  "/dev/md/bd_test_imsm >/dev/null 2>&1")
+        os.system("udevadm settle")
+        os.system("mdadm --stop /dev/md/bd_test_vol >/dev/null 2>&1")
+        os.system("mdadm --stop /dev/md/bd_test_imsm >/dev/null 2>&1")
+        os.system("udevadm settle")
+
+    def _clean_up(self):
+        try:
+            BlockDev.dm_remove("testMap")
+        except:
+            pass
+        os.system("mdadm --stop /dev/md/bd_test_vol >/dev/null 2>&1")
+        os.system("mdadm --stop /dev/md/bd_test_imsm >/dev/null 2>&1")
+        for loop_dev in self.loop_devs:
+            os.system("mdadm --zero-superblock %s >/dev/null 2>&1" % loop_dev)
+            BlockDev.loop_teardown(loop_dev)
+        for dev_file in self.dev_files:
+            os.unlink(dev_file)
+
+        # do not leave the stale RAID set cached for the other tests
+        BlockDev.dm_raid_rescan()
+
+    def tearDown(self):
+        self._clean_up()
+
+    def _swap_metadata(self, dev_file, data):
+        """Replace the metadata area of the backing @dev_file with @data (without
+           any udev events being generated), return the original data"""
+
+        with open(dev_file, "r+b") as f:
+            f.seek(-self.METADATA_SIZE, os.SEEK_END)
+            old_data = f.read(self.METADATA_SIZE)
+            f.seek(-self.METADATA_SIZE, os.SEEK_END)
+            f.write(data)
+            f.flush()
+            os.fsync(f.fileno())
+        return old_data
+
+    def _flush_buffers(self):
+        for loop_dev in self.loop_devs:
+            os.system("blockdev --flushbufs %s" % loop_dev)
+
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_raid_cache(self):
+        """Verify that discovered RAID sets are cached until a block device is added"""
+
+        member = self.loop_devs[0].split("/")[-1]
+
+        # hide the metadata and scan, nothing should be found
+        saved = [self._swap_metadata(dev_file, b"\0" * self.METADATA_SIZE) for dev_file in self.dev_files]
+        self._flush_buffers()
+        succ = BlockDev.dm_raid_rescan()
+        self.assertTrue(succ)
+        with self.assertRaises(GLib.GError):
+            BlockDev.dm_get_member_raid_sets(member, None, -1, -1)
+
+        # put the metadata back behind the library's back (no block device was
+        # added or removed), the cached scan should still be used
+        for dev_file, data in zip(self.dev_files, saved):
+            self._swap_metadata(dev_file, data)
+        self._flush_buffers()
+        with self.assertRaises(GLib.GError):
+            BlockDev.dm_get_member_raid_sets(member, None, -1, -1)
+
+        # a new block device appears, the cache should be dropped and the RAID
+        # set found by the new scan
+        succ = BlockDev.dm_create_linear("testMap", self.loop_devs[0], 100, None)
+        self.assertTrue(succ)
+        os.system("udevadm settle")
+
+        sets = BlockDev.dm_get_member_raid_sets(member, None, -1, -1)
+        self.assertTrue(sets)
+        self.assertTrue(all(s.startswith("isw_") for s in sets))
+
+        succ = BlockDev.dm_remove("testMap")
+        self.assertTrue(succ)
+        os.system("udevadm settle")
+
+        # removing a block device also drops the cache
+        for dev_file in self.dev_files:
+            self._swap_metadata(dev_file, b"\0" * self.METADATA_SIZE)
+        self._flush_buffers()
+        with self.assertRaises(GLib.GError):
+            BlockDev.dm_get_member_raid_sets(member, None, -1, -1)
+
 class DMUnloadTest(unittest.TestCase):
     def tearDown(self):
         # make sure the library is initialized with all plugins loaded for other
@@ -184,6 +184,100 @@ class LvmNoDevTestCase(unittest.TestCase):
         with self.assertRaises(GLib.GError):
             BlockDev.lvm_cache_get_mode_from_str("bla")
 
+class LvmTestCompactReports(unittest.TestCase):
+    def _get_items(self, array):
+        items = [array.get_item(i) for i in range(array.n_items)]
+        self.assertIsNone(array.get_item(array.n_items))
+        return items
+
+    def test_pvs_compact(self):
+        """Verify that parsing the compact PVs report works as expected"""
+
+        with fake_utils("tests/lvm_compact_report/"):
+            pvs = BlockDev.lvm_pvs_compact()
+        pvs = self._get_items(pvs)
+
+        # the warning line is skipped
+        self.assertEqual([pv.pv_name for pv in pvs], ["/dev/sda1", "/dev/sdb1", "/dev/sdd"])
+        self.assertEqual(pvs[0].pv_uuid, "pv-uuid-1")
+        self.assertEqual(pvs[0].pe_start, 1048576)
+        self.assertEqual(pvs[1].pv_free, 4194304)
+        self.assertEqual(pvs[1].vg_name, "testVG")
+        self.assertEqual(pvs[1].vg_extent_count, 2)
+        self.assertEqual(pvs[1].vg_pv_count, 2)
+
+        # empty fields (PV not in any VG)
+        self.assertEqual(pvs[2].pv_free, 10485760)
+        self.assertEqual(pvs[2].vg_name, "")
+        self.assertEqual(pvs[2].vg_uuid, "")
+        self.assertEqual(pvs[2].vg_size, 0)
+        self.assertEqual(pvs[2].vg_pv_count, 0)
+
+    def test_vgs_compact(self):
+        """Verify that parsing the compact VGs report works as expected"""
+
+        with fake_utils("tests/lvm_compact_report/"):
+            vgs = BlockDev.lvm_vgs_compact()
+        vgs = self._get_items(vgs)
+
+        # tabs separate fields too and empty lines are skipped
+        self.assertEqual([vg.name for vg in vgs], ["testVG", "testVG2"])
+        self.assertEqual(vgs[0].uuid, "vg-uuid-1")
+        self.assertEqual(vgs[0].size, 8388608)
+        self.assertEqual(vgs[0].free, 4194304)
+        self.assertEqual(vgs[1].extent_size, 4194304)
+        self.assertEqual(vgs[1].free_count, 0)
+        self.assertEqual(vgs[1].pv_count, 1)
+
+    def test_lvs_compact(self):
+        """Verify that parsing the compact LVs report works as expected"""
+
+        with fake_utils("tests/lvm_compact_report/"):
+            lvs = BlockDev.lvm_lvs_compact(None)
+        lvs = self._get_items(lvs)
+
+        self.assertEqual([(lv.vg_name, lv.lv_name) for lv in lvs],
+                         [("testVG", "testLV"), ("testVG", "[testPool_tdata]"), ("testVG2", "testLV")])
+        self.assertEqual(lvs[0].size, 4194304)
+        self.assertEqual(lvs[0].attr, "-wi-a-----")
+        self.assertEqual(lvs[0].segtype, "linear")
+
+        # the output is unquoted, values are taken verbatim (including any
+        # quotes and '=' characters)
+        self.assertEqual(lvs[1].uuid, "lv=uuid=2")
+        self.assertEqual(lvs[1].attr, "'Twi-aotz--'")
+        self.assertEqual(lvs[1].segtype, '"thin-pool"')
+
+        # empty fields, unknown fields are ignored
+        self.assertEqual(lvs[2].uuid, "lv-uuid-3")
+        self.assertEqual(lvs[2].size, 0)
+        self.assertEqual(lvs[2].attr, "")
+        self.assertEqual(lvs[2].segtype, "")
+        self.assertIsNone(lvs[2].origin)
+
+    def test_compact_no_valid_items(self):
+        """Verify that empty and invalid compact reports are handled properly"""
+
+        with fake_utils("tests/lvm_compact_report/"):
+            os.environ["LVM_REPORT_VARIANT"] = "empty"
+            try:
+                self.assertEqual(BlockDev.lvm_pvs_compact().n_items, 0)
+                self.assertEqual(BlockDev.lvm_vgs_compact().n_items, 0)
+                self.assertEqual(BlockDev.lvm_lvs_compact(None).n_items, 0)
+            finally:
+                del os.environ["LVM_REPORT_VARIANT"]
+
+            os.environ["LVM_REPORT_VARIANT"] = "invalid"
+            try:
+                with six.assertRaisesRegex(self, GLib.GError, "Failed to parse"):
+                    BlockDev.lvm_pvs_compact()
+                with six.assertRaisesRegex(self, GLib.GError, "Failed to parse"):
+                    BlockDev.lvm_vgs_compact()
+                with six.assertRaisesRegex(self, GLib.GError, "Failed to parse"):
+                    BlockDev.lvm_lvs_compact(None)
+            finally:
+                del os.environ["LVM_REPORT_VARIANT"]
+
 class LvmPVonlyTestCase(unittest.TestCase):
     # :TODO:
     #     * test pvmove (must create two PVs, a VG, a VG and some data in it
@@ -620,6 +714,68 @@ class LvmTestLVactivateDeactivate(LvmPVVGLVTestCase):
         succ = BlockDev.lvm_lvdeactivate("testVG", "testLV")
         self.assertTrue(succ)
 
+class LvmTestActivateMany(LvmPVVGLVTestCase):
+    def tearDown(self):
+        try:
+            BlockDev.lvm_vgremove("testVG2")
+        except:
+            pass
+
+        LvmPVVGLVTestCase.tearDown(self)
+
+    def test_activate_many(self):
+        """Verify it's possible to activate multiple VGs and LVs at once"""
+
+        succ = BlockDev.lvm_pvcreate(self.loop_dev, 0, 0)
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_pvcreate(self.loop_dev2, 0, 0)
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_vgcreate("testVG", [self.loop_dev], 0)
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_vgcreate("testVG2", [self.loop_dev2], 0)
+        self.assertTrue(succ)
+
+        for vg in ("testVG", "testVG2"):
+            for lv in ("testLV", "testLV2"):
+                succ = BlockDev.lvm_lvcreate(vg, lv, 128 * 1024**2, None, None)
+                self.assertTrue(succ)
+
+        succ = BlockDev.lvm_vgdeactivate("testVG")
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_vgdeactivate("testVG2")
+        self.assertTrue(succ)
+
+        # invalid specifications should be refused
+        with self.assertRaises(GLib.GError):
+            BlockDev.lvm_activate_many(["testVG/"], False, 0)
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.lvm_activate_many(["testVG/testLV/testLV2"], False, 0)
+
+        names = ["testVG", "testVG2/testLV", "testVG2/nonexistingLV", "testVG2/testLV2", "nonexistingVG/testLV"]
+        results = BlockDev.lvm_activate_many(names, False, 0)
+        self.assertEqual([res.name for res in results], names)
+        self.assertEqual([res.success for res in results], [True, True, False, True, False])
+        self.assertIsNone(results[0].error_message)
+        self.assertTrue(results[2].error_message)
+        self.assertTrue(results[4].error_message)
+
+        for vg in ("testVG", "testVG2"):
+            for lv in ("testLV", "testLV2"):
+                info = BlockDev.lvm_lvinfo(vg, lv)
+                self.assertEqual(info.attr[4], "a")
+
+        # sequential processing should give the same results
+        succ = BlockDev.lvm_vgdeactivate("testVG2")
+        self.assertTrue(succ)
+
+        results = BlockDev.lvm_activate_many(["testVG2/testLV", "testVG2/testLV2"], False, 1)
+        self.assertTrue(all(res.success for res in results))
+
 class LvmTestLVresize(LvmPVVGLVTestCase):
     def test_lvresize(self):
         """Verify that it's possible to resize an LV"""
@@ -849,6 +1005,51 @@ class LvmTestThLVcreate(LvmPVVGLVthLVTestCase):
         pool = BlockDev.lvm_thlvpoolname("testVG", "testThLV")
         self.assertEqual(pool, "testPool")
 
+class LvmTestLVsEx(LvmPVVGLVthLVTestCase):
+    def test_lvs_ex(self):
+        """Verify that extended information about LVs can be gathered in one go"""
+
+        succ = BlockDev.lvm_pvcreate(self.loop_dev, 0, 0)
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_pvcreate(self.loop_dev2, 0, 0)
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_vgcreate("testVG", [self.loop_dev, self.loop_dev2], 0)
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_thpoolcreate("testVG", "testPool", 512 * 1024**2, 4 * 1024**2, 512 * 1024, None)
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_thlvcreate("testVG", "testPool", "testThLV", 1024**3)
+        self.assertTrue(succ)
+
+        # no extended fields requested -> nothing extra filled in
+        lvs = BlockDev.lvm_lvs_ex("testVG", 0)
+        pool = next(info for info in lvs if info.lv_name == "testPool")
+        self.assertIsNone(pool.data_lv)
+        self.assertIsNone(pool.devices)
+
+        fields = BlockDev.LVMLVFields.POOL_LV | BlockDev.LVMLVFields.DATA_LV | BlockDev.LVMLVFields.METADATA_LV | \
+                 BlockDev.LVMLVFields.DATA_PERCENT | BlockDev.LVMLVFields.DEVICES | BlockDev.LVMLVFields.STRIPES
+        lvs = BlockDev.lvm_lvs_ex("testVG", fields)
+
+        # every LV should be reported only once
+        self.assertEqual(len(lvs), len(set(info.uuid for info in lvs)))
+
+        pool = next(info for info in lvs if info.lv_name == "testPool")
+        self.assertEqual(pool.data_lv, BlockDev.lvm_data_lv_name("testVG", "testPool"))
+        self.assertEqual(pool.metadata_lv, BlockDev.lvm_metadata_lv_name("testVG", "testPool"))
+        self.assertGreaterEqual(pool.data_percent, 0.0)
+
+        thlv = next(info for info in lvs if info.lv_name == "testThLV")
+        self.assertEqual(thlv.pool_lv, "testPool")
+        self.assertEqual(thlv.pool_lv, BlockDev.lvm_thlvpoolname("testVG", "testThLV"))
+
+        tdata = next(info for info in lvs if info.lv_name == "[testPool_tdata]")
+        self.assertTrue(any(dev in tdata.devices for dev in (self.loop_dev, self.loop_dev2)))
+        self.assertEqual(tdata.stripes, 1)
+
 class LvmPVVGLVthLVsnapshotTestCase(LvmPVVGLVthLVTestCase):
     def tearDown(self):
         BlockDev.lvm_lvremove("testVG", "testThLV_bak", True)
@@ -974,6 +1175,61 @@ class LvmPVVGcachedLVTestCase(LvmPVVGLVTestCase):
                                                    [self.loop_dev], [self.loop_dev2])
         self.assertTrue(succ)
 
+class LvmPVVGcachedLVlayoutTestCase(LvmPVVGLVTestCase):
+    def tearDown(self):
+        try:
+            BlockDev.lvm_lvremove("testVG", "testLV2", True)
+        except:
+            pass
+
+        LvmPVVGLVTestCase.tearDown(self)
+
+    @unittest.skipIf("SKIP_SLOW" in os.environ, "skipping slow tests")
+    def test_create_cached_lv_layout(self):
+        """Verify that creating a cached LV in a single step gives the same layout as step by step"""
+
+        succ = BlockDev.lvm_pvcreate(self.loop_dev, 0, 0)
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_pvcreate(self.loop_dev2, 0, 0)
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_vgcreate("testVG", [self.loop_dev, self.loop_dev2], 0)
+        self.assertTrue(succ)
+
+        # two lvm runs (lvcreate --type cache-pool + lvcreate --type cache)
+        succ = BlockDev.lvm_cache_create_cached_lv("testVG", "testLV", 256 * 1024**2, 128 * 1024**2, 0,
+                                                   BlockDev.LVMCacheMode.WRITETHROUGH, 0,
+                                                   [self.loop_dev], [self.loop_dev2])
+        self.assertTrue(succ)
+
+        # five lvm runs (the STRIPED flag forces the pool to be created step by step)
+        succ = BlockDev.lvm_cache_create_pool("testVG", "testLV2_cache", 128 * 1024**2, 0, BlockDev.LVMCacheMode.WRITETHROUGH,
+                                              BlockDev.LVMCachePoolFlags.STRIPED, [self.loop_dev2])
+        self.assertTrue(succ)
+        succ = BlockDev.lvm_lvcreate("testVG", "testLV2", 256 * 1024**2, None, [self.loop_dev])
+        self.assertTrue(succ)
+        succ = BlockDev.lvm_cache_attach("testVG", "testLV2", "testLV2_cache")
+        self.assertTrue(succ)
+
+        lvs = BlockDev.lvm_lvs_ex("testVG", BlockDev.LVMLVFields.DEVICES)
+
+        # both ways should give the same result
+        for lv in ("testLV", "testLV2"):
+            info = BlockDev.lvm_lvinfo("testVG", lv)
+            self.assertEqual(info.segtype, "cache")
+            self.assertEqual(info.size, 256 * 1024**2)
+            self.assertEqual(BlockDev.lvm_cache_pool_name("testVG", lv), lv + "_cache")
+
+            # the origin (data) has to be on the slow PV and the cache data on the fast PV
+            orig = next(info for info in lvs if info.lv_name == "[%s_corig]" % lv)
+            self.assertIn(self.loop_dev + "(", orig.devices)
+            self.assertNotIn(self.loop_dev2 + "(", orig.devices)
+
+            cdata = next(info for info in lvs if info.lv_name.startswith("[%s_cache" % lv) and info.lv_name.endswith("_cdata]"))
+            self.assertIn(self.loop_dev2 + "(", cdata.devices)
+            self.assertNotIn(self.loop_dev + "(", cdata.devices)
+
 class LvmPVVGcachedLVpoolTestCase(LvmPVVGLVTestCase):
     def test_cache_get_pool_name(self):
         """Verify that it is possible to get the name of the cache pool"""
@@ -1026,6 +1282,48 @@ class LvmPVVGcachedLVstatsTestCase(LvmPVVGLVTestCase):
         self.assertEqual(stats.md_size, 8 * 1024**2)
         self.assertEqual(stats.mode, BlockDev.LVMCacheMode.WRITETHROUGH)
 
+class LvmPVVGwritecachedLVTestCase(LvmPVVGLVTestCase):
+    def test_writecache_create_stats_detach(self):
+        """Verify that it is possible to create a writecache cached LV, get its stats and detach the cache"""
+
+        succ = BlockDev.lvm_pvcreate(self.loop_dev, 0, 0)
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_pvcreate(self.loop_dev2, 0, 0)
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_vgcreate("testVG", [self.loop_dev, self.loop_dev2], 0)
+        self.assertTrue(succ)
+
+        succ = BlockDev.lvm_writecache_create_cached_lv("testVG", "testLV", 512 * 1024**2, 256 * 1024**2,
+                                                        [self.loop_dev], [self.loop_dev2])
+        self.assertTrue(succ)
+
+        info = BlockDev.lvm_lvinfo("testVG", "testLV")
+        self.assertEqual(info.segtype, "writecache")
+
+        stats = BlockDev.lvm_writecache_stats("testVG", "testLV")
+        self.assertTrue(stats)
+        self.assertEqual(stats.error, 0)
+        self.assertGreater(stats.block_size, 0)
+        # part of the cache LV is used for the writecache metadata
+        self.assertLessEqual(stats.total_blocks * stats.block_size, 256 * 1024**2)
+        self.assertLessEqual(stats.free_blocks, stats.total_blocks)
+
+        # a dm-cache stats query on a writecache LV should fail
+        with six.assertRaisesRegex(self, GLib.GError, "not a cached LV"):
+            BlockDev.lvm_cache_stats("testVG", "testLV")
+
+        # detach and do not destroy the cache LV
+        succ = BlockDev.lvm_writecache_detach("testVG", "testLV", False)
+        self.assertTrue(succ)
+
+        lvs = BlockDev.lvm_lvs("testVG")
+        self.assertTrue(any(info.lv_name == "testLV_writecache" for info in lvs))
+
+        with self.assertRaises(GLib.GError):
+            BlockDev.lvm_writecache_stats("testVG", "testLV")
+
 class LVMUnloadTest(unittest.TestCase):
     def tearDown(self):
         # make sure the library is initialized with all plugins loaded for other